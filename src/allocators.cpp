@@ -4,6 +4,8 @@
 
 #include "allocators.h"
 
+#include <algorithm>
+
 #ifdef WIN32
 #ifdef _WIN32_WINNT
 #undef _WIN32_WINNT
@@ -64,3 +66,68 @@ bool MemoryPageLocker::Unlock(const void* addr, size_t len)
 LockedPageManager::LockedPageManager() : LockedPageManagerBase<MemoryPageLocker>(GetSystemPageSize())
 {
 }
+
+const size_t CPoolArena::ALIGNMENT;
+const size_t CPoolArena::MAX_OBJECT_SIZE;
+const size_t CPoolArena::CHUNK_MIN_SIZE;
+const size_t CPoolArena::CHUNK_MAX_SIZE;
+
+CPoolArena::CPoolArena() : nChunkBytes(0), pNext(NULL), pEnd(NULL), nObjects(0), nUsedBytes(0)
+{
+    memset(vFree, 0, sizeof(vFree));
+}
+
+CPoolArena::~CPoolArena()
+{
+    for (std::vector<char*>::iterator it = vChunks.begin(); it != vChunks.end(); ++it)
+        ::operator delete(*it);
+}
+
+void* CPoolArena::Allocate(size_t nSize)
+{
+    if (nSize > MAX_OBJECT_SIZE)
+        return NULL;
+    size_t nClass = nSize == 0 ? 0 : (nSize - 1) / ALIGNMENT;
+    size_t nBytes = (nClass + 1) * ALIGNMENT;
+
+    void* p = vFree[nClass];
+    if (p != NULL) {
+        vFree[nClass] = *static_cast<void**>(p);
+    } else {
+        if ((size_t)(pEnd - pNext) < nBytes) {
+            // Every new chunk is as large as the arena so far, so that the many
+            // short-lived caches stay small while a large cache needs few chunks
+            size_t nChunkSize = vChunks.empty() ? CHUNK_MIN_SIZE : std::min(CHUNK_MAX_SIZE, nChunkBytes);
+            pNext = static_cast<char*>(::operator new(nChunkSize));
+            pEnd = pNext + nChunkSize;
+            vChunks.push_back(pNext);
+            nChunkBytes += nChunkSize;
+        }
+        p = pNext;
+        pNext += nBytes;
+    }
+    nObjects++;
+    nUsedBytes += nBytes;
+    return p;
+}
+
+void CPoolArena::Deallocate(void* p, size_t nSize)
+{
+    size_t nClass = nSize == 0 ? 0 : (nSize - 1) / ALIGNMENT;
+    *static_cast<void**>(p) = vFree[nClass];
+    vFree[nClass] = p;
+    nObjects--;
+    nUsedBytes -= (nClass + 1) * ALIGNMENT;
+}
+
+void CPoolArena::Release()
+{
+    if (nObjects != 0)
+        return;
+    for (std::vector<char*>::iterator it = vChunks.begin(); it != vChunks.end(); ++it)
+        ::operator delete(*it);
+    std::vector<char*>().swap(vChunks);
+    nChunkBytes = 0;
+    pNext = pEnd = NULL;
+    memset(vFree, 0, sizeof(vFree));
+}
@@ -259,6 +259,104 @@ struct zero_after_free_allocator : public std::allocator<T> {
     }
 };
 
+/**
+ * Arena for many small objects of a few distinct sizes, such as the nodes of
+ * a hash map. Memory is carved out of chunks that grow up to CHUNK_MAX_SIZE
+ * and is recycled through one free list per size class, which avoids the
+ * per-object malloc overhead and the heap fragmentation of millions of small
+ * allocations. Not thread-safe: an arena belongs to a single container.
+ */
+class CPoolArena
+{
+public:
+    static const size_t ALIGNMENT = 16;
+    static const size_t MAX_OBJECT_SIZE = 256;
+    static const size_t CHUNK_MIN_SIZE = 4096;
+    static const size_t CHUNK_MAX_SIZE = 256 * 1024;
+
+    CPoolArena();
+    ~CPoolArena();
+
+    //! Returns NULL for objects larger than MAX_OBJECT_SIZE, which the caller allocates itself
+    void* Allocate(size_t nSize);
+    void Deallocate(void* p, size_t nSize);
+
+    //! Give all chunks back to the heap once no object is allocated anymore
+    void Release();
+
+    //! Bytes held by the arena, including free slots
+    size_t DynamicMemoryUsage() const { return nChunkBytes; }
+    //! Bytes in the slots of the live objects
+    size_t GetUsedBytes() const { return nUsedBytes; }
+    size_t GetObjectCount() const { return nObjects; }
+
+private:
+    std::vector<char*> vChunks;
+    size_t nChunkBytes;
+    char* pNext;
+    char* pEnd;
+    void* vFree[MAX_OBJECT_SIZE / ALIGNMENT];
+    size_t nObjects;
+    size_t nUsedBytes;
+
+    CPoolArena(const CPoolArena&);
+    CPoolArena& operator=(const CPoolArena&);
+};
+
+//
+// Allocator that takes small objects from a CPoolArena. A default-constructed
+// allocator has no arena and behaves like std::allocator.
+//
+template <typename T>
+struct pooled_allocator : public std::allocator<T> {
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+
+    CPoolArena* arena;
+
+    pooled_allocator() throw() : arena(NULL) {}
+    explicit pooled_allocator(CPoolArena* arenaIn) throw() : arena(arenaIn) {}
+    pooled_allocator(const pooled_allocator& a) throw() : base(a), arena(a.arena) {}
+    template <typename U>
+    pooled_allocator(const pooled_allocator<U>& a) throw() : base(a), arena(a.arena)
+    {
+    }
+    ~pooled_allocator() throw() {}
+    template <typename _Other>
+    struct rebind {
+        typedef pooled_allocator<_Other> other;
+    };
+
+    T* allocate(std::size_t n, const void* hint = 0)
+    {
+        if (arena != NULL) {
+            void* p = arena->Allocate(sizeof(T) * n);
+            if (p != NULL)
+                return static_cast<T*>(p);
+        }
+        return std::allocator<T>::allocate(n, hint);
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (arena != NULL && sizeof(T) * n <= CPoolArena::MAX_OBJECT_SIZE)
+            arena->Deallocate(p, sizeof(T) * n);
+        else
+            std::allocator<T>::deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const pooled_allocator<U>& a) const { return arena == a.arena; }
+    template <typename U>
+    bool operator!=(const pooled_allocator<U>& a) const { return arena != a.arena; }
+};
+
 // This is exactly like std::string, but with a custom allocator.
 typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > SecureString;
 
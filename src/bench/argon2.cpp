@@ -0,0 +1,63 @@
+// Copyright (c) 2025 The Worldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "crypto/argon2.h"
+
+#include <cstring>
+
+static void HashNonces(benchmark::State& state, worldcoin_argon2d_context *ctx)
+{
+    char header[80];
+    char hash[WDC_ARGON2_HASH_LENGTH];
+    memset(header, 0, sizeof(header));
+    uint32_t nNonce = 0;
+    while (state.KeepRunning()) {
+        memcpy(header + 76, &nNonce, sizeof(nNonce));
+        worldcoin_argon2d_ctx(ctx, header, hash);
+        nNonce++;
+    }
+}
+
+// Hash with a memory matrix allocated and freed on every call
+static void Argon2dAllocate(benchmark::State& state)
+{
+    worldcoin_argon2d_detect();
+    HashNonces(state, NULL);
+}
+
+// Hash with the memory matrix of a reused context
+static void Argon2dContext(benchmark::State& state)
+{
+    worldcoin_argon2d_detect();
+    worldcoin_argon2d_context *ctx = worldcoin_argon2d_context_create();
+    HashNonces(state, ctx);
+    worldcoin_argon2d_context_destroy(ctx);
+}
+
+// Each compression function with a reused context; unsupported ones return at once
+static void HashWithKernel(benchmark::State& state, int kernel)
+{
+    if (!worldcoin_argon2d_use_kernel(kernel))
+        return;
+    worldcoin_argon2d_context *ctx = worldcoin_argon2d_context_create();
+    HashNonces(state, ctx);
+    worldcoin_argon2d_context_destroy(ctx);
+    worldcoin_argon2d_detect();
+}
+
+static void Argon2dGeneric(benchmark::State& state) { HashWithKernel(state, WDC_ARGON2D_GENERIC); }
+static void Argon2dSSE2(benchmark::State& state) { HashWithKernel(state, WDC_ARGON2D_SSE2); }
+static void Argon2dSSSE3(benchmark::State& state) { HashWithKernel(state, WDC_ARGON2D_SSSE3); }
+static void Argon2dAVX2(benchmark::State& state) { HashWithKernel(state, WDC_ARGON2D_AVX2); }
+static void Argon2dAVX512(benchmark::State& state) { HashWithKernel(state, WDC_ARGON2D_AVX512); }
+
+BENCHMARK(Argon2dAllocate);
+BENCHMARK(Argon2dContext);
+BENCHMARK(Argon2dGeneric);
+BENCHMARK(Argon2dSSE2);
+BENCHMARK(Argon2dSSSE3);
+BENCHMARK(Argon2dAVX2);
+BENCHMARK(Argon2dAVX512);
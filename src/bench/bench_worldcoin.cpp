@@ -0,0 +1,12 @@
+// Copyright (c) 2025 The Worldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+int main(int argc, char** argv)
+{
+    benchmark::BenchRunner::RunAll();
+
+    return 0;
+}
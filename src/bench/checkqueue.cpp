@@ -0,0 +1,87 @@
+// Copyright (c) 2025 The Worldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "checkqueue.h"
+#include "key.h"
+#include "pubkey.h"
+#include "uint256.h"
+
+#include <cassert>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+//! A block's worth of inputs, added one transaction at a time as ConnectBlock does
+static const unsigned int BENCH_TRANSACTIONS = 1000;
+static const unsigned int BENCH_INPUTS_PER_TRANSACTION = 2;
+
+/** One ECDSA verification, standing in for a CScriptCheck */
+class CSignatureCheck
+{
+private:
+    const CPubKey* ppubkey;
+    const std::vector<unsigned char>* pvchSig;
+    uint256 hash;
+
+public:
+    CSignatureCheck() : ppubkey(NULL), pvchSig(NULL) {}
+    CSignatureCheck(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const uint256& hashIn) : ppubkey(&pubkey), pvchSig(&vchSig), hash(hashIn) {}
+
+    bool operator()() { return ppubkey->Verify(hash, *pvchSig); }
+
+    void swap(CSignatureCheck& check)
+    {
+        std::swap(ppubkey, check.ppubkey);
+        std::swap(pvchSig, check.pvchSig);
+        std::swap(hash, check.hash);
+    }
+};
+
+// Verify a block's signatures with nThreads threads: the master and nThreads-1 workers
+static void VerifyBlockSignatures(benchmark::State& state, int nThreads)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    uint256 hash = 12345;
+    std::vector<unsigned char> vchSig;
+    key.Sign(hash, vchSig);
+
+    CCheckQueue<CSignatureCheck> queue(128);
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<CSignatureCheck>::Thread, &queue));
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CSignatureCheck> control(&queue);
+        for (unsigned int i = 0; i < BENCH_TRANSACTIONS; i++) {
+            std::vector<CSignatureCheck> vChecks(BENCH_INPUTS_PER_TRANSACTION, CSignatureCheck(pubkey, vchSig, hash));
+            control.Add(vChecks);
+        }
+        bool fOk = control.Wait();
+        assert(fOk);
+    }
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+static void CheckQueueThreads01(benchmark::State& state) { VerifyBlockSignatures(state, 1); }
+static void CheckQueueThreads02(benchmark::State& state) { VerifyBlockSignatures(state, 2); }
+static void CheckQueueThreads04(benchmark::State& state) { VerifyBlockSignatures(state, 4); }
+static void CheckQueueThreads08(benchmark::State& state) { VerifyBlockSignatures(state, 8); }
+static void CheckQueueThreads16(benchmark::State& state) { VerifyBlockSignatures(state, 16); }
+static void CheckQueueThreads32(benchmark::State& state) { VerifyBlockSignatures(state, 32); }
+static void CheckQueueThreads64(benchmark::State& state) { VerifyBlockSignatures(state, 64); }
+
+BENCHMARK(CheckQueueThreads01);
+BENCHMARK(CheckQueueThreads02);
+BENCHMARK(CheckQueueThreads04);
+BENCHMARK(CheckQueueThreads08);
+BENCHMARK(CheckQueueThreads16);
+BENCHMARK(CheckQueueThreads32);
+BENCHMARK(CheckQueueThreads64);
@@ -197,6 +197,9 @@ enum BlockStatus {
 	BLOCK_FAILED_VALID       =   32,
 	BLOCK_FAILED_CHILD       =   64,
 	BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+	//! hashPoW holds the Argon2d hash of the header, which was checked against nBits
+	BLOCK_HAVE_POWHASH       =  128,
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -225,6 +228,9 @@ public:
 	unsigned int nNonce;
 	uint32_t nSequenceId;
 
+	//! Argon2d hash of the header, valid if nStatus & BLOCK_HAVE_POWHASH
+	uint256 hashPoW;
+
 	void SetNull()
 	{
 		phashBlock = NULL;
@@ -245,6 +251,7 @@ public:
 		nTime          = 0;
 		nBits          = 0;
 		nNonce         = 0;
+		hashPoW        = 0;
 	}
 
 	CBlockIndex()
@@ -301,9 +308,17 @@ public:
 
 	uint256 GetBlockPoWHash() const
 	{
+		if (nStatus & BLOCK_HAVE_POWHASH)
+			return hashPoW;
 		return GetBlockHeader().GetPoWHash();
 	}
 
+	void SetPoWHash(const uint256& hash)
+	{
+		hashPoW = hash;
+		nStatus |= BLOCK_HAVE_POWHASH;
+	}
+
 	int64_t GetBlockTime() const
 	{
 		return (int64_t)nTime;
@@ -419,6 +434,8 @@ public:
 		READWRITE(nTime);
 		READWRITE(nBits);
 		READWRITE(nNonce);
+		if (nStatus & BLOCK_HAVE_POWHASH)
+			READWRITE(hashPoW);
 	}
 
 	uint256 GetBlockHash() const
@@ -12,6 +12,7 @@
 #include "protocol.h"
 #include "uint256.h"
 
+#include <map>
 #include <vector>
 
 typedef unsigned char MessageStartChars[MESSAGE_START_SIZE];
@@ -87,6 +88,8 @@ public:
     const std::vector<unsigned char>& Base58Prefix(Base58Type type) const { return base58Prefixes[type]; }
     const std::vector<CAddress>& FixedSeeds() const { return vFixedSeeds; }
     virtual const Checkpoints::CCheckpointData& Checkpoints() const = 0;
+    /** Checksums of known good UTXO set snapshots (as written by dumptxoutset), by the block they belong to */
+    const std::map<uint256, uint256>& SnapshotHashes() const { return mapSnapshotHashes; }
 
     // Worldcoin: Height to enforce v2 block
     int EnforceV2AfterHeight() const { return nEnforceV2AfterHeight; }
@@ -115,6 +118,7 @@ protected:
     std::string strNetworkID;
     CBlock genesis;
     std::vector<CAddress> vFixedSeeds;
+    std::map<uint256, uint256> mapSnapshotHashes;
     bool fRequireRPCPassword;
     bool fMiningRequiresPeers;
     bool fAllowMinDifficultyBlocks;
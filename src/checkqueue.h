@@ -6,8 +6,11 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <deque>
+#include <stdint.h>
 #include <vector>
 
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
@@ -16,6 +19,114 @@
 template <typename T>
 class CCheckQueueControl;
 
+/** A queue that the threads of a CCheckQueueWorkers pool help with */
+class CCheckQueueBase
+{
+public:
+    virtual ~CCheckQueueBase() {}
+
+    /**
+     * Help with the queued verifications, if there are any, as pool worker
+     * nWorker (counting from 1). Returns whether there were any.
+     */
+    virtual bool Work(unsigned int nWorker) = 0;
+};
+
+/**
+ * Worker threads shared by several check queues, so that each kind of
+ * verification does not need a thread pool of its own. Every thread helps
+ * with whichever queue has verifications queued, and sleeps while none has.
+ * Queues are registered when they are constructed and must outlive the
+ * threads.
+ */
+class CCheckQueueWorkers
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::vector<CCheckQueueBase*> vQueues;
+
+    //! Number of threads started
+    unsigned int nThreads;
+
+    //! Incremented whenever verifications are added to any of the queues
+    uint64_t nGeneration;
+
+public:
+    CCheckQueueWorkers() : nThreads(0), nGeneration(0) {}
+
+    void Register(CCheckQueueBase* pqueue)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vQueues.push_back(pqueue);
+    }
+
+    unsigned int GetThreads()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return nThreads;
+    }
+
+    //! Wake one thread, or all of them, for verifications just added
+    void Notify(bool fAll)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nGeneration++;
+        if (fAll)
+            cond.notify_all();
+        else
+            cond.notify_one();
+    }
+
+    //! Worker thread
+    void Thread()
+    {
+        unsigned int nWorker;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nWorker = ++nThreads;
+        }
+        std::vector<CCheckQueueBase*> vQueuesNow;
+        do {
+            uint64_t nSeen;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                vQueuesNow = vQueues;
+                nSeen = nGeneration;
+            }
+            // Anything added from here on bumps nGeneration past nSeen
+            bool fWorked;
+            do {
+                fWorked = false;
+                BOOST_FOREACH (CCheckQueueBase* pqueue, vQueuesNow)
+                    fWorked |= pqueue->Work(nWorker);
+            } while (fWorked);
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (nGeneration == nSeen)
+                cond.wait(lock);
+        } while (true);
+    }
+};
+
+/**
+ * Run a batch of verifications taken from the queue, returning whether all
+ * of them succeeded. On failure the failing verification is swapped into
+ * *pcheckFailed, if given. Types that can share work between the
+ * verifications of a batch specialize this.
+ */
+template <typename T>
+bool CheckAll(std::vector<T>& vChecks, T* pcheckFailed = NULL)
+{
+    BOOST_FOREACH (T& check, vChecks) {
+        if (!check()) {
+            if (pcheckFailed)
+                pcheckFailed->swap(check);
+            return false;
+        }
+    }
+    return true;
+}
+
 /** 
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
@@ -25,12 +136,33 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker (the master included) has its own deque of verifications,
+  * each with its own lock. Added batches are spread over the deques. A
+  * worker takes the newest verifications from its own deque and, once that
+  * is empty, steals the oldest ones from the others. Work is claimed and
+  * accounted for through atomic counters; the shared lock is only taken to
+  * sleep when there is no work, to report a failure and to wake the master.
+  *
+  * The workers are either threads running Thread(), or the threads of a
+  * CCheckQueueWorkers pool the queue is constructed with, which leave the
+  * queue for the pool's other queues instead of sleeping.
   */
 template <typename T>
-class CCheckQueue
+class CCheckQueue : public CCheckQueueBase
 {
 private:
-    //! Mutex to protect the inner state
+    //! Number of deques; workers beyond that share them
+    static const unsigned int QUEUES = 128;
+
+    //! A worker's own verifications
+    struct CWorkQueue
+    {
+        boost::mutex mutex;
+        std::deque<T> deque;
+    };
+
+    //! Mutex to protect the inner state (taken before a deque's mutex, never after)
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,9 +171,17 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The deques of the master (0) and the workers
+    std::vector<CWorkQueue*> vQueues;
+
+    //! The number of deques in use: one for the master, one per worker thread
+    unsigned int nQueuesUsed;
+
+    //! The deque the next batch starts filling
+    unsigned int nNextQueue;
+
+    //! The number of worker threads started (excluding the master).
+    int nWorkers;
 
     //! The number of workers (including the master) that are idle.
     int nIdle;
@@ -49,15 +189,25 @@ private:
     //! The total number of workers (including the master).
     int nTotal;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! The temporary evaluation result (only set under the lock, read without it to skip work).
+    boost::atomic<bool> fAllOk;
+
+    //! The first verification that failed, handed to the master by Wait.
+    T checkFailed;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are not anymore in queue, but still in
+     * This includes elements that are not anymore in a deque, but still in
      * worker's own batches.
      */
-    unsigned int nTodo;
+    boost::atomic<unsigned int> nTodo;
+
+    /**
+     * Number of verifications still in the deques, not taken by any worker.
+     * Only changed while holding the lock of the deque that is filled or
+     * emptied, so it never counts verifications that were already taken.
+     */
+    boost::atomic<unsigned int> nQueued;
 
     //! Whether we're shutting down.
     bool fQuit;
@@ -65,70 +215,133 @@ private:
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! The pool whose threads work on this queue, if any
+    CCheckQueueWorkers* pworkers;
+
+    /**
+     * Move a batch of verifications to vChecks: the newest ones of the own
+     * deque or, if that is empty, the oldest ones of another deque. Returns
+     * how many were taken.
+     */
+    unsigned int Take(unsigned int nQueue, unsigned int nQueuesIn, std::vector<T>& vChecks)
+    {
+        for (unsigned int i = 0; i < nQueuesIn; i++) {
+            CWorkQueue& queue = *vQueues[(nQueue + i) % nQueuesIn];
+            boost::unique_lock<boost::mutex> lock(queue.mutex);
+            if (queue.deque.empty())
+                continue;
+            // Leave half of the deque to the others, so all workers finish
+            // approximately simultaneously.
+            unsigned int nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.deque.size() / 2));
+            vChecks.resize(nNow);
+            for (unsigned int j = 0; j < nNow; j++) {
+                // Swap instead of copy, to keep the lock short
+                if (i == 0) {
+                    vChecks[j].swap(queue.deque.back());
+                    queue.deque.pop_back();
+                } else {
+                    vChecks[j].swap(queue.deque.front());
+                    queue.deque.pop_front();
+                }
+            }
+            nQueued -= nNow;
+            return nNow;
+        }
+        return 0;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(bool fMaster = false, T* pcheckFailed = NULL, unsigned int nPoolWorker = 0)
     {
         boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
+        T checkOwnFailed;
+        unsigned int nQueue = 0;
+        unsigned int nQueuesIn = 0;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nPoolWorker) {
+                // Pool threads only join while there is something to take,
+                // so the queue is idle whenever the master has returned
+                if (nQueued == 0)
+                    return true;
+                nQueue = 1 + (nPoolWorker - 1) % (QUEUES - 1);
+            } else if (!fMaster) {
+                nQueue = 1 + nWorkers % (QUEUES - 1);
+                nWorkers++;
+                nQueuesUsed = std::min((unsigned int)nWorkers + 1, (unsigned int)QUEUES);
+            }
+            nTotal++;
+            nQueuesIn = nQueuesUsed;
+        }
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master he can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
+            // Claim a batch, holding no lock but that of the deque it comes from
+            unsigned int nNow = Take(nQueue, nQueuesIn, vChecks);
+            if (nNow) {
+                // Skip the work if a verification already failed
+                if (fAllOk.load(boost::memory_order_relaxed) && !CheckAll(vChecks, &checkOwnFailed)) {
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    if (fAllOk) {
+                        checkFailed.swap(checkOwnFailed);
+                        fAllOk = false;
+                    }
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+                vChecks.clear();
+                if (nTodo.fetch_sub(nNow) == nNow && !fMaster) {
+                    // We processed the last element; inform the master he can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
+                }
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // Every deque was empty when Take() looked at it. Add() counts new
+            // verifications in nQueued before it wakes anyone up, so if there
+            // are any, they came after that and are worth another look;
+            // otherwise sleep until Add() signals more.
+            while (nQueued == 0) {
+                if ((fMaster || fQuit) && nTodo == 0) {
+                    // workers that woke up for work others took must settle first
+                    while (fMaster && nIdle + 1 < nTotal)
+                        condMaster.wait(lock);
+                    nTotal--;
+                    bool fRet = fAllOk;
+                    // reset the status for new work later
+                    if (fMaster) {
+                        fAllOk = true;
+                        if (pcheckFailed && !fRet)
+                            pcheckFailed->swap(checkFailed);
+                        T checkNone;
+                        checkFailed.swap(checkNone);
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+                    // return the current status
+                    return fRet;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                if (!fMaster && nTodo == 0)
+                    condMaster.notify_one();
+                if (nPoolWorker) {
+                    // Go help with the pool's other queues
+                    nTotal--;
+                    return true;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                nIdle++;
+                cond.wait(lock); // wait
+                nIdle--;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
+            nQueuesIn = nQueuesUsed;
         } while (true);
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn, CCheckQueueWorkers* pworkersIn = NULL) : nQueuesUsed(1), nNextQueue(0), nWorkers(0), nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nQueued(0), fQuit(false), nBatchSize(nBatchSizeIn), pworkers(pworkersIn)
+    {
+        for (unsigned int i = 0; i < QUEUES; i++)
+            vQueues.push_back(new CWorkQueue());
+        if (pworkers)
+            pworkers->Register(this);
+    }
 
     //! Worker thread
     void Thread()
@@ -136,29 +349,60 @@ public:
         Loop();
     }
 
-    //! Wait until execution finishes, and return whether all evaluations where successful.
-    bool Wait()
+    //! Pool worker
+    bool Work(unsigned int nWorker)
+    {
+        if (nQueued == 0)
+            return false;
+        Loop(false, NULL, nWorker);
+        return true;
+    }
+
+    /**
+     * Wait until execution finishes, and return whether all evaluations where
+     * successful. If not, the first one found failing is swapped into
+     * *pcheckFailed, if given.
+     */
+    bool Wait(T* pcheckFailed = NULL)
     {
-        return Loop(true);
+        return Loop(true, pcheckFailed);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
+        if (vChecks.empty())
+            return;
         boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (pworkers)
+            nQueuesUsed = std::min(pworkers->GetThreads() + 1, (unsigned int)QUEUES);
+        // Count the verifications before any can be taken and finished
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
+        // Spread the batch over the deques in use, starting at a different one each time
+        unsigned int nChunk = (vChecks.size() + nQueuesUsed - 1) / nQueuesUsed;
+        for (unsigned int i = 0; i < vChecks.size(); i += nChunk) {
+            CWorkQueue& queue = *vQueues[nNextQueue];
+            nNextQueue = (nNextQueue + 1) % nQueuesUsed;
+            boost::unique_lock<boost::mutex> lockQueue(queue.mutex);
+            unsigned int nEnd = std::min(i + nChunk, (unsigned int)vChecks.size());
+            for (unsigned int j = i; j < nEnd; j++) {
+                queue.deque.push_back(T());
+                vChecks[j].swap(queue.deque.back());
+            }
+            nQueued += nEnd - i;
+        }
+        if (pworkers)
+            pworkers->Notify(vChecks.size() > 1);
+        else if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
     ~CCheckQueue()
     {
+        BOOST_FOREACH (CWorkQueue* pqueue, vQueues)
+            delete pqueue;
     }
 
     bool IsIdle()
@@ -190,11 +434,11 @@ public:
         }
     }
 
-    bool Wait()
+    bool Wait(T* pcheckFailed = NULL)
     {
         if (pqueue == NULL)
             return true;
-        bool fRet = pqueue->Wait();
+        bool fRet = pqueue->Wait(pcheckFailed);
         fDone = true;
         return fRet;
     }
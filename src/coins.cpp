@@ -5,7 +5,9 @@
 #include "coins.h"
 
 #include "random.h"
+#include "util.h"
 
+#include <algorithm>
 #include <assert.h>
 
 /**
@@ -71,7 +73,15 @@ bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStat
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), hashBlock(0),
+    cacheCoins(0, CCoinsKeyHasher(), std::equal_to<uint256>(), CCoinsMap::allocator_type(&arena)), cachedCoinsUsage(0), nAccessCounter(0), nFlushCount(0) { }
+
+size_t CCoinsViewCache::DynamicMemoryUsage() const {
+    // Nodes live in the arena, the bucket array comes from the heap. Slots
+    // freed by PartialFlush are reused before the arena grows, so only the
+    // live ones count against the budget.
+    return arena.GetUsedBytes() + memusage::MallocUsage(cacheCoins.bucket_count() * sizeof(void*)) + cachedCoinsUsage;
+}
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -80,18 +90,23 @@ CCoinsViewCache::~CCoinsViewCache()
 
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
     CCoinsMap::iterator it = cacheCoins.find(txid);
-    if (it != cacheCoins.end())
+    if (it != cacheCoins.end()) {
+        it->second.nLastUsed = ++nAccessCounter;
         return it;
+    }
     CCoins tmp;
     if (!base->GetCoins(txid, tmp))
         return cacheCoins.end();
     CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
+    ret->second.nBaseOutputs = tmp.vout.size();
     tmp.swap(ret->second.coins);
     if (ret->second.coins.IsPruned()) {
         // The parent only has an empty entry for this txid; we can consider our
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
+    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
+    ret->second.nLastUsed = ++nAccessCounter;
     return ret;
 }
 
@@ -104,9 +119,27 @@ bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
     return false;
 }
 
+bool CCoinsViewCache::HaveCoinsInCache(const uint256 &txid) const {
+    return cacheCoins.count(txid) != 0;
+}
+
+bool CCoinsViewCache::WarmCoins(const uint256 &txid, CCoins &coins) {
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    if (!ret.second)
+        return false;
+    ret.first->second.nBaseOutputs = coins.vout.size();
+    coins.swap(ret.first->second.coins);
+    if (ret.first->second.coins.IsPruned())
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    cachedCoinsUsage += ret.first->second.coins.DynamicMemoryUsage();
+    ret.first->second.nLastUsed = ++nAccessCounter;
+    return true;
+}
+
 CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     assert(!hasModifier);
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    size_t cachedCoinUsage = 0;
     if (ret.second) {
         if (!base->GetCoins(txid, ret.first->second.coins)) {
             // The parent view does not have this entry; mark it as fresh.
@@ -116,10 +149,14 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
             // The parent view only has a pruned entry for this; mark it as fresh.
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
         }
+        ret.first->second.nBaseOutputs = ret.first->second.coins.vout.size();
+    } else {
+        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first);
+    ret.first->second.nLastUsed = ++nAccessCounter;
+    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
 }
 
 const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
@@ -164,18 +201,24 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     assert(it->second.flags & CCoinsCacheEntry::FRESH);
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
                     entry.coins.swap(it->second.coins);
+                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                    entry.nLastUsed = ++nAccessCounter;
                 }
             } else {
                 if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
+                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
+                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
+                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    itUs->second.nLastUsed = ++nAccessCounter;
                 }
             }
         }
@@ -187,8 +230,73 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
 }
 
 bool CCoinsViewCache::Flush() {
+    nFlushCount++;
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    cachedCoinsUsage = 0;
+    arena.Release();
+    return fOk;
+}
+
+namespace {
+struct CompareCacheEntryByLastUsed
+{
+    bool operator()(const CCoinsMap::iterator& a, const CCoinsMap::iterator& b) const
+    {
+        return a->second.nLastUsed > b->second.nLastUsed;
+    }
+};
+}
+
+bool CCoinsViewCache::PartialFlush(size_t nTargetUsage) {
+    assert(!hasModifier);
+    nFlushCount++;
+
+    // Most recently used entries first
+    std::vector<CCoinsMap::iterator> vEntries;
+    vEntries.reserve(cacheCoins.size());
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); ++it)
+        vEntries.push_back(it);
+    std::sort(vEntries.begin(), vEntries.end(), CompareCacheEntryByLastUsed());
+
+    // Dirty entries that stay are copied to the batch, those that go are moved
+    size_t nNodeUsage = memusage::MallocUsage(sizeof(CCoinsMap::value_type) + sizeof(void*));
+    size_t nRetained = memusage::MallocUsage(cacheCoins.bucket_count() * sizeof(void*));
+    bool fFull = false;
+    CCoinsMap mapWrite;
+    for (std::vector<CCoinsMap::iterator>::iterator itv = vEntries.begin(); itv != vEntries.end(); ++itv) {
+        CCoinsMap::iterator it = *itv;
+        size_t nEntryUsage = it->second.coins.DynamicMemoryUsage();
+        bool fKeep = false;
+        if (!fFull && !it->second.coins.IsPruned()) {
+            fFull = nRetained + nEntryUsage + nNodeUsage > nTargetUsage;
+            fKeep = !fFull;
+        }
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            CCoinsCacheEntry& entry = mapWrite[it->first];
+            entry.flags = it->second.flags;
+            entry.nBaseOutputs = it->second.nBaseOutputs;
+            if (fKeep)
+                entry.coins = it->second.coins;
+            else
+                entry.coins.swap(it->second.coins);
+        }
+        if (fKeep) {
+            // The base now has this version
+            it->second.flags = 0;
+            it->second.nBaseOutputs = it->second.coins.vout.size();
+            nRetained += nEntryUsage + nNodeUsage;
+        } else {
+            cachedCoinsUsage -= nEntryUsage;
+            cacheCoins.erase(it);
+        }
+    }
+    LogPrint("coindb", "Partial flush: wrote %u changed transactions, kept %u of %u\n",
+             (unsigned int)mapWrite.size(), (unsigned int)cacheCoins.size(), (unsigned int)vEntries.size());
+
+    bool fOk = base->BatchWrite(mapWrite, hashBlock);
+    if (cacheCoins.empty())
+        arena.Release();
     return fOk;
 }
 
@@ -246,7 +354,7 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight) const
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_) : cache(cache_), it(it_) {
+CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
 }
@@ -256,7 +364,11 @@ CCoinsModifier::~CCoinsModifier()
     assert(cache.hasModifier);
     cache.hasModifier = false;
     it->second.coins.Cleanup();
+    cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
+    } else {
+        // If the coin still exists after the modification, add the new usage
+        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
     }
 }
@@ -6,7 +6,10 @@
 #ifndef BITCOIN_COINS_H
 #define BITCOIN_COINS_H
 
+#include "allocators.h"
 #include "compressor.h"
+#include "core_memusage.h"
+#include "memusage.h"
 #include "serialize.h"
 #include "uint256.h"
 #include "undo.h"
@@ -256,6 +259,14 @@ public:
                 return false;
         return true;
     }
+
+    size_t DynamicMemoryUsage() const {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH(const CTxOut &out, vout) {
+            ret += RecursiveDynamicUsage(out.scriptPubKey);
+        }
+        return ret;
+    }
 };
 
 class CCoinsKeyHasher
@@ -280,16 +291,19 @@ struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    uint32_t nBaseOutputs; // Size of vout in the parent view when this entry was read, so a write knows what to overwrite there.
+    uint64_t nLastUsed; // Access counter of the cache when this entry was last used.
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : coins(), flags(0), nBaseOutputs(0), nLastUsed(0) {}
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>,
+                             pooled_allocator<std::pair<const uint256, CCoinsCacheEntry> > > CCoinsMap;
 
 struct CCoinsStats
 {
@@ -360,7 +374,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -376,6 +391,9 @@ protected:
     /* Whether this cache has an active modifier. */
     bool hasModifier;
 
+    /* Arena for the nodes of cacheCoins; declared first so that it outlives the map. */
+    CPoolArena arena;
+
     /**
      * Make mutable so that we can "fill the cache" even from Get-methods
      * declared as "const".  
@@ -383,6 +401,15 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage of the CCoins objects (outputs and scripts) in cacheCoins. */
+    mutable size_t cachedCoinsUsage;
+
+    /* Incremented on every access, to rank entries by recency for PartialFlush. */
+    mutable uint64_t nAccessCounter;
+
+    /* Number of times this cache has been (partially) flushed to its base. */
+    uint64_t nFlushCount;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -408,6 +435,21 @@ public:
      */
     CCoinsModifier ModifyCoins(const uint256 &txid);
 
+    //! Check whether an entry for txid is held by this cache, without consulting the base
+    bool HaveCoinsInCache(const uint256 &txid) const;
+
+    /**
+     * Add coins for txid that were read from the base outside of this cache,
+     * as if FetchCoins had loaded them. The coins are swapped in; nothing is
+     * done (and false returned) if the cache already has an entry for txid.
+     * The caller must make sure the base has not been written to since the
+     * read, see GetFlushCount.
+     */
+    bool WarmCoins(const uint256 &txid, CCoins &coins);
+
+    //! Number of Flush and PartialFlush calls, i.e. of writes to the base by this cache
+    uint64_t GetFlushCount() const { return nFlushCount; }
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
@@ -415,9 +457,20 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base, but keep the
+     * most recently used entries (now clean) as long as they fit in
+     * nTargetUsage bytes. Everything else is dropped from the cache.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool PartialFlush(size_t nTargetUsage);
+
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of bitcoins coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
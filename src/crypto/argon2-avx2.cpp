@@ -0,0 +1,95 @@
+// Copyright (c) 2025 The Worldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Argon2d compression function using AVX2, one BLAKE2b round per set of four
+// 256-bit registers. Built with -mavx2, only called after
+// worldcoin_argon2d_detect() found the instruction set.
+
+#include "crypto/argon2.h"
+
+#include <immintrin.h>
+
+namespace {
+
+inline __m256i rotr32(__m256i x)
+{
+    return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+}
+
+inline __m256i rotr24(__m256i x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_setr_epi8(
+        3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+        3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10));
+}
+
+inline __m256i rotr16(__m256i x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_setr_epi8(
+        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+        2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9));
+}
+
+inline __m256i rotr63(__m256i x)
+{
+    return _mm256_xor_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x));
+}
+
+inline __m256i fBlaMka(__m256i x, __m256i y)
+{
+    const __m256i z = _mm256_mul_epu32(x, y);
+    return _mm256_add_epi64(_mm256_add_epi64(x, y), _mm256_add_epi64(z, z));
+}
+
+// G on four columns at once; A, B, C, D hold words 0-3, 4-7, 8-11, 12-15 of the round
+inline void G(__m256i& A, __m256i& B, __m256i& C, __m256i& D)
+{
+    A = fBlaMka(A, B); D = rotr32(_mm256_xor_si256(D, A));
+    C = fBlaMka(C, D); B = rotr24(_mm256_xor_si256(B, C));
+    A = fBlaMka(A, B); D = rotr16(_mm256_xor_si256(D, A));
+    C = fBlaMka(C, D); B = rotr63(_mm256_xor_si256(B, C));
+}
+
+inline void BlaMkaRound(__m256i& A, __m256i& B, __m256i& C, __m256i& D)
+{
+    G(A, B, C, D);
+    // Move the diagonals into columns: B = 5,6,7,4  C = 10,11,8,9  D = 15,12,13,14
+    B = _mm256_permute4x64_epi64(B, _MM_SHUFFLE(0, 3, 2, 1));
+    C = _mm256_permute4x64_epi64(C, _MM_SHUFFLE(1, 0, 3, 2));
+    D = _mm256_permute4x64_epi64(D, _MM_SHUFFLE(2, 1, 0, 3));
+    G(A, B, C, D);
+    B = _mm256_permute4x64_epi64(B, _MM_SHUFFLE(2, 1, 0, 3));
+    C = _mm256_permute4x64_epi64(C, _MM_SHUFFLE(1, 0, 3, 2));
+    D = _mm256_permute4x64_epi64(D, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+} // anon namespace
+
+void worldcoin_argon2d_fill_block_avx2(uint64_t *next, const uint64_t *prev, const uint64_t *ref, int with_xor)
+{
+    // S[4 * r + k] holds words 4k..4k+3 of row r (a row being 16 words)
+    __m256i S[32], T[32];
+    for (int i = 0; i < 32; i++) {
+        S[i] = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)prev + i), _mm256_loadu_si256((const __m256i*)ref + i));
+        T[i] = with_xor ? _mm256_xor_si256(S[i], _mm256_loadu_si256((const __m256i*)next + i)) : S[i];
+    }
+    for (int r = 0; r < 8; r++)
+        BlaMkaRound(S[4 * r + 0], S[4 * r + 1], S[4 * r + 2], S[4 * r + 3]);
+    // Column rounds c and c+1 take word pairs c and c+1 of every row, which share a register
+    for (int k = 0; k < 4; k++) {
+        __m256i X[8];
+        for (int j = 0; j < 4; j++) {
+            X[j] = _mm256_permute2x128_si256(S[8 * j + k], S[8 * j + 4 + k], 0x20);
+            X[4 + j] = _mm256_permute2x128_si256(S[8 * j + k], S[8 * j + 4 + k], 0x31);
+        }
+        BlaMkaRound(X[0], X[1], X[2], X[3]);
+        BlaMkaRound(X[4], X[5], X[6], X[7]);
+        for (int j = 0; j < 4; j++) {
+            S[8 * j + k] = _mm256_permute2x128_si256(X[j], X[4 + j], 0x20);
+            S[8 * j + 4 + k] = _mm256_permute2x128_si256(X[j], X[4 + j], 0x31);
+        }
+    }
+    for (int i = 0; i < 32; i++)
+        _mm256_storeu_si256((__m256i*)next + i, _mm256_xor_si256(S[i], T[i]));
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2025 The Worldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Argon2d compression function using AVX-512F, running two BLAKE2b rounds side
+// by side in the two 256-bit halves of each register. Built with -mavx512f,
+// only called after worldcoin_argon2d_detect() found the instruction set.
+
+#include "crypto/argon2.h"
+
+#include <immintrin.h>
+
+// gcc 12's unmasked AVX-512 intrinsics pass a self-initialized
+// _mm512_undefined_epi32() as the merge source of their masked builtins, and
+// -Wuninitialized reports it once inlined here. The value is never read.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace {
+
+inline __m512i fBlaMka(__m512i x, __m512i y)
+{
+    const __m512i z = _mm512_mul_epu32(x, y);
+    return _mm512_add_epi64(_mm512_add_epi64(x, y), _mm512_add_epi64(z, z));
+}
+
+// G on four columns of two rounds at once; A, B, C, D hold words 0-3, 4-7,
+// 8-11, 12-15 of each round
+inline void G(__m512i& A, __m512i& B, __m512i& C, __m512i& D)
+{
+    A = fBlaMka(A, B); D = _mm512_ror_epi64(_mm512_xor_si512(D, A), 32);
+    C = fBlaMka(C, D); B = _mm512_ror_epi64(_mm512_xor_si512(B, C), 24);
+    A = fBlaMka(A, B); D = _mm512_ror_epi64(_mm512_xor_si512(D, A), 16);
+    C = fBlaMka(C, D); B = _mm512_ror_epi64(_mm512_xor_si512(B, C), 63);
+}
+
+inline void BlaMkaRound(__m512i& A, __m512i& B, __m512i& C, __m512i& D)
+{
+    G(A, B, C, D);
+    // Move the diagonals into columns, within each 256-bit half
+    B = _mm512_permutex_epi64(B, _MM_SHUFFLE(0, 3, 2, 1));
+    C = _mm512_permutex_epi64(C, _MM_SHUFFLE(1, 0, 3, 2));
+    D = _mm512_permutex_epi64(D, _MM_SHUFFLE(2, 1, 0, 3));
+    G(A, B, C, D);
+    B = _mm512_permutex_epi64(B, _MM_SHUFFLE(2, 1, 0, 3));
+    C = _mm512_permutex_epi64(C, _MM_SHUFFLE(1, 0, 3, 2));
+    D = _mm512_permutex_epi64(D, _MM_SHUFFLE(0, 3, 2, 1));
+}
+
+inline __m512i Join(__m256i lo, __m256i hi)
+{
+    return _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1);
+}
+
+/** Run the rounds held in X[0..3] and X[4..7] together */
+inline void BlaMkaRound2(__m256i *X)
+{
+    __m512i A = Join(X[0], X[4]), B = Join(X[1], X[5]), C = Join(X[2], X[6]), D = Join(X[3], X[7]);
+    BlaMkaRound(A, B, C, D);
+    X[0] = _mm512_castsi512_si256(A); X[4] = _mm512_extracti64x4_epi64(A, 1);
+    X[1] = _mm512_castsi512_si256(B); X[5] = _mm512_extracti64x4_epi64(B, 1);
+    X[2] = _mm512_castsi512_si256(C); X[6] = _mm512_extracti64x4_epi64(C, 1);
+    X[3] = _mm512_castsi512_si256(D); X[7] = _mm512_extracti64x4_epi64(D, 1);
+}
+
+} // anon namespace
+
+void worldcoin_argon2d_fill_block_avx512(uint64_t *next, const uint64_t *prev, const uint64_t *ref, int with_xor)
+{
+    // S[4 * r + k] holds words 4k..4k+3 of row r (a row being 16 words), so
+    // rows r and r+1 are S[8 * j .. 8 * j + 7] for r = 2j
+    __m256i S[32], T[32];
+    for (int i = 0; i < 32; i++) {
+        S[i] = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)prev + i), _mm256_loadu_si256((const __m256i*)ref + i));
+        T[i] = with_xor ? _mm256_xor_si256(S[i], _mm256_loadu_si256((const __m256i*)next + i)) : S[i];
+    }
+    for (int j = 0; j < 4; j++)
+        BlaMkaRound2(&S[8 * j]);
+    // Column rounds c and c+1 take word pairs c and c+1 of every row, which share a register
+    for (int k = 0; k < 4; k++) {
+        __m256i X[8];
+        for (int j = 0; j < 4; j++) {
+            X[j] = _mm256_permute2x128_si256(S[8 * j + k], S[8 * j + 4 + k], 0x20);
+            X[4 + j] = _mm256_permute2x128_si256(S[8 * j + k], S[8 * j + 4 + k], 0x31);
+        }
+        BlaMkaRound2(X);
+        for (int j = 0; j < 4; j++) {
+            S[8 * j + k] = _mm256_permute2x128_si256(X[j], X[4 + j], 0x20);
+            S[8 * j + 4 + k] = _mm256_permute2x128_si256(X[j], X[4 + j], 0x31);
+        }
+    }
+    for (int i = 0; i < 32; i++)
+        _mm256_storeu_si256((__m256i*)next + i, _mm256_xor_si256(S[i], T[i]));
+}
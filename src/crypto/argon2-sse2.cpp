@@ -0,0 +1,87 @@
+// Copyright (c) 2025 The Worldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Argon2d compression function using SSE2. Built with -msse2, only called
+// after worldcoin_argon2d_detect() found the instruction set.
+
+#include "crypto/argon2.h"
+
+#include <emmintrin.h>
+
+namespace {
+
+inline __m128i rotr64(__m128i x, int c)
+{
+    return _mm_xor_si128(_mm_srli_epi64(x, c), _mm_slli_epi64(x, 64 - c));
+}
+
+inline __m128i fBlaMka(__m128i x, __m128i y)
+{
+    const __m128i z = _mm_mul_epu32(x, y);
+    return _mm_add_epi64(_mm_add_epi64(x, y), _mm_add_epi64(z, z));
+}
+
+// G on two columns at once; A0..D0 hold words (0,1), (4,5), (8,9), (12,13)
+// of the round and A1..D1 words (2,3), (6,7), (10,11), (14,15)
+inline void G(__m128i& A0, __m128i& B0, __m128i& C0, __m128i& D0,
+              __m128i& A1, __m128i& B1, __m128i& C1, __m128i& D1)
+{
+    A0 = fBlaMka(A0, B0); A1 = fBlaMka(A1, B1);
+    D0 = rotr64(_mm_xor_si128(D0, A0), 32); D1 = rotr64(_mm_xor_si128(D1, A1), 32);
+    C0 = fBlaMka(C0, D0); C1 = fBlaMka(C1, D1);
+    B0 = rotr64(_mm_xor_si128(B0, C0), 24); B1 = rotr64(_mm_xor_si128(B1, C1), 24);
+    A0 = fBlaMka(A0, B0); A1 = fBlaMka(A1, B1);
+    D0 = rotr64(_mm_xor_si128(D0, A0), 16); D1 = rotr64(_mm_xor_si128(D1, A1), 16);
+    C0 = fBlaMka(C0, D0); C1 = fBlaMka(C1, D1);
+    B0 = rotr64(_mm_xor_si128(B0, C0), 63); B1 = rotr64(_mm_xor_si128(B1, C1), 63);
+}
+
+// Move the diagonals into columns: B = (5,6), (7,4), C = (10,11), (8,9), D = (15,12), (13,14)
+inline void Diagonalize(__m128i& B0, __m128i& C0, __m128i& D0, __m128i& B1, __m128i& C1, __m128i& D1)
+{
+    __m128i t0 = D0, t1 = B0, t2 = C0;
+    C0 = C1; C1 = t2;
+    D0 = _mm_unpackhi_epi64(D1, _mm_unpacklo_epi64(t0, t0));
+    D1 = _mm_unpackhi_epi64(t0, _mm_unpacklo_epi64(D1, D1));
+    B0 = _mm_unpackhi_epi64(B0, _mm_unpacklo_epi64(B1, B1));
+    B1 = _mm_unpackhi_epi64(B1, _mm_unpacklo_epi64(t1, t1));
+}
+
+inline void Undiagonalize(__m128i& B0, __m128i& C0, __m128i& D0, __m128i& B1, __m128i& C1, __m128i& D1)
+{
+    __m128i t0 = B0, t1 = D0, t2 = C0;
+    C0 = C1; C1 = t2;
+    B0 = _mm_unpackhi_epi64(B1, _mm_unpacklo_epi64(B0, B0));
+    B1 = _mm_unpackhi_epi64(t0, _mm_unpacklo_epi64(B1, B1));
+    D0 = _mm_unpackhi_epi64(D0, _mm_unpacklo_epi64(D1, D1));
+    D1 = _mm_unpackhi_epi64(D1, _mm_unpacklo_epi64(t1, t1));
+}
+
+inline void BlaMkaRound(__m128i& A0, __m128i& A1, __m128i& B0, __m128i& B1,
+                        __m128i& C0, __m128i& C1, __m128i& D0, __m128i& D1)
+{
+    G(A0, B0, C0, D0, A1, B1, C1, D1);
+    Diagonalize(B0, C0, D0, B1, C1, D1);
+    G(A0, B0, C0, D0, A1, B1, C1, D1);
+    Undiagonalize(B0, C0, D0, B1, C1, D1);
+}
+
+} // anon namespace
+
+void worldcoin_argon2d_fill_block_sse2(uint64_t *next, const uint64_t *prev, const uint64_t *ref, int with_xor)
+{
+    __m128i R[64], T[64];
+    for (int i = 0; i < 64; i++) {
+        R[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)prev + i), _mm_loadu_si128((const __m128i*)ref + i));
+        T[i] = with_xor ? _mm_xor_si128(R[i], _mm_loadu_si128((const __m128i*)next + i)) : R[i];
+    }
+    for (int r = 0; r < 8; r++)
+        BlaMkaRound(R[8 * r + 0], R[8 * r + 1], R[8 * r + 2], R[8 * r + 3],
+                    R[8 * r + 4], R[8 * r + 5], R[8 * r + 6], R[8 * r + 7]);
+    for (int c = 0; c < 8; c++)
+        BlaMkaRound(R[8 * 0 + c], R[8 * 1 + c], R[8 * 2 + c], R[8 * 3 + c],
+                    R[8 * 4 + c], R[8 * 5 + c], R[8 * 6 + c], R[8 * 7 + c]);
+    for (int i = 0; i < 64; i++)
+        _mm_storeu_si128((__m128i*)next + i, _mm_xor_si128(R[i], T[i]));
+}
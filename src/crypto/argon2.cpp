@@ -1,17 +1,478 @@
 #include "crypto/argon2.h"
-#include <argon2.h>
+
+#include "crypto/common.h"
+
+#include <algorithm>
 #include <cstring>
+#include <vector>
+
+#if defined(USE_ARGON2_X86)
+#include <cpuid.h>
+#endif
+
+#ifndef WIN32
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+// Use a fixed salt for mining (could be derived from input)
+static const char salt[] = "WorldcoinArgon2dSalt2025";
+
+// Argon2 uses one 1KB block per unit of memory cost
+static const size_t ARENA_SIZE = (size_t)WDC_ARGON2_MEMORY_COST * 1024;
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+struct worldcoin_argon2d_context
+{
+    uint8_t *arena;   // ARENA_SIZE bytes holding the Argon2d memory matrix
+    void *mapping;    // underlying allocation
+    size_t nMapping;
+};
+
+worldcoin_argon2d_context *worldcoin_argon2d_context_create(void)
+{
+    worldcoin_argon2d_context *ctx = (worldcoin_argon2d_context*)malloc(sizeof(worldcoin_argon2d_context));
+    if (ctx == NULL)
+        return NULL;
+#ifdef WIN32
+    ctx->nMapping = ARENA_SIZE;
+    ctx->mapping = malloc(ARENA_SIZE);
+    ctx->arena = (uint8_t*)ctx->mapping;
+#else
+    void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    // Explicit huge pages only work if the administrator reserved some
+    ctx->nMapping = ARENA_SIZE;
+    p = mmap(NULL, ctx->nMapping, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (p == MAP_FAILED) {
+        // Over-allocate so the arena can start on a huge page boundary, and
+        // ask for transparent huge pages
+        ctx->nMapping = ARENA_SIZE + HUGE_PAGE_SIZE;
+        p = mmap(NULL, ctx->nMapping, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (p == MAP_FAILED) {
+        ctx->mapping = NULL;
+        ctx->arena = NULL;
+    } else {
+        ctx->mapping = p;
+        if (ctx->nMapping == ARENA_SIZE)
+            ctx->arena = (uint8_t*)p;
+        else
+            ctx->arena = (uint8_t*)(((uintptr_t)p + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+#ifdef MADV_HUGEPAGE
+        madvise(ctx->arena, ARENA_SIZE, MADV_HUGEPAGE);
+#endif
+    }
+#endif
+    if (ctx->arena == NULL) {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void worldcoin_argon2d_context_destroy(worldcoin_argon2d_context *ctx)
+{
+    if (ctx == NULL)
+        return;
+#ifdef WIN32
+    free(ctx->mapping);
+#else
+    munmap(ctx->mapping, ctx->nMapping);
+#endif
+    free(ctx);
+}
+
+// BLAKE2b (RFC 7693), as used by Argon2 for H0, H' and the final tag
+namespace {
+
+const uint64_t blake2b_IV[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+const uint8_t blake2b_sigma[12][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3}
+};
+
+inline uint64_t rotr64(uint64_t x, int c) { return (x >> c) | (x << (64 - c)); }
+
+#define B2B_G(a, b, c, d, x, y)          \
+    do {                                 \
+        a = a + b + x; d = rotr64(d ^ a, 32); \
+        c = c + d;     b = rotr64(b ^ c, 24); \
+        a = a + b + y; d = rotr64(d ^ a, 16); \
+        c = c + d;     b = rotr64(b ^ c, 63); \
+    } while (0)
+
+class CBlake2b
+{
+private:
+    uint64_t h[8];
+    uint64_t t;
+    unsigned char buf[128];
+    size_t bufsize;
+    size_t outlen;
+
+    void Compress(bool fLast)
+    {
+        uint64_t m[16], v[16];
+        for (int i = 0; i < 16; i++)
+            m[i] = ReadLE64(buf + 8 * i);
+        for (int i = 0; i < 8; i++) {
+            v[i] = h[i];
+            v[i + 8] = blake2b_IV[i];
+        }
+        v[12] ^= t;
+        if (fLast)
+            v[14] = ~v[14];
+        for (int r = 0; r < 12; r++) {
+            const uint8_t *s = blake2b_sigma[r];
+            B2B_G(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+            B2B_G(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+            B2B_G(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+            B2B_G(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+            B2B_G(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+            B2B_G(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+            B2B_G(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+            B2B_G(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+        }
+        for (int i = 0; i < 8; i++)
+            h[i] ^= v[i] ^ v[i + 8];
+    }
+
+public:
+    explicit CBlake2b(size_t outlenIn) : t(0), bufsize(0), outlen(outlenIn)
+    {
+        for (int i = 0; i < 8; i++)
+            h[i] = blake2b_IV[i];
+        h[0] ^= 0x01010000 ^ outlen;
+    }
+
+    CBlake2b& Write(const unsigned char *data, size_t len)
+    {
+        while (len > 0) {
+            // Keep the last block buffered, it must be compressed as the final one
+            if (bufsize == sizeof(buf)) {
+                t += sizeof(buf);
+                Compress(false);
+                bufsize = 0;
+            }
+            size_t n = std::min(sizeof(buf) - bufsize, len);
+            memcpy(buf + bufsize, data, n);
+            bufsize += n;
+            data += n;
+            len -= n;
+        }
+        return *this;
+    }
+
+    CBlake2b& WriteLE32(uint32_t x)
+    {
+        unsigned char tmp[4];
+        ::WriteLE32(tmp, x);
+        return Write(tmp, sizeof(tmp));
+    }
+
+    void Finalize(unsigned char *out)
+    {
+        t += bufsize;
+        memset(buf + bufsize, 0, sizeof(buf) - bufsize);
+        Compress(true);
+        unsigned char full[64];
+        for (int i = 0; i < 8; i++)
+            ::WriteLE64(full + 8 * i, h[i]);
+        memcpy(out, full, outlen);
+    }
+};
+
+/** Argon2's variable-length hash H' */
+void Blake2bLong(unsigned char *out, size_t outlen, const unsigned char *in, size_t inlen)
+{
+    if (outlen <= 64) {
+        CBlake2b(outlen).WriteLE32(outlen).Write(in, inlen).Finalize(out);
+        return;
+    }
+    unsigned char v[64];
+    CBlake2b(64).WriteLE32(outlen).Write(in, inlen).Finalize(v);
+    memcpy(out, v, 32);
+    out += 32;
+    size_t toproduce = outlen - 32;
+    while (toproduce > 64) {
+        CBlake2b(64).Write(v, 64).Finalize(v);
+        memcpy(out, v, 32);
+        out += 32;
+        toproduce -= 32;
+    }
+    CBlake2b(toproduce).Write(v, 64).Finalize(v);
+    memcpy(out, v, toproduce);
+}
+
+inline uint64_t fBlaMka(uint64_t x, uint64_t y)
+{
+    return x + y + 2 * (uint64_t)(uint32_t)x * (uint32_t)y;
+}
+
+#define BLAMKA_G(a, b, c, d)                       \
+    do {                                           \
+        a = fBlaMka(a, b); d = rotr64(d ^ a, 32);  \
+        c = fBlaMka(c, d); b = rotr64(b ^ c, 24);  \
+        a = fBlaMka(a, b); d = rotr64(d ^ a, 16);  \
+        c = fBlaMka(c, d); b = rotr64(b ^ c, 63);  \
+    } while (0)
+
+/** One BLAKE2b round without message words, on 16 words of a block at the given indices */
+inline void BlaMkaRound(uint64_t *v, const int *idx)
+{
+    BLAMKA_G(v[idx[0]], v[idx[4]], v[idx[8]], v[idx[12]]);
+    BLAMKA_G(v[idx[1]], v[idx[5]], v[idx[9]], v[idx[13]]);
+    BLAMKA_G(v[idx[2]], v[idx[6]], v[idx[10]], v[idx[14]]);
+    BLAMKA_G(v[idx[3]], v[idx[7]], v[idx[11]], v[idx[15]]);
+    BLAMKA_G(v[idx[0]], v[idx[5]], v[idx[10]], v[idx[15]]);
+    BLAMKA_G(v[idx[1]], v[idx[6]], v[idx[11]], v[idx[12]]);
+    BLAMKA_G(v[idx[2]], v[idx[7]], v[idx[8]], v[idx[13]]);
+    BLAMKA_G(v[idx[3]], v[idx[4]], v[idx[9]], v[idx[14]]);
+}
+
+// Argon2 version 1.3, type Argon2d
+const uint32_t ARGON2_VERSION = 0x13;
+const uint32_t ARGON2_TYPE_D = 0;
+const size_t ARGON2_BLOCK_WORDS = 128;
+const size_t ARGON2_BLOCK_SIZE = ARGON2_BLOCK_WORDS * 8;
+const uint32_t ARGON2_SYNC_POINTS = 4;
+
+} // anon namespace
+
+void worldcoin_argon2d_fill_block_generic(uint64_t *next, const uint64_t *prev, const uint64_t *ref, int with_xor)
+{
+    uint64_t R[ARGON2_BLOCK_WORDS], T[ARGON2_BLOCK_WORDS];
+    for (size_t i = 0; i < ARGON2_BLOCK_WORDS; i++) {
+        R[i] = prev[i] ^ ref[i];
+        T[i] = with_xor ? R[i] ^ next[i] : R[i];
+    }
+    // The block is an 8x8 matrix of 16-byte registers: apply the round to
+    // each row, then to each column
+    int idx[16];
+    for (int r = 0; r < 8; r++) {
+        for (int j = 0; j < 16; j++)
+            idx[j] = 16 * r + j;
+        BlaMkaRound(R, idx);
+    }
+    for (int c = 0; c < 8; c++) {
+        for (int j = 0; j < 16; j++)
+            idx[j] = 2 * c + 16 * (j / 2) + (j % 2);
+        BlaMkaRound(R, idx);
+    }
+    for (size_t i = 0; i < ARGON2_BLOCK_WORDS; i++)
+        next[i] = T[i] ^ R[i];
+}
+
+typedef void (*fill_block_fn)(uint64_t *next, const uint64_t *prev, const uint64_t *ref, int with_xor);
+
+// By default, use the generic function until worldcoin_argon2d_detect() is called
+static fill_block_fn argon2d_fill_block_detected = &worldcoin_argon2d_fill_block_generic;
+
+/**
+ * Argon2d with the Worldcoin parameters (one lane), using memory as the
+ * WDC_ARGON2_MEMORY_COST blocks of the memory matrix.
+ */
+static void Argon2dHash(uint64_t *memory, const char *input, char *output)
+{
+    const uint32_t nLaneLength = WDC_ARGON2_MEMORY_COST;
+    const uint32_t nSegmentLength = nLaneLength / ARGON2_SYNC_POINTS;
+    fill_block_fn fill_block = argon2d_fill_block_detected;
+
+    // H0, followed by room for the block and lane index
+    unsigned char blockhash[64 + 8];
+    CBlake2b(64).WriteLE32(WDC_ARGON2_PARALLELISM).WriteLE32(WDC_ARGON2_HASH_LENGTH)
+        .WriteLE32(WDC_ARGON2_MEMORY_COST).WriteLE32(WDC_ARGON2_TIME_COST)
+        .WriteLE32(ARGON2_VERSION).WriteLE32(ARGON2_TYPE_D)
+        .WriteLE32(80).Write((const unsigned char*)input, 80) // 80-byte block header
+        .WriteLE32(sizeof(salt) - 1).Write((const unsigned char*)salt, sizeof(salt) - 1)
+        .WriteLE32(0)  // no secret
+        .WriteLE32(0)  // no associated data
+        .Finalize(blockhash);
+
+    // The first two blocks of the lane are derived from H0
+    unsigned char blockbytes[ARGON2_BLOCK_SIZE];
+    for (uint32_t b = 0; b < 2; b++) {
+        WriteLE32(blockhash + 64, b);
+        WriteLE32(blockhash + 68, 0);
+        Blake2bLong(blockbytes, sizeof(blockbytes), blockhash, sizeof(blockhash));
+        for (size_t i = 0; i < ARGON2_BLOCK_WORDS; i++)
+            memory[b * ARGON2_BLOCK_WORDS + i] = ReadLE64(blockbytes + 8 * i);
+    }
+
+    for (uint32_t pass = 0; pass < WDC_ARGON2_TIME_COST; pass++) {
+        for (uint32_t slice = 0; slice < ARGON2_SYNC_POINTS; slice++) {
+            for (uint32_t index = 0; index < nSegmentLength; index++) {
+                uint32_t nCurr = slice * nSegmentLength + index;
+                if (pass == 0 && nCurr < 2)
+                    continue;
+                uint32_t nPrev = nCurr == 0 ? nLaneLength - 1 : nCurr - 1;
+
+                // Argon2d: the reference block depends on the previous block
+                uint64_t nPseudoRand = memory[nPrev * ARGON2_BLOCK_WORDS];
+                uint32_t nRefAreaSize, nStart;
+                if (pass == 0) {
+                    nRefAreaSize = slice * nSegmentLength + index - 1;
+                    nStart = 0;
+                } else {
+                    nRefAreaSize = nLaneLength - nSegmentLength + index - 1;
+                    nStart = slice == ARGON2_SYNC_POINTS - 1 ? 0 : (slice + 1) * nSegmentLength;
+                }
+                uint64_t nRel = nPseudoRand & 0xffffffff;
+                nRel = (nRel * nRel) >> 32;
+                nRel = nRefAreaSize - 1 - ((nRefAreaSize * nRel) >> 32);
+                uint32_t nRef = (nStart + nRel) % nLaneLength;
+
+                fill_block(memory + nCurr * ARGON2_BLOCK_WORDS, memory + nPrev * ARGON2_BLOCK_WORDS,
+                           memory + nRef * ARGON2_BLOCK_WORDS, pass != 0);
+            }
+        }
+    }
+
+    const uint64_t *last = memory + (nLaneLength - 1) * ARGON2_BLOCK_WORDS;
+    for (size_t i = 0; i < ARGON2_BLOCK_WORDS; i++)
+        WriteLE64(blockbytes + 8 * i, last[i]);
+    Blake2bLong((unsigned char*)output, WDC_ARGON2_HASH_LENGTH, blockbytes, sizeof(blockbytes));
+}
+
+void worldcoin_argon2d_ctx(worldcoin_argon2d_context *ctx, const char *input, char *output)
+{
+    if (ctx != NULL) {
+        Argon2dHash((uint64_t*)ctx->arena, input, output);
+        return;
+    }
+    std::vector<uint64_t> memory((size_t)WDC_ARGON2_MEMORY_COST * ARGON2_BLOCK_WORDS);
+    Argon2dHash(&memory[0], input, output);
+}
+
+#if defined(USE_ARGON2_X86)
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+}
+
+/** Extended register state enabled by the OS */
+static uint64_t xgetbv0()
+{
+    uint32_t a, d;
+    __asm__ ("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return ((uint64_t)d << 32) | a;
+}
+
+static bool CPUHasKernel(int kernel)
+{
+    uint32_t a, b, c, d;
+    cpuid(0, 0, a, b, c, d);
+    uint32_t nMaxLeaf = a;
+    cpuid(1, 0, a, b, c, d);
+    bool fSSE2 = d & (1 << 26);
+    bool fSSSE3 = c & (1 << 9);
+    bool fOSXSAVE = c & (1 << 27);
+    uint64_t xcr0 = fOSXSAVE ? xgetbv0() : 0;
+    bool fAVX2 = false, fAVX512 = false;
+    if (nMaxLeaf >= 7) {
+        cpuid(7, 0, a, b, c, d);
+        fAVX2 = (b & (1 << 5)) && (xcr0 & 0x6) == 0x6;
+        fAVX512 = (b & (1 << 16)) && (xcr0 & 0xe6) == 0xe6;
+    }
+    switch (kernel) {
+    case WDC_ARGON2D_SSE2: return fSSE2;
+    case WDC_ARGON2D_SSSE3: return fSSSE3;
+    case WDC_ARGON2D_AVX2: return fAVX2;
+    case WDC_ARGON2D_AVX512: return fAVX512;
+    }
+    return false;
+}
+#endif
+
+static const char *kernel_names[WDC_ARGON2D_KERNELS] = {"generic", "sse2", "ssse3", "avx2", "avx512"};
+
+int worldcoin_argon2d_use_kernel(int kernel)
+{
+    if (kernel == WDC_ARGON2D_GENERIC) {
+        argon2d_fill_block_detected = &worldcoin_argon2d_fill_block_generic;
+        return 1;
+    }
+#if defined(USE_ARGON2_X86)
+    if (!CPUHasKernel(kernel))
+        return 0;
+    switch (kernel) {
+#if defined(ENABLE_ARGON2_SSE2)
+    case WDC_ARGON2D_SSE2: argon2d_fill_block_detected = &worldcoin_argon2d_fill_block_sse2; return 1;
+#endif
+#if defined(ENABLE_ARGON2_SSSE3)
+    case WDC_ARGON2D_SSSE3: argon2d_fill_block_detected = &worldcoin_argon2d_fill_block_ssse3; return 1;
+#endif
+#if defined(ENABLE_ARGON2_AVX2)
+    case WDC_ARGON2D_AVX2: argon2d_fill_block_detected = &worldcoin_argon2d_fill_block_avx2; return 1;
+#endif
+#if defined(ENABLE_ARGON2_AVX512)
+    case WDC_ARGON2D_AVX512: argon2d_fill_block_detected = &worldcoin_argon2d_fill_block_avx512; return 1;
+#endif
+    }
+#endif
+    return 0;
+}
+
+const char *worldcoin_argon2d_detect(void)
+{
+    for (int kernel = WDC_ARGON2D_KERNELS - 1; kernel > WDC_ARGON2D_GENERIC; kernel--) {
+        if (worldcoin_argon2d_use_kernel(kernel))
+            return kernel_names[kernel];
+    }
+    worldcoin_argon2d_use_kernel(WDC_ARGON2D_GENERIC);
+    return kernel_names[WDC_ARGON2D_GENERIC];
+}
+
+#ifdef WIN32
+worldcoin_argon2d_context *worldcoin_argon2d_thread_context(void)
+{
+    // No thread exit hook here: hash with a fresh allocation every time
+    return NULL;
+}
+#else
+static pthread_key_t keyThreadContext;
+static pthread_once_t onceThreadContext = PTHREAD_ONCE_INIT;
+
+static void DestroyThreadContext(void *ctx)
+{
+    worldcoin_argon2d_context_destroy((worldcoin_argon2d_context*)ctx);
+}
+
+static void CreateThreadContextKey()
+{
+    pthread_key_create(&keyThreadContext, DestroyThreadContext);
+}
+
+worldcoin_argon2d_context *worldcoin_argon2d_thread_context(void)
+{
+    pthread_once(&onceThreadContext, CreateThreadContextKey);
+    worldcoin_argon2d_context *ctx = (worldcoin_argon2d_context*)pthread_getspecific(keyThreadContext);
+    if (ctx == NULL) {
+        ctx = worldcoin_argon2d_context_create();
+        if (ctx != NULL)
+            pthread_setspecific(keyThreadContext, ctx);
+    }
+    return ctx;
+}
+#endif
 
 void worldcoin_argon2d(const char *input, char *output)
 {
-    // Use block header (80 bytes) as input
-    // Use a fixed salt for mining (could be derived from input)
-    const char salt[] = "WorldcoinArgon2dSalt2025";
-
-    argon2d_hash_raw(WDC_ARGON2_TIME_COST,
-                     WDC_ARGON2_MEMORY_COST,
-                     WDC_ARGON2_PARALLELISM,
-                     input, 80,                    // 80-byte block header
-                     salt, sizeof(salt) - 1,      // Fixed salt
-                     output, WDC_ARGON2_HASH_LENGTH);
-}
\ No newline at end of file
+    worldcoin_argon2d_ctx(worldcoin_argon2d_thread_context(), input, output);
+}
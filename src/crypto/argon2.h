@@ -14,10 +14,64 @@ static const uint32_t WDC_ARGON2_MEMORY_COST = 4096; // 4MB memory
 static const uint32_t WDC_ARGON2_PARALLELISM = 1;   // Single thread
 static const uint32_t WDC_ARGON2_HASH_LENGTH = 32;  // 256-bit output
 
+/**
+ * Argon2d hashing state that owns the 4MB memory matrix, so that it is
+ * allocated (backed by huge pages where the OS allows) once and reused for
+ * every hash instead of being allocated and freed on each call.
+ * A context must not be used by two threads at the same time.
+ */
+typedef struct worldcoin_argon2d_context worldcoin_argon2d_context;
+
+/** Allocate a context. Returns NULL if the memory could not be reserved. */
+worldcoin_argon2d_context *worldcoin_argon2d_context_create(void);
+void worldcoin_argon2d_context_destroy(worldcoin_argon2d_context *ctx);
+
+/** Context of the calling thread, created on first use and freed when the thread exits. */
+worldcoin_argon2d_context *worldcoin_argon2d_thread_context(void);
+
+/** Hash an 80-byte block header using the memory of ctx. */
+void worldcoin_argon2d_ctx(worldcoin_argon2d_context *ctx, const char *input, char *output);
+
+/** Hash an 80-byte block header using the context of the calling thread. */
 void worldcoin_argon2d(const char *input, char *output);
 
+/**
+ * Argon2d compression function G: next = G(prev ^ ref), additionally xored
+ * into the old contents of next when with_xor is set. Blocks are 128 64-bit words.
+ */
+void worldcoin_argon2d_fill_block_generic(uint64_t *next, const uint64_t *prev, const uint64_t *ref, int with_xor);
+
+#if defined(USE_ARGON2_X86)
+void worldcoin_argon2d_fill_block_sse2(uint64_t *next, const uint64_t *prev, const uint64_t *ref, int with_xor);
+void worldcoin_argon2d_fill_block_ssse3(uint64_t *next, const uint64_t *prev, const uint64_t *ref, int with_xor);
+void worldcoin_argon2d_fill_block_avx2(uint64_t *next, const uint64_t *prev, const uint64_t *ref, int with_xor);
+void worldcoin_argon2d_fill_block_avx512(uint64_t *next, const uint64_t *prev, const uint64_t *ref, int with_xor);
+#endif
+
+// Compression function implementations, fastest last
+enum {
+    WDC_ARGON2D_GENERIC = 0,
+    WDC_ARGON2D_SSE2,
+    WDC_ARGON2D_SSSE3,
+    WDC_ARGON2D_AVX2,
+    WDC_ARGON2D_AVX512,
+    WDC_ARGON2D_KERNELS
+};
+
+/**
+ * Select the fastest compression function supported by this build and CPU
+ * and return its name. Until this is called the generic one is used.
+ */
+const char *worldcoin_argon2d_detect(void);
+
+/**
+ * Switch to a specific compression function, for tests and benchmarks. Must not
+ * be called while other threads are hashing. Returns 0 if it is not available.
+ */
+int worldcoin_argon2d_use_kernel(int kernel);
+
 #ifdef __cplusplus
 }
 #endif
 
-#endif // BITCOIN_CRYPTO_ARGON2_H
\ No newline at end of file
+#endif // BITCOIN_CRYPTO_ARGON2_H
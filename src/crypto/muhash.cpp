@@ -0,0 +1,123 @@
+// Copyright (c) 2025 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/sha256.h"
+
+#include <string.h>
+
+namespace
+{
+typedef CMuHash3072::limb_t limb_t;
+#ifdef __SIZEOF_INT128__
+typedef unsigned __int128 double_limb_t;
+#else
+typedef uint64_t double_limb_t;
+#endif
+const int LIMB_BITS = 8 * sizeof(limb_t);
+const int LIMBS = CMuHash3072::LIMBS;
+
+/** The modulus is 2^3072 - MODULUS_DIFF. */
+const limb_t MODULUS_DIFF = 1103717;
+
+/** Add n * MODULUS_DIFF (n below 2^(LIMB_BITS - 21)) to the number in limbs; returns the carry out of the top limb. */
+limb_t AddMultipleOfDiff(limb_t* limbs, limb_t n)
+{
+    double_limb_t carry = (double_limb_t)n * MODULUS_DIFF;
+    for (int i = 0; i < LIMBS && carry; i++) {
+        double_limb_t v = (double_limb_t)limbs[i] + (limb_t)carry;
+        limbs[i] = (limb_t)v;
+        carry = (carry >> LIMB_BITS) + (v >> LIMB_BITS);
+    }
+    return (limb_t)carry;
+}
+
+void ReadLimbs(limb_t* limbs, const unsigned char* buf, int nLimbs)
+{
+    for (int i = 0; i < nLimbs; i++) {
+        limbs[i] = 0;
+        for (int j = sizeof(limb_t) - 1; j >= 0; j--)
+            limbs[i] = (limbs[i] << 8) | buf[i * sizeof(limb_t) + j];
+    }
+}
+
+void WriteLimbs(unsigned char* buf, const limb_t* limbs, int nLimbs)
+{
+    for (int i = 0; i < nLimbs; i++) {
+        for (unsigned int j = 0; j < sizeof(limb_t); j++)
+            buf[i * sizeof(limb_t) + j] = (unsigned char)(limbs[i] >> (8 * j));
+    }
+}
+}
+
+CMuHash3072::CMuHash3072()
+{
+    memset(limbs, 0, sizeof(limbs));
+    limbs[0] = 1;
+}
+
+void CMuHash3072::Multiply(const limb_t* a)
+{
+    limb_t r[2 * LIMBS];
+    memset(r, 0, sizeof(r));
+    for (int i = 0; i < LIMBS; i++) {
+        double_limb_t carry = 0;
+        for (int j = 0; j < LIMBS; j++) {
+            double_limb_t v = (double_limb_t)limbs[i] * a[j] + r[i + j] + carry;
+            r[i + j] = (limb_t)v;
+            carry = v >> LIMB_BITS;
+        }
+        r[i + LIMBS] = (limb_t)carry;
+    }
+
+    // 2^3072 is MODULUS_DIFF modulo the prime, so the upper half folds into
+    // the lower one multiplied by MODULUS_DIFF
+    double_limb_t carry = 0;
+    for (int i = 0; i < LIMBS; i++) {
+        double_limb_t v = (double_limb_t)r[i + LIMBS] * MODULUS_DIFF + r[i] + carry;
+        limbs[i] = (limb_t)v;
+        carry = v >> LIMB_BITS;
+    }
+    limb_t nCarry = (limb_t)carry;
+    while (nCarry)
+        nCarry = AddMultipleOfDiff(limbs, nCarry);
+}
+
+CMuHash3072& CMuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    unsigned char seed[CSHA256::OUTPUT_SIZE + 4];
+    CSHA256().Write(data, len).Finalize(seed);
+
+    // Expand the element to 3072 bits with SHA-256 in counter mode
+    unsigned char buf[384];
+    for (unsigned int i = 0; i < sizeof(buf) / CSHA256::OUTPUT_SIZE; i++) {
+        for (int j = 0; j < 4; j++)
+            seed[CSHA256::OUTPUT_SIZE + j] = (unsigned char)(i >> (8 * j));
+        CSHA256().Write(seed, sizeof(seed)).Finalize(buf + i * CSHA256::OUTPUT_SIZE);
+    }
+    limb_t a[LIMBS];
+    ReadLimbs(a, buf, LIMBS);
+    Multiply(a);
+    return *this;
+}
+
+CMuHash3072& CMuHash3072::operator*=(const CMuHash3072& other)
+{
+    Multiply(other.limbs);
+    return *this;
+}
+
+void CMuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE]) const
+{
+    // The number is below 2^3072 but may be at or above the prime: it is
+    // iff adding MODULUS_DIFF carries out, which also subtracts the prime
+    limb_t reduced[LIMBS];
+    memcpy(reduced, limbs, sizeof(reduced));
+    const limb_t* canonical = AddMultipleOfDiff(reduced, 1) ? reduced : limbs;
+
+    unsigned char buf[384];
+    WriteLimbs(buf, canonical, LIMBS);
+    CSHA256().Write(buf, sizeof(buf)).Finalize(hash);
+}
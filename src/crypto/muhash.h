@@ -0,0 +1,44 @@
+// Copyright (c) 2025 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * A hasher for sets of byte strings (MuHash3072). Every element is expanded
+ * with SHA-256 to a number modulo the prime 2^3072 - 1103717, and the set
+ * hash is the product of its elements. Unlike a sum of hashes, finding a set
+ * with a chosen hash takes a discrete logarithm in that group. The result
+ * does not depend on the order in which elements are inserted, and hashes of
+ * disjoint sets combine with operator*=.
+ */
+class CMuHash3072
+{
+public:
+#ifdef __SIZEOF_INT128__
+    typedef uint64_t limb_t;
+#else
+    typedef uint32_t limb_t;
+#endif
+    static const size_t OUTPUT_SIZE = 32;
+    static const int LIMBS = 3072 / (8 * sizeof(limb_t));
+
+private:
+    //! Little-endian limbs of a number below 2^3072, not always fully reduced
+    limb_t limbs[LIMBS];
+
+    void Multiply(const limb_t* a);
+
+public:
+    //! The hash of the empty set
+    CMuHash3072();
+    CMuHash3072& Insert(const unsigned char* data, size_t len);
+    CMuHash3072& operator*=(const CMuHash3072& other);
+    void Finalize(unsigned char hash[OUTPUT_SIZE]) const;
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -152,6 +152,58 @@ public:
     }
 };
 
+/** Reads from or writes to another stream, keeping the hash of all the data that passed through. */
+template<typename Source>
+class CHashStream
+{
+private:
+    Source* source;
+    CHash256 ctx;
+    uint64_t nBytes;
+
+public:
+    explicit CHashStream(Source* sourceIn) : source(sourceIn), nBytes(0) {}
+
+    int GetType() { return source->GetType(); }
+    int GetVersion() { return source->GetVersion(); }
+
+    CHashStream& read(char *pch, size_t size) {
+        source->read(pch, size);
+        ctx.Write((const unsigned char*)pch, size);
+        nBytes += size;
+        return (*this);
+    }
+
+    CHashStream& write(const char *pch, size_t size) {
+        source->write(pch, size);
+        ctx.Write((const unsigned char*)pch, size);
+        nBytes += size;
+        return (*this);
+    }
+
+    //! Number of bytes that passed through so far
+    uint64_t GetCount() const { return nBytes; }
+
+    // invalidates the object
+    uint256 GetHash() {
+        uint256 result;
+        ctx.Finalize((unsigned char*)&result);
+        return result;
+    }
+
+    template<typename T>
+    CHashStream& operator<<(const T& obj) {
+        ::Serialize(*this, obj, GetType(), GetVersion());
+        return (*this);
+    }
+
+    template<typename T>
+    CHashStream& operator>>(T& obj) {
+        ::Unserialize(*this, obj, GetType(), GetVersion());
+        return (*this);
+    }
+};
+
 /** Compute the 256-bit hash of an object's serialization. */
 template<typename T>
 uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL_VERSION)
@@ -13,6 +13,7 @@
 #include "amount.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
+#include "crypto/argon2.h"
 #include "key.h"
 #include "main.h"
 #include "miner.h"
@@ -50,6 +51,7 @@ using namespace std;
 CWallet* pwalletMain = NULL;
 #endif
 bool fFeeEstimatesInitialized = false;
+static bool fDumpMempoolLater = false;
 
 #ifdef WIN32
 // Win32 LevelDB doesn't use filedescriptors, and the ones used for
@@ -132,7 +134,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 
 void Shutdown()
@@ -169,6 +170,9 @@ void Shutdown()
         fFeeEstimatesInitialized = false;
     }
 
+    if (fDumpMempoolLater)
+        DumpMempool();
+
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
@@ -178,6 +182,8 @@ void Shutdown()
         pcoinsTip = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        delete pcoinsWriter;
+        pcoinsWriter = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
@@ -235,6 +241,22 @@ bool static Bind(const CService &addr, unsigned int flags) {
     return true;
 }
 
+/** Read the tuning of a database from -<strDB>profile and the -<strDB><opt> overrides */
+bool static GetDBProfileArgs(const std::string& strDB, CLevelDBProfile& profile)
+{
+    std::string strPreset = GetArg("-" + strDB + "profile", "default");
+    if (!profile.SetPreset(strPreset))
+        return InitError(strprintf(_("Unknown database profile -%sprofile=%s"), strDB, strPreset));
+    profile.nBlockSize = GetArg("-" + strDB + "blocksize", profile.nBlockSize);
+    profile.nMaxOpenFiles = GetArg("-" + strDB + "maxopenfiles", profile.nMaxOpenFiles);
+    profile.fCompression = GetBoolArg("-" + strDB + "compression", profile.fCompression);
+    profile.nBloomBits = GetArg("-" + strDB + "bloombits", profile.nBloomBits);
+    profile.nWriteBufferPercent = GetArg("-" + strDB + "writebuffer", profile.nWriteBufferPercent);
+    if (!profile.IsValid())
+        return InitError(strprintf(_("Invalid %s database settings (see -help-debug for the allowed ranges)"), strDB));
+    return true;
+}
+
 std::string HelpMessage(HelpMessageMode mode)
 {
     // When adding new options to the categories, please keep and ensure alphabetical ordering.
@@ -254,9 +276,19 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -dbcache=<n>           " + strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache) + "\n";
+    strUsage += "  -chainstateprofile=<p> " + strprintf(_("Tune the chainstate database for the disk it is on: default, hdd or ssd (default: %s)"), "default") + "\n";
+    strUsage += "  -blockindexprofile=<p> " + strprintf(_("Tune the block index database for the disk it is on: default, hdd or ssd (default: %s)"), "default") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + " " + _("on startup") + "\n";
+    strUsage += "  -loadsnapshot=<file>   " + _("Start from a UTXO set snapshot written by dumptxoutset, if the chain is not beyond the genesis block yet. The blocks up to the snapshot must be stored; they are trusted, not validated") + "\n";
+    strUsage += "  -loadsnapshotchecksum=<hex> " + _("Checksum dumptxoutset reported for the -loadsnapshot file; required unless one is built in for its block") + "\n";
     strUsage += "  -maxorphantx=<n>       " + strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS) + "\n";
-    strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
+    strUsage += "  -maxmempool=<n>        " + strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE) + "\n";
+    strUsage += "  -limitancestorcount=<n>   " + strprintf(_("Do not accept transactions with <n> or more in-pool ancestors, themselves included (default: %u)"), DEFAULT_ANCESTOR_LIMIT) + "\n";
+    strUsage += "  -limitancestorsize=<n>    " + strprintf(_("Do not accept transactions whose size with all in-pool ancestors exceeds <n> kilobytes (default: %u)"), DEFAULT_ANCESTOR_SIZE_LIMIT) + "\n";
+    strUsage += "  -limitdescendantcount=<n> " + strprintf(_("Do not accept transactions that would give an in-pool transaction more than <n> descendants, itself included (default: %u)"), DEFAULT_DESCENDANT_LIMIT) + "\n";
+    strUsage += "  -limitdescendantsize=<n>  " + strprintf(_("Do not accept transactions that would make an in-pool transaction with its descendants exceed <n> kilobytes (default: %u)"), DEFAULT_DESCENDANT_SIZE_LIMIT) + "\n";
+    strUsage += "  -persistmempool        " + strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL) + "\n";
+    strUsage += "  -par=<n>               " + strprintf(_("Set the number of script and header proof-of-work verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
 #ifndef WIN32
     strUsage += "  -pid=<file>            " + strprintf(_("Specify pid file (default: %s)"), "worldcoind.pid") + "\n";
 #endif
@@ -324,6 +356,8 @@ std::string HelpMessage(HelpMessageMode mode)
     if (GetBoolArg("-help-debug", false))
     {
         strUsage += "  -checkpoints           " + strprintf(_("Only accept block chain matching built-in checkpoints (default: %u)"), 1) + "\n";
+        strUsage += "  -chainstate<opt>=<n>   " + _("Override one setting of the chainstate database profile: <opt> is blocksize (1024 to 4194304 bytes), maxopenfiles (64 to 50000), compression (0/1), bloombits (bits per key, 0 to 64, 0 = none) or writebuffer (1 to 49 percent of its cache)") + "\n";
+        strUsage += "  -blockindex<opt>=<n>   " + _("Override one setting of the block index database profile, see -chainstate<opt>") + "\n";
         strUsage += "  -dblogsize=<n>         " + strprintf(_("Flush database activity from memory pool to disk log every <n> megabytes (default: %u)"), 100) + "\n";
         strUsage += "  -disablesafemode       " + strprintf(_("Disable safemode, override a real safe mode event (default: %u)"), 0) + "\n";
         strUsage += "  -testsafemode          " + strprintf(_("Force safe mode (default: %u)"), 0) + "\n";
@@ -335,7 +369,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -debug=<category>      " + strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + "\n";
     strUsage += "                         " + _("If <category> is not supplied, output all debugging information.") + "\n";
     strUsage += "                         " + _("<category> can be:");
-    strUsage +=                                 " addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, net"; // Don't translate these and qt below
+    strUsage +=                                 " addrman, alert, bench, coindb, db, lock, pow, rand, rpc, selectcoins, mempool, net"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         strUsage += ", qt";
     strUsage += ".\n";
@@ -350,7 +384,7 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += "  -limitfreerelay=<n>    " + strprintf(_("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default:%u)"), 15) + "\n";
         strUsage += "  -relaypriority         " + strprintf(_("Require high priority for relaying free or low-fee transactions (default:%u)"), 1) + "\n";
-        strUsage += "  -maxsigcachesize=<n>   " + strprintf(_("Limit size of signature cache to <n> entries (default: %u)"), 50000) + "\n";
+        strUsage += "  -maxsigcachesize=<n>   " + strprintf(_("Limit size of signature cache to <n> megabytes (0 to %d, default: %d; larger values are taken as a number of entries, as in earlier versions)"), MAX_MAX_SIG_CACHE_SIZE, DEFAULT_MAX_SIG_CACHE_SIZE) + "\n";
     }
     strUsage += "  -minrelaytxfee=<amt>   " + strprintf(_("Fees (in WDC/Kb) smaller than this are considered zero fee for relaying (default: %s)"), FormatMoney(::minRelayTxFee.GetFeePerK())) + "\n";
     strUsage += "  -printtoconsole        " + _("Send trace/debug info to console instead of debug.log file") + "\n";
@@ -503,6 +537,31 @@ if (boost::filesystem::exists(pathBootstrap)) {
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    // Reload the transactions saved at the last shutdown; only overwrite
+    // mempool.dat again once they have all been offered to the pool
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool();
+        fDumpMempoolLater = !ShutdownRequested();
+    }
+}
+
+/** Once the initial block download is over, finish the bulk load the chainstate was opened for */
+void ThreadFinishBulkLoad()
+{
+    RenameThread("worldcoin-bulkload");
+    while (IsInitialBlockDownload())
+        MilliSleep(10 * 1000);
+
+    LogPrintf("Initial block download finished, compacting the chainstate...\n");
+    int64_t nStart = GetTimeMillis();
+    try {
+        pcoinsdbview->EndBulkLoad();
+    } catch (const leveldb_error& e) {
+        AbortNode(std::string("System error while compacting the chainstate: ") + e.what());
+        return;
+    }
+    LogPrintf("Compacted the chainstate in %dms\n", GetTimeMillis() - nStart);
 }
 
 /** Sanity checks
@@ -650,15 +709,22 @@ bool AppInit2(boost::thread_group& threadGroup)
             LogPrintf("AppInit2 : parameter interaction: -zapwallettxes=<mode> -> setting -rescan=1\n");
     }
 
-    // Make sure enough file descriptors are available
+    CLevelDBProfile chainstateProfile, blockIndexProfile;
+    if (!GetDBProfileArgs("chainstate", chainstateProfile) || !GetDBProfileArgs("blockindex", blockIndexProfile))
+        return false;
+
+    // Make sure enough file descriptors are available, including for databases
+    // allowed to keep more table files open than MIN_CORE_FILEDESCRIPTORS assumes
+    int nCoreFD = MIN_CORE_FILEDESCRIPTORS + (chainstateProfile.nMaxOpenFiles - CLevelDBProfile().nMaxOpenFiles) +
+                  (blockIndexProfile.nMaxOpenFiles - CLevelDBProfile().nMaxOpenFiles);
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", 125);
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
-    int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - nCoreFD)), 0);
+    int nFD = RaiseFileDescriptorLimit(nMaxConnections + nCoreFD);
+    if (nFD < nCoreFD)
         return InitError(_("Not enough file descriptors available."));
-    if (nFD - MIN_CORE_FILEDESCRIPTORS < nMaxConnections)
-        nMaxConnections = nFD - MIN_CORE_FILEDESCRIPTORS;
+    if (nFD - nCoreFD < nMaxConnections)
+        nMaxConnections = nFD - nCoreFD;
 
     // ********************************************************* Step 3: parameter-to-internal-flags
 
@@ -813,7 +879,9 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %s Argon2d implementation\n", worldcoin_argon2d_detect());
+
+    LogPrintf("Using %u threads for script and header proof-of-work verification and coin prefetching\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
@@ -1053,7 +1121,12 @@ if (!boost::filesystem::exists(blocksDir))
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache; // the rest is the in-memory coins cache, measured in bytes
+
+    // A new chainstate is written in bulk until the initial block download is over.
+    // The block index is not: its synced writes are what a chainstate that lost
+    // its unsynced ones after a crash is replayed from.
+    bool fNewChainstate = !filesystem::exists(GetDataDir() / "chainstate");
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1067,13 +1140,24 @@ if (!boost::filesystem::exists(blocksDir))
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
-                delete pcoinsdbview;
                 delete pcoinscatcher;
+                delete pcoinsWriter;
+                delete pcoinsdbview;
                 delete pblocktree;
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                chainstateProfile.fBulkLoad = fReindex || fNewChainstate;
+                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex, blockIndexProfile);
+                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex, chainstateProfile);
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+                if (pcoinsdbview->IsLoadingSnapshot() && !mapArgs.count("-loadsnapshot")) {
+                    strLoadError = _("The chainstate database is incomplete after an interrupted UTXO snapshot load, use -loadsnapshot to load it again");
+                    break;
+                }
+                pcoinsWriter = new CCoinsViewAsyncWriter(pcoinsdbview);
+                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsWriter);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
                 if (fReindex)
@@ -1145,6 +1229,21 @@ if (!boost::filesystem::exists(blocksDir))
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // -loadsnapshot replaces the chainstate before any block is connected to it
+    if (mapArgs.count("-loadsnapshot")) {
+        if (chainActive.Height() > 0) {
+            LogPrintf("Ignoring -loadsnapshot, the active chain is already at height %d\n", chainActive.Height());
+        } else {
+            boost::filesystem::path pathSnapshot(GetArg("-loadsnapshot", ""));
+            if (!pathSnapshot.is_absolute())
+                pathSnapshot = GetDataDir() / pathSnapshot;
+            uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+            CCoinsStats stats;
+            if (!LoadTxOutSet(pathSnapshot, uint256(GetArg("-loadsnapshotchecksum", "0")), stats))
+                return InitError(strprintf(_("Error loading UTXO snapshot %s (see debug.log)"), pathSnapshot.string()));
+        }
+    }
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1306,6 +1405,8 @@ if (!boost::filesystem::exists(blocksDir))
             vImportFiles.push_back(strFile);
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    if (chainstateProfile.fBulkLoad)
+        threadGroup.create_thread(&ThreadFinishBulkLoad);
     if (chainActive.Tip() == NULL) {
         LogPrintf("Waiting for genesis block to be imported...\n");
         while (!fRequestShutdown && chainActive.Tip() == NULL)
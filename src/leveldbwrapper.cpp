@@ -6,7 +6,14 @@
 
 #include "util.h"
 
+#include <algorithm>
+
+#include <boost/atomic.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -27,14 +34,133 @@ void HandleError(const leveldb::Status& status) throw(leveldb_error)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+bool CLevelDBProfile::SetPreset(const std::string& strName)
+{
+    *this = CLevelDBProfile();
+    if (strName == "default")
+        return true;
+    if (strName == "hdd") {
+        // Every block read is a seek: read more per seek, keep table files
+        // open and make the bloom filters rule out more of them.
+        nBlockSize = 64 * 1024;
+        nMaxOpenFiles = 1000;
+        nBloomBits = 16;
+        return true;
+    }
+    if (strName == "ssd") {
+        // Reads are cheap: favour fewer, larger level-0 files over block cache.
+        nMaxOpenFiles = 1000;
+        nWriteBufferPercent = 40;
+        return true;
+    }
+    return false;
+}
+
+bool CLevelDBProfile::IsValid() const
+{
+    return nBlockSize >= 1024 && nBlockSize <= 4 * 1024 * 1024 &&
+           nMaxOpenFiles >= 64 && nMaxOpenFiles <= 50000 &&
+           nBloomBits >= 0 && nBloomBits <= 64 &&
+           nWriteBufferPercent >= 1 && nWriteBufferPercent <= 49;
+}
+
+class CLevelDBCounters
+{
+public:
+    //! Block cache lookups run on every reading thread at once, so they only
+    //! bump these without ordering or a lock
+    boost::atomic<uint64_t> nCacheHits;
+    boost::atomic<uint64_t> nCacheMisses;
+
+    boost::mutex cs;
+    uint64_t nWrites;
+    int64_t nWriteMicros;
+    int64_t nStallMicros;
+
+    CLevelDBCounters() : nCacheHits(0), nCacheMisses(0), nWrites(0), nWriteMicros(0), nStallMicros(0) {}
+};
+
+namespace {
+
+/** Block cache that counts how many lookups it could answer */
+class CCountingCache : public leveldb::Cache
+{
+private:
+    leveldb::Cache* pcache;
+    CLevelDBCounters& counters;
+
+public:
+    CCountingCache(size_t nCapacity, CLevelDBCounters& countersIn) : pcache(leveldb::NewLRUCache(nCapacity)), counters(countersIn) {}
+    ~CCountingCache() { delete pcache; }
+
+    Handle* Insert(const leveldb::Slice& key, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value))
+    {
+        return pcache->Insert(key, value, charge, deleter);
+    }
+
+    Handle* Lookup(const leveldb::Slice& key)
+    {
+        Handle* handle = pcache->Lookup(key);
+        if (handle)
+            counters.nCacheHits.fetch_add(1, boost::memory_order_relaxed);
+        else
+            counters.nCacheMisses.fetch_add(1, boost::memory_order_relaxed);
+        return handle;
+    }
+
+    void Release(Handle* handle) { pcache->Release(handle); }
+    void* Value(Handle* handle) { return pcache->Value(handle); }
+    void Erase(const leveldb::Slice& key) { pcache->Erase(key); }
+    uint64_t NewId() { return pcache->NewId(); }
+    void Prune() { pcache->Prune(); }
+    size_t TotalCharge() const { return pcache->TotalCharge(); }
+};
+
+/**
+ * Environment that counts the time writes are delayed. LevelDB only sleeps
+ * through its environment to slow writes down while level-0 compactions catch
+ * up; writes that wait for a compaction to finish outright only show up in the
+ * total write time.
+ */
+class CCountingEnv : public leveldb::EnvWrapper
+{
+private:
+    CLevelDBCounters& counters;
+
+public:
+    CCountingEnv(leveldb::Env* target, CLevelDBCounters& countersIn) : leveldb::EnvWrapper(target), counters(countersIn) {}
+
+    void SleepForMicroseconds(int micros)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(counters.cs);
+            counters.nStallMicros += micros;
+        }
+        target()->SleepForMicroseconds(micros);
+    }
+};
+
+}
+
+//! Percentage of the cache used per write buffer while bulk loading
+static const int BULK_LOAD_WRITE_BUFFER_PERCENT = 45;
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CLevelDBProfile& profile, CLevelDBCounters& counters)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    // Larger write buffers turn a bulk load into fewer, larger level-0 files,
+    // so the compactions that stall writes are needed less often. The block
+    // cache shrinks accordingly for as long as the database stays open.
+    int nWriteBufferPercent = profile.nWriteBufferPercent;
+    if (profile.fBulkLoad)
+        nWriteBufferPercent = std::max(nWriteBufferPercent, BULK_LOAD_WRITE_BUFFER_PERCENT);
+    size_t nWriteBufferSize = nCacheSize / 100 * nWriteBufferPercent;
+    options.block_cache = new CCountingCache(nCacheSize - 2 * nWriteBufferSize, counters);
+    options.write_buffer_size = nWriteBufferSize; // up to two write buffers may be held in memory simultaneously
+    options.block_size = profile.nBlockSize;
+    options.filter_policy = profile.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(profile.nBloomBits) : NULL;
+    options.compression = profile.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = profile.nMaxOpenFiles;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -43,19 +169,21 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CLevelDBProfile& profileIn) : profile(profileIn), fBulkLoad(profileIn.fBulkLoad)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    pcounters = new CLevelDBCounters();
+    options = GetOptions(nCacheSize, profile, *pcounters);
     options.create_if_missing = true;
-    if (fMemory) {
+    if (fMemory)
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
-        options.env = penv;
-    } else {
+    pcountingenv = new CCountingEnv(penv ? penv : leveldb::Env::Default(), *pcounters);
+    options.env = pcountingenv;
+    if (!fMemory) {
         if (fWipe) {
             LogPrintf("Wiping LevelDB in %s\n", path.string());
             leveldb::Status result = leveldb::DestroyDB(path.string(), options);
@@ -77,13 +205,90 @@ CLevelDBWrapper::~CLevelDBWrapper()
     options.filter_policy = NULL;
     delete options.block_cache;
     options.block_cache = NULL;
-    delete penv;
+    delete pcountingenv;
     options.env = NULL;
+    delete penv;
+    delete pcounters;
 }
 
 bool CLevelDBWrapper::WriteBatch(CLevelDBBatch& batch, bool fSync) throw(leveldb_error)
 {
-    leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    int64_t nStart = GetTimeMicros();
+    leveldb::Status status = pdb->Write(fSync && !IsBulkLoading() ? syncoptions : writeoptions, &batch.batch);
+    {
+        boost::unique_lock<boost::mutex> lock(pcounters->cs);
+        pcounters->nWrites++;
+        pcounters->nWriteMicros += GetTimeMicros() - nStart;
+    }
     HandleError(status);
     return true;
 }
+
+void CLevelDBWrapper::GetStats(CLevelDBStats& stats) const
+{
+    if (!pdb->GetProperty("leveldb.stats", &stats.strLevelDBStats))
+        stats.strLevelDBStats.clear();
+    // Every key starts with a one byte type prefix below 0xff
+    leveldb::Range range("", std::string(1, '\xff'));
+    pdb->GetApproximateSizes(&range, 1, &stats.nApproximateSize);
+
+    stats.nCacheHits = pcounters->nCacheHits.load(boost::memory_order_relaxed);
+    stats.nCacheMisses = pcounters->nCacheMisses.load(boost::memory_order_relaxed);
+
+    boost::unique_lock<boost::mutex> lock(pcounters->cs);
+    stats.nWrites = pcounters->nWrites;
+    stats.nWriteMicros = pcounters->nWriteMicros;
+    stats.nStallMicros = pcounters->nStallMicros;
+    stats.fBulkLoading = fBulkLoad;
+}
+
+bool CLevelDBWrapper::IsBulkLoading() const
+{
+    boost::unique_lock<boost::mutex> lock(pcounters->cs);
+    return fBulkLoad;
+}
+
+void CLevelDBWrapper::EndBulkLoad() throw(leveldb_error)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(pcounters->cs);
+        if (!fBulkLoad)
+            return;
+        fBulkLoad = false;
+    }
+    Sync();
+
+    // LevelDB cannot abort a compaction, so every key prefix is compacted in
+    // 256 pieces (split on the second byte) to keep this interruptible.
+    std::string strPrefix;
+    while (true) {
+        {
+            // A fresh iterator for every prefix: an open one would keep the
+            // files already compacted away from being deleted
+            boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+            pcursor->Seek(strPrefix);
+            if (!pcursor->Valid()) {
+                HandleError(pcursor->status());
+                break;
+            }
+            strPrefix = pcursor->key().ToString().substr(0, 1);
+        }
+        unsigned char chPrefix = strPrefix[0];
+        for (int i = 0; i < 256; i++) {
+            boost::this_thread::interruption_point();
+            std::string strBegin = strPrefix;
+            if (i > 0)
+                strBegin += (char)i;
+            std::string strEnd = strPrefix;
+            if (i < 255)
+                strEnd += (char)(i + 1);
+            else
+                strEnd[0] = chPrefix + 1;
+            leveldb::Slice slBegin(strBegin), slEnd(strEnd);
+            pdb->CompactRange(&slBegin, (i < 255 || chPrefix < 0xff) ? &slEnd : NULL);
+        }
+        if (chPrefix == 0xff)
+            break;
+        strPrefix[0] = chPrefix + 1;
+    }
+}
@@ -59,14 +59,73 @@ public:
 
         batch.Delete(slKey);
     }
+
+    void Clear()
+    {
+        batch.Clear();
+    }
 };
 
+/** Tuning of one LevelDB database, independent of its cache size */
+struct CLevelDBProfile
+{
+    //! approximate size of the user data packed per table block
+    size_t nBlockSize;
+    //! number of table files LevelDB may keep open
+    int nMaxOpenFiles;
+    //! compress blocks with Snappy (only effective when LevelDB was built with it)
+    bool fCompression;
+    //! bits per key of the bloom filter, 0 to use none
+    int nBloomBits;
+    //! percentage of the cache used for each of the (up to two) write buffers, the rest is block cache
+    int nWriteBufferPercent;
+    //! open for bulk loading: larger write buffers and no synced writes, until CLevelDBWrapper::EndBulkLoad
+    bool fBulkLoad;
+
+    CLevelDBProfile() : nBlockSize(4096), nMaxOpenFiles(64), fCompression(false), nBloomBits(10), nWriteBufferPercent(25), fBulkLoad(false) {}
+
+    //! Select one of the named presets ("default", "hdd" or "ssd"); returns false if there is no such preset
+    bool SetPreset(const std::string& strName);
+
+    //! Check the settings are within the ranges LevelDB accepts
+    bool IsValid() const;
+};
+
+/** Figures about one LevelDB database, see CLevelDBWrapper::GetStats */
+struct CLevelDBStats
+{
+    std::string strLevelDBStats; //!< the leveldb.stats property: per-level files, sizes and compaction work
+    uint64_t nApproximateSize;   //!< approximate size on disk of all keys
+    uint64_t nCacheHits;         //!< block cache lookups that found the block
+    uint64_t nCacheMisses;       //!< block cache lookups that had to read the block from disk
+    uint64_t nWrites;            //!< number of batches written
+    int64_t nWriteMicros;        //!< time spent writing batches
+    int64_t nStallMicros;        //!< time writes were slowed down for level-0 compactions to catch up
+    bool fBulkLoading;           //!< whether the database is still bulk loading
+
+    CLevelDBStats() : nApproximateSize(0), nCacheHits(0), nCacheMisses(0), nWrites(0), nWriteMicros(0), nStallMicros(0), fBulkLoading(false) {}
+};
+
+class CLevelDBCounters;
+
 class CLevelDBWrapper
 {
 private:
     //! custom environment this database is using (may be NULL in case of default environment)
     leveldb::Env* penv;
 
+    //! wrapper around penv (or the default environment) that counts write stalls
+    leveldb::Env* pcountingenv;
+
+    //! counters behind GetStats, shared with the block cache and pcountingenv
+    CLevelDBCounters* pcounters;
+
+    //! tuning the database was opened with
+    CLevelDBProfile profile;
+
+    //! whether writes skip syncing (see CLevelDBProfile::fBulkLoad), guarded by pcounters->cs
+    bool fBulkLoad;
+
     //! database options used
     leveldb::Options options;
 
@@ -86,9 +145,17 @@ private:
     leveldb::DB* pdb;
 
 public:
-    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CLevelDBProfile& profileIn = CLevelDBProfile());
     ~CLevelDBWrapper();
 
+    const CLevelDBProfile& GetProfile() const { return profile; }
+    void GetStats(CLevelDBStats& stats) const;
+
+    //! Whether the database was opened for bulk loading and has not finished yet
+    bool IsBulkLoading() const;
+    //! Finish bulk loading: sync what was written, then compact the whole database
+    void EndBulkLoad() throw(leveldb_error);
+
     template <typename K, typename V>
     bool Read(const K& key, V& value) const throw(leveldb_error)
     {
@@ -106,7 +173,7 @@ public:
             HandleError(status);
         }
         try {
-            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+            CSpanReader ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
             ssValue >> value;
         } catch (const std::exception&) {
             return false;
@@ -168,6 +235,25 @@ public:
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    //! Iterate over the database as it was when snapshot was taken
+    leveldb::Iterator* NewIterator(const leveldb::Snapshot* snapshot)
+    {
+        leveldb::ReadOptions options = iteroptions;
+        options.snapshot = snapshot;
+        return pdb->NewIterator(options);
+    }
+
+    //! Freeze the current state of the database for NewIterator; must be released with ReleaseSnapshot
+    const leveldb::Snapshot* GetSnapshot()
+    {
+        return pdb->GetSnapshot();
+    }
+
+    void ReleaseSnapshot(const leveldb::Snapshot* snapshot)
+    {
+        pdb->ReleaseSnapshot(snapshot);
+    }
 };
 
 #endif // BITCOIN_LEVELDBWRAPPER_H
@@ -14,6 +14,7 @@
 #include "merkleblock.h"
 #include "net.h"
 #include "pow.h"
+#include "pubkey.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -23,6 +24,7 @@
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/atomic.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/thread.hpp>
@@ -42,6 +44,8 @@ CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
 CChain chainActive;
+/** chainActive.Tip(), published for readers that do not hold cs_main */
+static boost::atomic<CBlockIndex*> pindexActiveTip(NULL);
 CBlockIndex *pindexBestHeader = NULL;
 int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
@@ -52,7 +56,7 @@ bool fReindex = false;
 bool fTxIndex = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying and mining) */
@@ -150,6 +154,11 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /** Entries whose write on the chainstate writer thread failed; dirty again at the next flush. */
+    CCriticalSection cs_failedBlockIndex;
+    set<CBlockIndex*> setFailedBlockIndex;
+    set<int> setFailedFileInfo;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -545,6 +554,8 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewAsyncWriter *pcoinsWriter = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -942,9 +953,111 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
     return nMinFee;
 }
 
+/**
+ * With libsecp256k1, script checks taken from the queue verify their
+ * signatures in one batch. If that fails, or a script failed (possibly
+ * because of a signature that was assumed valid), the checks run again one
+ * by one, which also reports the culprit. OpenSSL has no batch verification,
+ * so without libsecp256k1 the checks only run one by one.
+ */
+template <>
+bool CheckAll(std::vector<CScriptCheck>& vChecks, CScriptCheck* pcheckFailed)
+{
+#ifdef USE_SECP256K1
+    CSignatureBatch batch;
+    std::vector<std::pair<size_t, size_t> > vCache;
+    bool fBatched = true;
+    BOOST_FOREACH(CScriptCheck& check, vChecks) {
+        size_t nBegin = batch.size();
+        if (!check.VerifyBatched(batch)) {
+            fBatched = false;
+            break;
+        }
+        if (check.GetCacheStore())
+            vCache.push_back(std::make_pair(nBegin, batch.size()));
+    }
+    if (fBatched && batch.Verify()) {
+        for (unsigned int i = 0; i < vCache.size(); i++)
+            CacheSignatures(batch, vCache[i].first, vCache[i].second);
+        return true;
+    }
+#endif
+
+    BOOST_FOREACH(CScriptCheck& check, vChecks) {
+        if (!check()) {
+            if (pcheckFailed)
+                pcheckFailed->swap(check);
+            return false;
+        }
+    }
+    return true;
+}
+
+// The -par threads, shared by the script, header proof-of-work and coin prefetch queues.
+static CCheckQueueWorkers checkqueueworkers;
+
+// Shared by ConnectBlock and AcceptToMemoryPool, which both run under cs_main.
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128, &checkqueueworkers);
+
+void ThreadScriptCheck() {
+    RenameThread("worldcoin-scriptch");
+    checkqueueworkers.Thread();
+}
+
+/**
+ * Reject a transaction whose script check failed with the reason of that
+ * check, not banning the peer if only a non-mandatory flag made it fail.
+ */
+static bool InvalidScript(const CTransaction& tx, CValidationState &state, const CCoins& coins, const CScriptCheck& checkFailed, unsigned int flags, bool cacheStore)
+{
+    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+        // Check whether the failure was caused by a
+        // non-mandatory script verification check, such as
+        // non-standard DER encodings or non-null dummy
+        // arguments; if so, don't trigger DoS protection to
+        // avoid splitting the network between upgraded and
+        // non-upgraded nodes.
+        CScriptCheck check(coins, tx, checkFailed.GetInput(),
+                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+        if (check())
+            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(checkFailed.GetScriptError())));
+    }
+    // Failures of other flags indicate a transaction that is
+    // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
+    // such nodes as they are not following the protocol. That
+    // said during an upgrade careful thought should be taken
+    // as to the correct behavior - we may want to continue
+    // peering with non-upgraded nodes even after a soft-fork
+    // super-majority vote has passed.
+    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(checkFailed.GetScriptError())));
+}
+
+/**
+ * CheckInputs for a transaction entering the memory pool, verifying the
+ * scripts of its inputs on the script check threads when there are any and
+ * the transaction has more than one input. The reject reason comes from the
+ * check that failed.
+ */
+static bool CheckMempoolInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, unsigned int flags)
+{
+    if (nScriptCheckThreads == 0 || tx.vin.size() < 2)
+        return CheckInputs(tx, state, view, true, flags, true);
+
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckInputs(tx, state, view, true, flags, true, &vChecks))
+        return false;
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    CScriptCheck checkFailed;
+    if (control.Wait(&checkFailed))
+        return true;
+    const CCoins* coins = view.AccessCoins(tx.vin[checkFailed.GetInput()].prevout.hash);
+    assert(coins);
+    return InvalidScript(tx, state, *coins, checkFailed, flags, true);
+}
 
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectInsaneFee)
+                        bool* pfMissingInputs, bool fRejectInsaneFee, int64_t nAcceptTime)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1044,9 +1157,16 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         CAmount nFees = nValueIn-nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime ? nAcceptTime : GetTime(), dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
 
+        // A pool that had to evict only takes transactions paying more than what it dropped
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (mempoolRejectFee > 0 && nFees < mempoolRejectFee)
+            return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d",
+                                      hash.ToString(), nFees, mempoolRejectFee),
+                             REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+
         // Don't accept it if it can't get into a block
         CAmount txMinFee = GetMinRelayFee(tx, nSize, true);
         if (fLimitFree && nFees < txMinFee)
@@ -1088,9 +1208,19 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                          hash.ToString(),
                          nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
 
+        // Bound the chains of unconfirmed transactions, which every insertion
+        // into and removal from the pool walks
+        std::string errString;
+        if (!pool.CheckPackageLimits(tx, GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT),
+                                     GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000,
+                                     GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT),
+                                     GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000, errString))
+            return state.DoS(0, error("AcceptToMemoryPool : too-long-mempool-chain %s, %s", hash.ToString(), errString),
+                             REJECT_NONSTANDARD, "too-long-mempool-chain");
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckMempoolInputs(tx, state, view, STANDARD_SCRIPT_VERIFY_FLAGS))
         {
             return error("AcceptToMemoryPool: : ConnectInputs failed %s", hash.ToString());
         }
@@ -1104,13 +1234,18 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckMempoolInputs(tx, state, view, MANDATORY_SCRIPT_VERIFY_FLAGS))
         {
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry);
+
+        // Make room below -maxmempool; the new transaction itself may be evicted
+        pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -1210,7 +1345,18 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+uint256 GetBlockPoWHash(const CBlockHeader& block)
+{
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
+        if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_POWHASH))
+            return mi->second->hashPoW;
+    }
+    return block.GetPoWHash();
+}
+
+static bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, bool fCheckPOW)
 {
     block.SetNull();
 
@@ -1228,18 +1374,26 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
     }
 
     // Check the header
-    if (!CheckProofOfWork(block.GetPoWHash(), block.nBits))
+    if (fCheckPOW && !CheckProofOfWork(GetBlockPoWHash(block), block.nBits))
         return error("ReadBlockFromDisk : Errors in block header");
 
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    return ReadBlockFromDisk(block, pos, true);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), false))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : GetHash() doesn't match index");
+    // The header matches the index entry, so its stored PoW hash applies
+    if (!CheckProofOfWork(pindex->GetBlockPoWHash(), block.nBits))
+        return error("ReadBlockFromDisk(CBlock&, CBlockIndex*) : Errors in block header");
     return true;
 }
 
@@ -1445,6 +1599,38 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+/** Whether a script contains CHECKMULTISIG or CHECKMULTISIGVERIFY. */
+static bool HasMultisig(const CScript& script)
+{
+    CScript::const_iterator pc = script.begin();
+    opcodetype opcode;
+    while (script.GetOp(pc, opcode)) {
+        if (opcode == OP_CHECKMULTISIG || opcode == OP_CHECKMULTISIGVERIFY)
+            return true;
+    }
+    return false;
+}
+
+bool CScriptCheck::VerifyBatched(CSignatureBatch& batch) {
+    const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
+
+    // CHECKMULTISIG tries signatures against keys they need not belong to,
+    // so its signatures cannot be assumed valid: verify such inputs now.
+    bool fMultisig = HasMultisig(scriptSig) || HasMultisig(scriptPubKey);
+    if (!fMultisig && scriptPubKey.IsPayToScriptHash()) {
+        std::vector<unsigned char> vchPush, vchRedeemScript;
+        CScript::const_iterator pc = scriptSig.begin();
+        opcodetype opcode;
+        while (scriptSig.GetOp(pc, opcode, vchPush))
+            vchRedeemScript.swap(vchPush);
+        fMultisig = HasMultisig(CScript(vchRedeemScript.begin(), vchRedeemScript.end()));
+    }
+    if (fMultisig)
+        return (*this)();
+
+    return VerifyScript(scriptSig, scriptPubKey, nFlags, BatchingTransactionSignatureChecker(ptxTo, nIn, &batch), &error);
+}
+
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase())
@@ -1519,26 +1705,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
                 } else if (!check()) {
-                    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // non-standard DER encodings or non-null dummy
-                        // arguments; if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
-                        if (check())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after a soft-fork
-                    // super-majority vote has passed.
-                    return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+                    return InvalidScript(tx, state, *coins, check, flags, cacheStore);
                 }
             }
         }
@@ -1661,11 +1828,175 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+bool CPoWCheck::operator()() {
+    *phashPoW = header.GetPoWHash();
+    return CheckProofOfWork(*phashPoW, header.nBits);
+}
 
-void ThreadScriptCheck() {
-    RenameThread("worldcoin-scriptch");
-    scriptcheckqueue.Thread();
+// Only used from the message handler thread, see PrecomputeHeadersPoW.
+static CCheckQueue<CPoWCheck> powcheckqueue(1, &checkqueueworkers);
+
+/**
+ * Compute the Argon2d hashes of headers[nBegin..] before cs_main is taken,
+ * spreading the work over the script check threads when there are any. Hashing
+ * stops at the first header that fails its check. Since the queue may give up
+ * on headers before that one as well, those are finished here, in order, so
+ * that AcceptBlockHeader never has to hash the valid part of the batch itself.
+ */
+static void PrecomputeHeadersPoW(const std::vector<CBlockHeader>& headers, unsigned int nBegin, std::vector<uint256>& vHashPoW)
+{
+    if (nScriptCheckThreads > 0 && headers.size() > nBegin + 1) {
+        std::vector<CPoWCheck> vChecks;
+        vChecks.reserve(headers.size() - nBegin);
+        for (unsigned int i = nBegin; i < headers.size(); i++)
+            vChecks.push_back(CPoWCheck(headers[i], &vHashPoW[i]));
+        CCheckQueueControl<CPoWCheck> control(&powcheckqueue);
+        control.Add(vChecks);
+        if (control.Wait())
+            return;
+        LogPrint("pow", "%s : header batch contains invalid proof of work\n", __func__);
+    }
+
+    for (unsigned int i = nBegin; i < headers.size(); i++) {
+        if (vHashPoW[i] == 0)
+            vHashPoW[i] = headers[i].GetPoWHash();
+        if (!CheckProofOfWork(vHashPoW[i], headers[i].nBits))
+            break;
+    }
+}
+
+/**
+ * Accept headers[nBegin..nEnd) into the block index, using the hashes in
+ * vHashPoW where they were computed. Punishes pfrom and returns false at the
+ * first invalid header.
+ */
+static bool AcceptHeaders(CNode* pfrom, const std::vector<CBlockHeader>& headers, unsigned int nBegin, unsigned int nEnd,
+                          const std::vector<uint256>& vHashPoW, CBlockIndex** ppindexLast)
+{
+    AssertLockHeld(cs_main);
+    for (unsigned int n = nBegin; n < nEnd; n++) {
+        CValidationState state;
+        if (!AcceptBlockHeader(headers[n], state, ppindexLast, vHashPoW[n] != 0 ? &vHashPoW[n] : NULL)) {
+            int nDoS;
+            if (state.IsInvalid(nDoS)) {
+                if (nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                return error("invalid header received");
+            }
+        }
+    }
+    return true;
+}
+
+bool CCoinsPrefetch::operator()() {
+    try {
+        if (!view->GetCoins(txid, *pcoins))
+            pcoins->Clear();
+    } catch (const std::runtime_error& e) {
+        // Leave it to ConnectBlock, which reports database errors properly.
+        pcoins->Clear();
+    }
+    return true;
+}
+
+// Only used by the holder of csCoinsPrefetch, see CBlockCoinsPrefetch.
+static CCheckQueue<CCoinsPrefetch> coinsprefetchqueue(4, &checkqueueworkers);
+static boost::mutex csCoinsPrefetch;
+
+/**
+ * Reads the coins spent by a block from the chainstate below pcoinsTip on the
+ * -par threads, so that the random database reads ConnectBlock would do
+ * one at a time overlap with each other and with CheckBlock. One block is
+ * prefetched at a time; blocks processed by other threads meanwhile go without.
+ * The reads bypass pcoinsTip, so Warm only hands their results to it if it has
+ * not been flushed since they started.
+ */
+class CBlockCoinsPrefetch
+{
+private:
+    boost::unique_lock<boost::mutex> lock;
+    CCheckQueueControl<CCoinsPrefetch> control;
+    std::vector<uint256> vTxid;
+    std::vector<CCoins> vCoins;
+    uint64_t nFlushCount;
+
+public:
+    CBlockCoinsPrefetch() : lock(csCoinsPrefetch, boost::try_to_lock),
+        control(lock.owns_lock() && nScriptCheckThreads ? &coinsprefetchqueue : NULL), nFlushCount(0) {}
+
+    //! Queue the reads for the outputs spent by block that are not in pcoinsTip yet
+    void Start(const CBlock& block);
+
+    //! Wait for the reads to finish and let other threads prefetch
+    void Wait();
+
+    //! Add the coins that were read to pcoinsTip
+    void Warm();
+};
+
+void CBlockCoinsPrefetch::Start(const CBlock& block)
+{
+    if (!lock.owns_lock() || nScriptCheckThreads == 0)
+        return;
+
+    // Outputs created earlier in the block are not in the chainstate yet
+    std::set<uint256> setCreated, setSpent;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (!setCreated.count(txin.prevout.hash))
+                    setSpent.insert(txin.prevout.hash);
+            }
+        }
+        setCreated.insert(tx.GetHash());
+    }
+
+    const CCoinsView *view;
+    {
+        LOCK(cs_main);
+        // Only the background writer is safe to read from without cs_main
+        if (pcoinsWriter == NULL)
+            return;
+        view = pcoinsWriter;
+        nFlushCount = pcoinsTip->GetFlushCount();
+        BOOST_FOREACH(const uint256& txid, setSpent) {
+            if (!pcoinsTip->HaveCoinsInCache(txid))
+                vTxid.push_back(txid);
+        }
+    }
+
+    vCoins.resize(vTxid.size());
+    std::vector<CCoinsPrefetch> vChecks;
+    vChecks.reserve(vTxid.size());
+    for (unsigned int i = 0; i < vTxid.size(); i++)
+        vChecks.push_back(CCoinsPrefetch(view, vTxid[i], &vCoins[i]));
+    control.Add(vChecks);
+}
+
+void CBlockCoinsPrefetch::Wait()
+{
+    control.Wait();
+    if (lock.owns_lock())
+        lock.unlock();
+}
+
+void CBlockCoinsPrefetch::Warm()
+{
+    AssertLockHeld(cs_main);
+    if (vTxid.empty())
+        return;
+    // A flush may have written newer versions of these coins to the base
+    // (and dropped them from the cache) after they were read.
+    if (pcoinsTip->GetFlushCount() != nFlushCount) {
+        LogPrint("bench", "    - Prefetch: %u coins discarded after a flush\n", vTxid.size());
+        return;
+    }
+    unsigned int nWarmed = 0;
+    for (unsigned int i = 0; i < vTxid.size(); i++) {
+        if (!vCoins[i].IsPruned() && pcoinsTip->WarmCoins(vTxid[i], vCoins[i]))
+            nWarmed++;
+    }
+    LogPrint("bench", "    - Prefetch: %u of %u coins warmed\n", nWarmed, vTxid.size());
 }
 
 static int64_t nTimeVerify = 0;
@@ -1678,7 +2009,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 {
     AssertLockHeld(cs_main);
     // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
+    uint256 hashPoW;
+    if (!fJustCheck)
+        hashPoW = pindex->GetBlockPoWHash();
+    if (!CheckBlock(block, state, !fJustCheck, !fJustCheck, &hashPoW))
         return false;
 
     // verify that the view's current state corresponds to the previous block
@@ -1852,6 +2186,38 @@ enum FlushStateMode {
     FLUSH_STATE_ALWAYS
 };
 
+/** Write a snapshot of the dirty block file information and block index entries, and sync them. */
+static bool WriteBlockIndexSnapshot(const std::vector<std::pair<int, CBlockFileInfo> >& vFiles, int nLastFile, const std::vector<CDiskBlockIndex>& vBlocks)
+{
+    for (std::vector<std::pair<int, CBlockFileInfo> >::const_iterator it = vFiles.begin(); it != vFiles.end(); ++it) {
+        if (!pblocktree->WriteBlockFileInfo(it->first, it->second))
+            return error("%s : failed to write block file info", __func__);
+    }
+    if (!vFiles.empty() && !pblocktree->WriteLastBlockFile(nLastFile))
+        return error("%s : failed to write last block file", __func__);
+    for (std::vector<CDiskBlockIndex>::const_iterator it = vBlocks.begin(); it != vBlocks.end(); ++it) {
+        if (!pblocktree->WriteBlockIndex(*it))
+            return error("%s : failed to write block index", __func__);
+    }
+    return pblocktree->Sync();
+}
+
+/** WriteBlockIndexSnapshot on the chainstate writer thread, which hands the entries back to the next flush if it fails. */
+static bool WriteBlockIndexSnapshotAsync(const std::vector<std::pair<int, CBlockFileInfo> >& vFiles, int nLastFile, const std::vector<CDiskBlockIndex>& vBlocks, const std::vector<CBlockIndex*>& vIndex)
+{
+    try {
+        if (WriteBlockIndexSnapshot(vFiles, nLastFile, vBlocks))
+            return true;
+    } catch (const std::exception& e) {
+        LogPrintf("%s : %s\n", __func__, e.what());
+    }
+    LOCK(cs_failedBlockIndex);
+    for (std::vector<std::pair<int, CBlockFileInfo> >::const_iterator it = vFiles.begin(); it != vFiles.end(); ++it)
+        setFailedFileInfo.insert(it->first);
+    setFailedBlockIndex.insert(vIndex.begin(), vIndex.end());
+    return false;
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed if either they're too large, forceWrite is set, or
@@ -1862,7 +2228,7 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     static int64_t nLastWrite = 0;
     try {
     if ((mode == FLUSH_STATE_ALWAYS) ||
-        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+        ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) ||
         (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
         // Typical CCoins structures on disk are around 100 bytes in size.
         // Pushing a new one to the database can cause it to be written
@@ -1873,27 +2239,43 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             return state.Error("out of disk space");
         // First make sure all block and undo data is flushed to disk.
         FlushBlockFile();
-        // Then update all block file information (which may refer to block and undo files).
-        bool fileschanged = false;
-        for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
-            if (!pblocktree->WriteBlockFileInfo(*it, vinfoBlockFile[*it])) {
-                return state.Error("Failed to write to block index");
-            }
-            fileschanged = true;
-            setDirtyFileInfo.erase(it++);
-        }
-        if (fileschanged && !pblocktree->WriteLastBlockFile(nLastBlockFile)) {
+        {
+            LOCK(cs_failedBlockIndex);
+            setDirtyFileInfo.insert(setFailedFileInfo.begin(), setFailedFileInfo.end());
+            setFailedFileInfo.clear();
+            setDirtyBlockIndex.insert(setFailedBlockIndex.begin(), setFailedBlockIndex.end());
+            setFailedBlockIndex.clear();
+        }
+        // Then snapshot all block file information (which may refer to block and undo files)
+        // and the block index entries the chainstate may refer to. They are
+        // written and synced before the chainstate's best block moves on.
+        std::vector<std::pair<int, CBlockFileInfo> > vFiles;
+        vFiles.reserve(setDirtyFileInfo.size());
+        for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ++it)
+            vFiles.push_back(make_pair(*it, vinfoBlockFile[*it]));
+        std::vector<CDiskBlockIndex> vBlocks;
+        vBlocks.reserve(setDirtyBlockIndex.size());
+        for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ++it)
+            vBlocks.push_back(CDiskBlockIndex(*it));
+        if (pcoinsWriter) {
+            // Both go to the writer thread, so that cs_main is not held during the writes
+            std::vector<CBlockIndex*> vIndex(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
+            pcoinsWriter->SetPreCommit(boost::bind(&WriteBlockIndexSnapshotAsync, vFiles, nLastBlockFile, vBlocks, vIndex));
+        } else if (!WriteBlockIndexSnapshot(vFiles, nLastBlockFile, vBlocks)) {
+            // Still dirty, so the next flush writes them before the chainstate
             return state.Error("Failed to write to block index");
         }
-        for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-             if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(*it))) {
-                 return state.Error("Failed to write to block index");
-             }
-             setDirtyBlockIndex.erase(it++);
-        }
-        pblocktree->Sync();
+        setDirtyFileInfo.clear();
+        setDirtyBlockIndex.clear();
         // Finally flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Unless asked to empty it, keep the hottest part of the cache so that
+        // connecting the next blocks does not start from cold database reads.
+        bool fFlushed;
+        if (mode == FLUSH_STATE_ALWAYS)
+            fFlushed = pcoinsTip->Flush() && (!pcoinsWriter || pcoinsWriter->Sync());
+        else
+            fFlushed = pcoinsTip->PartialFlush(nCoinCacheUsage / 100 * COINS_CACHE_RETAIN_PERCENT);
+        if (!fFlushed)
             return state.Error("Failed to write to coin database");
         // Update best block in wallet (so we can detect restored wallets).
         if (mode != FLUSH_STATE_IF_NEEDED) {
@@ -1912,18 +2294,145 @@ void FlushStateToDisk() {
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+static bool CompareByAncestorCount(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b)
+{
+    return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+}
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    std::vector<std::pair<CTransaction, int64_t> > vEntries;
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    {
+        LOCK(mempool.cs);
+        // A transaction has more in-pool ancestors than any of its parents, so
+        // in this order LoadMempool finds every parent before its children
+        std::vector<const CTxMemPoolEntry*> vSorted;
+        vSorted.reserve(mempool.mapTx.size());
+        for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mempool.mapTx.begin(); it != mempool.mapTx.end(); ++it)
+            vSorted.push_back(&it->second);
+        std::stable_sort(vSorted.begin(), vSorted.end(), CompareByAncestorCount);
+        vEntries.reserve(vSorted.size());
+        BOOST_FOREACH(const CTxMemPoolEntry* pentry, vSorted)
+            vEntries.push_back(std::make_pair(pentry->GetTx(), pentry->GetTime()));
+        mapDeltas = mempool.mapDeltas;
+    }
+
+    int64_t nMid = GetTimeMicros();
+
+    boost::filesystem::path pathMempool = GetDataDir() / "mempool.dat";
+    boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+    try {
+        FILE* file = fopen(pathTmp.string().c_str(), "wb");
+        if (!file)
+            return error("%s : failed to open %s", __func__, pathTmp.string());
+
+        CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+        fileout << MEMPOOL_DUMP_VERSION;
+        fileout << (uint64_t)vEntries.size();
+        for (std::vector<std::pair<CTransaction, int64_t> >::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it)
+            fileout << it->first << it->second;
+        fileout << mapDeltas;
+        FileCommit(fileout.Get());
+        fileout.fclose();
+        if (!RenameOver(pathTmp, pathMempool))
+            return error("%s : failed to rename %s", __func__, pathTmp.string());
+    } catch (const std::exception& e) {
+        return error("%s : failed to dump mempool: %s", __func__, e.what());
+    }
+
+    LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (nMid - nStart) * 0.000001, (GetTimeMicros() - nMid) * 0.000001);
+    return true;
+}
+
+bool LoadMempool()
+{
+    boost::filesystem::path pathMempool = GetDataDir() / "mempool.dat";
+    CAutoFile filein(fopen(pathMempool.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        // Normal on the first start, or after a shutdown that did not dump
+        LogPrintf("%s : no %s to load\n", __func__, pathMempool.string());
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    int64_t nAccepted = 0;
+    int64_t nFailed = 0;
+    int64_t nAlreadyThere = 0;
+
+    try {
+        uint64_t nVersion;
+        filein >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION)
+            return error("%s : unknown mempool.dat version %d", __func__, nVersion);
+
+        uint64_t nCount;
+        filein >> nCount;
+        std::vector<std::pair<CTransaction, int64_t> > vEntries;
+        for (uint64_t i = 0; i < nCount; i++) {
+            CTransaction tx;
+            int64_t nTime;
+            filein >> tx >> nTime;
+            vEntries.push_back(std::make_pair(tx, nTime));
+        }
+
+        // Restore the PrioritiseTransaction deltas first, so the transactions
+        // are judged by the same modified fees they had when they were saved
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        filein >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        for (std::vector<std::pair<CTransaction, int64_t> >::const_iterator it = vEntries.begin(); it != vEntries.end(); ++it) {
+            if (ShutdownRequested())
+                return false;
+
+            CValidationState state;
+            LOCK(cs_main);
+            if (mempool.exists(it->first.GetHash())) {
+                nAlreadyThere++;
+            } else if (AcceptToMemoryPool(mempool, state, it->first, true, NULL, false, it->second)) {
+                nAccepted++;
+            } else {
+                nFailed++;
+            }
+        }
+    } catch (const std::exception& e) {
+        return error("%s : failed to deserialize mempool data from disk: %s", __func__, e.what());
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %d successes, %d failed, %d already there (%dms)\n",
+              nAccepted, nFailed, nAlreadyThere, GetTimeMillis() - nStart);
+    return true;
+}
+
+CBlockIndex* GetActiveTip()
+{
+    return pindexActiveTip.load();
+}
+
+/** Move the tip of chainActive, keeping GetActiveTip() in step. */
+void static SetActiveTip(CBlockIndex *pindex) {
+    chainActive.SetTip(pindex);
+    pindexActiveTip.store(pindex);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex *pindexNew) {
-    chainActive.SetTip(pindexNew);
+    SetActiveTip(pindexNew);
 
     // New best block
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
       chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble())/log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
       DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-      Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+      Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2100,8 +2609,19 @@ static CBlockIndex* FindMostWorkChain() {
             }
             pindexTest = pindexTest->pprev;
         }
-        if (!fInvalidAncestor)
-            return pindexNew;
+        if (fInvalidAncestor)
+            continue;
+
+        // The blocks up to the base of a loaded UTXO snapshot (see LoadTxOutSet)
+        // have no undo data, and those are the only active blocks without it.
+        // A candidate that forks off below the base cannot be switched to.
+        CBlockIndex *pindexDisconnect = pindexTest ? chainActive.Next(pindexTest) : NULL;
+        if (pindexDisconnect && !(pindexDisconnect->nStatus & BLOCK_HAVE_UNDO)) {
+            LogPrintf("%s : not switching to %s, it forks off at height %d, below the UTXO snapshot base\n", __func__, pindexNew->GetBlockHash().ToString(), pindexTest->nHeight);
+            setBlockIndexCandidates.erase(pindexNew);
+            continue;
+        }
+        return pindexNew;
     } while(true);
 }
 
@@ -2464,10 +2984,10 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW, const uint256* phashPoW)
 {
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits))
+    if (fCheckPOW && !CheckProofOfWork(phashPoW ? *phashPoW : block.GetPoWHash(), block.nBits))
         return state.DoS(50, error("CheckBlockHeader() : proof of work failed"),
                          REJECT_INVALID, "high-hash");
 
@@ -2479,13 +2999,13 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, const uint256* phashPoW)
 {
     // These are checks that are independent of context.
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, fCheckPOW))
+    if (!CheckBlockHeader(block, state, fCheckPOW, phashPoW))
         return false;
 
     // Check the merkle root.
@@ -2651,7 +3171,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, const uint256* phashPoW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -2668,7 +3188,9 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    // A hash computed by the caller without holding cs_main is only compared against the target here
+    uint256 hashPoW = phashPoW ? *phashPoW : block.GetPoWHash();
+    if (!CheckBlockHeader(block, state, true, &hashPoW))
         return false;
 
     // Get prev block index
@@ -2685,8 +3207,10 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
     if (!ContextualCheckBlockHeader(block, state, pindexPrev))
         return false;
 
-    if (pindex == NULL)
+    if (pindex == NULL) {
         pindex = AddToBlockIndex(block);
+        pindex->SetPoWHash(hashPoW);
+    }
 
     if (ppindex)
         *ppindex = pindex;
@@ -2694,13 +3218,13 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
     return true;
 }
 
-bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex, CDiskBlockPos* dbp)
+bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex, CDiskBlockPos* dbp, const uint256* phashPoW)
 {
     AssertLockHeld(cs_main);
 
     CBlockIndex *&pindex = *ppindex;
 
-    if (!AcceptBlockHeader(block, state, &pindex))
+    if (!AcceptBlockHeader(block, state, &pindex, phashPoW))
         return false;
 
     if (pindex->nStatus & BLOCK_HAVE_DATA) {
@@ -2709,7 +3233,8 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return true;
     }
 
-    if ((!CheckBlock(block, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
+    uint256 hashPoW = pindex->GetBlockPoWHash();
+    if ((!CheckBlock(block, state, true, true, &hashPoW)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -2741,8 +3266,20 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
 
 bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp)
 {
-    // Preliminary checks
-    bool checked = CheckBlock(*pblock, state);
+    // Preliminary checks; the Argon2d hash is computed (or looked up) once, outside
+    // of the cs_main section below
+    uint256 hashPoW = GetBlockPoWHash(*pblock);
+    bool checked = CheckBlockHeader(*pblock, state, true, &hashPoW);
+
+    // Read the coins the block spends while the rest of it is being checked,
+    // but only once its proof of work is known to be valid, so that a block
+    // without any cannot make us read from the chainstate
+    CBlockCoinsPrefetch prefetch;
+    if (checked) {
+        prefetch.Start(*pblock);
+        checked = CheckBlock(*pblock, state, true, true, &hashPoW);
+    }
+    prefetch.Wait();
 
     {
         LOCK(cs_main);
@@ -2753,13 +3290,15 @@ bool ProcessNewBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDis
 
         // Store to disk
         CBlockIndex *pindex = NULL;
-        bool ret = AcceptBlock(*pblock, state, &pindex, dbp);
+        bool ret = AcceptBlock(*pblock, state, &pindex, dbp, &hashPoW);
         if (pindex && pfrom) {
             mapBlockSource[pindex->GetBlockHash()] = pfrom->GetId();
         }
         CheckBlockIndex();
         if (!ret)
             return error("%s : AcceptBlock FAILED", __func__);
+
+        prefetch.Warm();
     }
 
     if (!ActivateBestChain(state, pblock))
@@ -2883,6 +3422,27 @@ bool static LoadBlockIndexDB()
 
     boost::this_thread::interruption_point();
 
+    // Entries written before PoW hashes were stored have never been checked
+    // since they were loaded from disk; verify them once and store the hash.
+    int nUpgraded = 0;
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+    {
+        CBlockIndex* pindex = item.second;
+        if (pindex->nStatus & BLOCK_HAVE_POWHASH)
+            continue;
+        if (nUpgraded == 0)
+            LogPrintf("LoadBlockIndexDB(): verifying proof of work of block index entries without stored PoW hash...\n");
+        boost::this_thread::interruption_point();
+        uint256 hashPoW = pindex->GetBlockPoWHash();
+        if (!CheckProofOfWork(hashPoW, pindex->nBits))
+            return error("LoadBlockIndexDB() : CheckProofOfWork failed: %s", pindex->ToString());
+        pindex->SetPoWHash(hashPoW);
+        setDirtyBlockIndex.insert(pindex);
+        nUpgraded++;
+    }
+    if (nUpgraded > 0)
+        LogPrintf("LoadBlockIndexDB(): stored PoW hashes for %d block index entries\n", nUpgraded);
+
     // Calculate nChainWork
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
@@ -2966,7 +3526,7 @@ bool static LoadBlockIndexDB()
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
-    chainActive.SetTip(it->second);
+    SetActiveTip(it->second);
 
     PruneBlockIndexCandidates();
 
@@ -2978,6 +3538,104 @@ bool static LoadBlockIndexDB()
     return true;
 }
 
+bool DumpTxOutSet(const boost::filesystem::path& path, CCoinsStats& stats)
+{
+    int64_t nStart = GetTimeMicros();
+
+    // Write out the cached chainstate, so the snapshot is of the current tip
+    FlushStateToDisk();
+
+    boost::filesystem::path pathTmp = path.string() + ".new";
+    bool fOk = false;
+    try {
+        FILE* file = fopen(pathTmp.string().c_str(), "wb");
+        if (!file)
+            return error("%s : failed to open %s", __func__, pathTmp.string());
+
+        CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+        if (pcoinsdbview->DumpSnapshot(fileout, stats)) {
+            FileCommit(fileout.Get());
+            fileout.fclose();
+            fOk = RenameOver(pathTmp, path);
+            if (!fOk)
+                error("%s : failed to rename %s", __func__, pathTmp.string());
+        }
+    } catch (const std::exception& e) {
+        error("%s : failed to dump UTXO set: %s", __func__, e.what());
+    }
+    if (!fOk) {
+        // Do not leave a partial snapshot behind
+        boost::system::error_code ec;
+        boost::filesystem::remove(pathTmp, ec);
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(stats.hashBlock);
+        stats.nHeight = mi != mapBlockIndex.end() ? mi->second->nHeight : -1;
+    }
+    LogPrintf("Dumped UTXO set of block %s (height %d) to %s: %u outputs, %gs\n", stats.hashBlock.ToString(), stats.nHeight,
+              path.string(), stats.nTransactionOutputs, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+bool LoadTxOutSet(const boost::filesystem::path& path, uint256 hashExpected, CCoinsStats& stats)
+{
+    int64_t nStart = GetTimeMicros();
+
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : failed to open %s", __func__, path.string());
+    uint64_t nFileSize = 0;
+    try {
+        nFileSize = boost::filesystem::file_size(path);
+    } catch (const boost::filesystem::filesystem_error&) {
+        // Only used for progress reports
+    }
+
+    CCoinsSnapshotReader reader(filein);
+    if (!reader.ReadHeader())
+        return false;
+
+    // The snapshot is not validated, so its contents must be vouched for by a
+    // checksum, either given by the user or built in
+    if (hashExpected == 0) {
+        std::map<uint256, uint256>::const_iterator it = Params().SnapshotHashes().find(reader.header.hashBlock);
+        if (it == Params().SnapshotHashes().end())
+            return error("%s : no known checksum for a snapshot of block %s, one must be given", __func__, reader.header.hashBlock.ToString());
+        hashExpected = it->second;
+    }
+
+    LOCK(cs_main);
+    if (chainActive.Height() > 0)
+        return error("%s : the active chain is at height %d, a snapshot can only replace an empty chainstate", __func__, chainActive.Height());
+    // The block it belongs to and its ancestors must be known and stored, so
+    // the chain can be extended from there. They get no undo data, so the
+    // chain can never be reorganized below it (see FindMostWorkChain).
+    BlockMap::iterator mi = mapBlockIndex.find(reader.header.hashBlock);
+    if (mi == mapBlockIndex.end())
+        return error("%s : snapshot block %s is not in the block index", __func__, reader.header.hashBlock.ToString());
+    CBlockIndex* pindex = mi->second;
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !pindex->IsValid(BLOCK_VALID_TRANSACTIONS) || pindex->nChainTx == 0)
+        return error("%s : snapshot block %s or one of its ancestors is not stored", __func__, reader.header.hashBlock.ToString());
+
+    // Empty the coin caches, so nothing of the old chainstate is left above the database
+    FlushStateToDisk();
+    mempool.clear();
+    if (!pcoinsdbview->LoadSnapshot(reader, nFileSize, hashExpected, stats))
+        return false;
+
+    pcoinsTip->SetBestBlock(pindex->GetBlockHash());
+    SetActiveTip(pindex);
+    PruneBlockIndexCandidates();
+    stats.nHeight = pindex->nHeight;
+
+    LogPrintf("Loaded UTXO set of block %s (height %d) from %s: %u outputs, %gs\n", stats.hashBlock.ToString(), stats.nHeight,
+              path.string(), stats.nTransactionOutputs, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
 CVerifyDB::CVerifyDB()
 {
     uiInterface.ShowProgress(_("Verifying blocks..."), 0);
@@ -3012,12 +3670,20 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        // A chainstate loaded from a snapshot has no undo data for the snapshot
+        // block and its ancestors, so they can neither be disconnected nor
+        // checked against it; the snapshot block is the verification floor.
+        if (!(pindex->nStatus & BLOCK_HAVE_UNDO)) {
+            LogPrintf("VerifyDB(): no undo data for block at %d, not verifying below it\n", pindex->nHeight);
+            break;
+        }
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
             return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state))
+        uint256 hashPoW = pindex->GetBlockPoWHash();
+        if (nCheckLevel >= 1 && !CheckBlock(block, state, true, true, &hashPoW))
             return error("VerifyDB() : *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 2: verify undo validity
         if (nCheckLevel >= 2 && pindex) {
@@ -3029,7 +3695,7 @@ bool CVerifyDB::VerifyDB(CCoinsView *coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -3070,7 +3736,7 @@ void UnloadBlockIndex()
 {
     mapBlockIndex.clear();
     setBlockIndexCandidates.clear();
-    chainActive.SetTip(NULL);
+    SetActiveTip(NULL);
     pindexBestInvalid = NULL;
 }
 
@@ -3198,7 +3864,8 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                     std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
                     while (range.first != range.second) {
                         std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second))
+                        // ProcessNewBlock checks the proof of work
+                        if (ReadBlockFromDisk(block, it->second, false))
                         {
                             LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
                                     head.ToString());
@@ -4112,30 +4779,76 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
-        LOCK(cs_main);
-
         if (nCount == 0) {
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
         }
 
-        CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
-            CValidationState state;
-            if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
-                Misbehaving(pfrom->GetId(), 20);
-                return error("non-continuous headers sequence");
+        // Known headers come first, since a known header's ancestors are all known
+        unsigned int nFirstNew = nCount;
+        {
+            LOCK(cs_main);
+            for (unsigned int n = 0; n < nCount; n++) {
+                if (n > 0 && headers[n].hashPrevBlock != headers[n-1].GetHash()) {
+                    Misbehaving(pfrom->GetId(), 20);
+                    return error("non-continuous headers sequence");
+                }
+                if (nFirstNew == nCount && !mapBlockIndex.count(headers[n].GetHash()))
+                    nFirstNew = n;
             }
-            if (!AcceptBlockHeader(header, state, &pindexLast)) {
+
+            // Argon2d is expensive: before hashing anything, make sure the new
+            // headers connect to the block index, the first one passes the
+            // contextual checks and none has a target its parent does not
+            // allow, so a bogus batch is rejected for free.
+            if (nFirstNew < nCount) {
+                const CBlockHeader& header = headers[nFirstNew];
+                BlockMap::iterator mi = mapBlockIndex.find(header.hashPrevBlock);
+                if (mi == mapBlockIndex.end()) {
+                    Misbehaving(pfrom->GetId(), 10);
+                    return error("headers do not connect to a known block");
+                }
+                if (mi->second->nStatus & BLOCK_FAILED_MASK) {
+                    Misbehaving(pfrom->GetId(), 100);
+                    return error("headers build on an invalid block");
+                }
+                CValidationState state;
                 int nDoS;
-                if (state.IsInvalid(nDoS)) {
+                if (!ContextualCheckBlockHeader(header, state, mi->second) && state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
                         Misbehaving(pfrom->GetId(), nDoS);
                     return error("invalid header received");
                 }
+                int nHeight = mi->second->nHeight + 1;
+                unsigned int nBitsPrev = mi->second->nBits;
+                for (unsigned int n = nFirstNew; n < nCount; n++, nHeight++) {
+                    if (!PermittedDifficultyTransition(nHeight, nBitsPrev, headers[n].nBits)) {
+                        Misbehaving(pfrom->GetId(), 100);
+                        return error("header at height %d has an unexpected target %08x", nHeight, headers[n].nBits);
+                    }
+                    nBitsPrev = headers[n].nBits;
+                }
             }
         }
 
+        // Hash and check the first new header on its own, so that a batch that
+        // starts with an invalid one costs a single hash; only then hash the
+        // rest of the batch in parallel before taking cs_main again.
+        std::vector<uint256> vHashPoW(nCount, uint256(0));
+        CBlockIndex *pindexLast = NULL;
+        if (nFirstNew < nCount) {
+            vHashPoW[nFirstNew] = headers[nFirstNew].GetPoWHash();
+            LOCK(cs_main);
+            if (!AcceptHeaders(pfrom, headers, 0, nFirstNew + 1, vHashPoW, &pindexLast))
+                return false;
+        }
+        PrecomputeHeadersPoW(headers, nFirstNew + 1, vHashPoW);
+
+        LOCK(cs_main);
+
+        if (!AcceptHeaders(pfrom, headers, nFirstNew < nCount ? nFirstNew + 1 : 0, nCount, vHashPoW, &pindexLast))
+            return false;
+
         if (pindexLast)
             UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
 
@@ -13,6 +13,7 @@
 #include "amount.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "checkqueue.h"
 #include "coins.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
@@ -40,6 +41,8 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewAsyncWriter;
+class CCoinsViewDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
@@ -65,6 +68,18 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxmempool, maximum megabytes of memory the transaction pool may use */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -limitancestorcount, maximum number of in-pool ancestors of a transaction, itself included */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of a transaction with its in-pool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, maximum number of in-pool descendants of a transaction, itself included */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of a transaction with its in-pool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -persistmempool, save the transaction pool on shutdown and reload it on startup */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -91,6 +106,8 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
+/** Share of the coins cache budget kept as recently used, clean entries after a flush (percent). */
+static const unsigned int COINS_CACHE_RETAIN_PERCENT = 50;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 
@@ -134,7 +151,7 @@ extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 
@@ -195,7 +212,7 @@ bool ProcessMessages(CNode* pfrom);
  * @param[in]   fSendTrickle    When true send the trickled data, otherwise trickle the data until true.
  */
 bool SendMessages(CNode* pto, bool fSendTrickle);
-/** Run an instance of the script checking thread */
+/** Run an instance of the script checking thread, which also checks header proof of work and prefetches coins */
 void ThreadScriptCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
@@ -218,11 +235,22 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Write the transaction pool and its fee deltas to mempool.dat. */
+bool DumpMempool();
+/** Re-accept the transactions saved in mempool.dat into the pool. Returns false if there is none or it cannot be read. */
+bool LoadMempool();
+/** Write a snapshot of the UTXO set at the current tip to path. */
+bool DumpTxOutSet(const boost::filesystem::path& path, CCoinsStats& stats);
+/**
+ * Replace the (empty) chainstate with a UTXO set snapshot and make its block the tip.
+ * The snapshot's checksum must be hashExpected or, if that is 0, the one built in for its block.
+ */
+bool LoadTxOutSet(const boost::filesystem::path& path, uint256 hashExpected, CCoinsStats& stats);
 
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectInsaneFee=false);
+                        bool* pfMissingInputs, bool fRejectInsaneFee=false, int64_t nAcceptTime=0);
 
 
 struct CNodeStateStats {
@@ -357,6 +385,17 @@ public:
 
     bool operator()();
 
+    /**
+     * Run the scripts like operator(), but add the signatures that are not
+     * cached to batch instead of verifying them. The result only holds if
+     * every signature in the batch turns out valid. Inputs that use
+     * CHECKMULTISIG are verified right away instead.
+     */
+    bool VerifyBatched(CSignatureBatch& batch);
+
+    bool GetCacheStore() const { return cacheStore; }
+    unsigned int GetInput() const { return nIn; }
+
     void swap(CScriptCheck &check) {
         scriptPubKey.swap(check.scriptPubKey);
         std::swap(ptxTo, check.ptxTo);
@@ -369,6 +408,66 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+//! Verify the signatures of the script checks in a batch together.
+template <>
+bool CheckAll(std::vector<CScriptCheck>& vChecks, CScriptCheck* pcheckFailed);
+
+/**
+ * Closure representing one header proof-of-work verification
+ * The Argon2d hash is written to *phashPoW so it can be stored in the block index.
+ */
+class CPoWCheck
+{
+private:
+    CBlockHeader header;
+    uint256 *phashPoW;
+
+public:
+    CPoWCheck(): phashPoW(NULL) {}
+    CPoWCheck(const CBlockHeader& headerIn, uint256* phashPoWIn) :
+        header(headerIn), phashPoW(phashPoWIn) { }
+
+    bool operator()();
+
+    void swap(CPoWCheck &check) {
+        std::swap(header, check.header);
+        std::swap(phashPoW, check.phashPoW);
+    }
+};
+
+/**
+ * Closure representing one chainstate read ahead of ConnectBlock
+ * The coins of txid are read from view into *pcoins, which is left empty when
+ * there are none or the read fails; ConnectBlock will then look again itself.
+ */
+class CCoinsPrefetch
+{
+private:
+    const CCoinsView *view;
+    uint256 txid;
+    CCoins *pcoins;
+
+public:
+    CCoinsPrefetch(): view(NULL), pcoins(NULL) {}
+    CCoinsPrefetch(const CCoinsView* viewIn, const uint256& txidIn, CCoins* pcoinsIn) :
+        view(viewIn), txid(txidIn), pcoins(pcoinsIn) { }
+
+    bool operator()();
+
+    void swap(CCoinsPrefetch &check) {
+        std::swap(view, check.view);
+        std::swap(txid, check.txid);
+        std::swap(pcoins, check.pcoins);
+    }
+};
+
+
+/**
+ * Return the Argon2d proof-of-work hash of a header. Headers that are already in
+ * the block index reuse the hash stored when they were first accepted instead of
+ * recomputing it. Takes cs_main for the lookup.
+ */
+uint256 GetBlockPoWHash(const CBlockHeader& block);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
@@ -387,9 +486,13 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false);
 
-/** Context-independent validity checks */
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/**
+ * Context-independent validity checks. The proof of work is checked against
+ * *phashPoW if given (the Argon2d hash the caller already has), else against a
+ * freshly computed hash.
+ */
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true, const uint256* phashPoW = NULL);
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, const uint256* phashPoW = NULL);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
@@ -398,9 +501,13 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex *pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
-/** Store block on disk. If dbp is provided, the file is known to already reside on disk */
-bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex **pindex, CDiskBlockPos* dbp = NULL);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL);
+/**
+ * Store block on disk. If dbp is provided, the file is known to already reside on disk.
+ * If phashPoW is given it is used as the already computed Argon2d hash of the header.
+ */
+bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex **pindex, CDiskBlockPos* dbp = NULL, const uint256* phashPoW = NULL);
+/** Store a block header. If phashPoW is given it is used as the already computed Argon2d hash of the header. */
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, const uint256* phashPoW = NULL);
 
 
 
@@ -480,12 +587,22 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex);
 /** The currently-connected chain of blocks. */
 extern CChain chainActive;
 
+/** The tip of chainActive, safe to read without cs_main; it may be out of date by the time it is used. */
+CBlockIndex* GetActiveTip();
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Background writer below pcoinsTip, or NULL to write the chainstate synchronously (protected by cs_main) */
+extern CCoinsViewAsyncWriter *pcoinsWriter;
+
+/** The chainstate database at the bottom of the coins view stack */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+
 struct CBlockTemplate
 {
     CBlock block;
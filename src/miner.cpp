@@ -9,10 +9,12 @@
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "hash.h"
-#include "crypto/scrypt.h"
+#include "crypto/argon2.h"
+#include "crypto/common.h"
 #include "main.h"
 #include "net.h"
 #include "pow.h"
+#include "streams.h"
 #include "timedata.h"
 #include "util.h"
 #include "utilmoneystr.h"
@@ -20,6 +22,7 @@
 #include "wallet.h"
 #endif
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 
@@ -30,32 +33,11 @@ using namespace std;
 // BitcoinMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
-};
-
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
 // We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
+typedef boost::tuple<double, CFeeRate, const CTxMemPoolEntry*> TxPriority;
 class TxPriorityCompare
 {
     bool byFee;
@@ -80,6 +62,330 @@ public:
     }
 };
 
+static TxPriority PriorityOf(const CTxMemPoolEntry& entry, int nHeight)
+{
+    double dPriority = entry.GetPriority(nHeight);
+    CAmount nFee = entry.GetFee();
+    mempool.ApplyDeltas(entry.GetTx().GetHash(), dPriority, nFee);
+    return TxPriority(dPriority, CFeeRate(nFee, entry.GetTxSize()), &entry);
+}
+
+class CompareTxMemPoolEntryByAncestorCount
+{
+public:
+    bool operator()(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) const
+    {
+        return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+    }
+};
+
+/**
+ * A block template being selected from scratch: the transactions taken so far
+ * and the coins view they are checked against, in which they are spent.
+ */
+class CTemplateBuilder
+{
+public:
+    CBlockTemplate& tmpl;
+    CCoinsViewCache& view;
+    const int nHeight;
+    const unsigned int nBlockMaxSize;
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    int nBlockSigOps;
+    CAmount nFees;
+    std::set<uint256> setInBlock;
+    bool fPrintPriority;
+
+    CTemplateBuilder(CBlockTemplate& tmplIn, CCoinsViewCache& viewIn, int nHeightIn, unsigned int nBlockMaxSizeIn) :
+        tmpl(tmplIn), view(viewIn), nHeight(nHeightIn), nBlockMaxSize(nBlockMaxSizeIn),
+        nBlockSize(1000), nBlockTx(0), nBlockSigOps(100), nFees(0),
+        fPrintPriority(GetBoolArg("-printpriority", false))
+    {
+    }
+
+    /** Append a transaction whose unconfirmed parents are already in; false if it does not fit or fails its checks */
+    bool Add(const CTxMemPoolEntry& entry, double dPriority);
+};
+
+bool CTemplateBuilder::Add(const CTxMemPoolEntry& entry, double dPriority)
+{
+    const CTransaction& tx = entry.GetTx();
+
+    // Size limits
+    unsigned int nTxSize = entry.GetTxSize();
+    if (nBlockSize + nTxSize >= nBlockMaxSize)
+        return false;
+
+    // Legacy limits on sigOps:
+    unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+    if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    if (!view.HaveInputs(tx))
+        return false;
+
+    CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
+
+    nTxSigOps += GetP2SHSigOpCount(tx, view);
+    if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    CValidationState state;
+    if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        return false;
+
+    CTxUndo txundo;
+    UpdateCoins(tx, state, view, txundo, nHeight);
+
+    // Added
+    tmpl.block.vtx.push_back(tx);
+    tmpl.vTxFees.push_back(nTxFees);
+    tmpl.vTxSigOps.push_back(nTxSigOps);
+    setInBlock.insert(tx.GetHash());
+    nBlockSize += nTxSize;
+    ++nBlockTx;
+    nBlockSigOps += nTxSigOps;
+    nFees += nTxFees;
+
+    if (fPrintPriority)
+    {
+        LogPrintf("priority %.1f fee %s txid %s\n",
+            dPriority, CFeeRate(entry.GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
+    }
+    return true;
+}
+
+/** Seconds before a template that had to leave out transactions for lack of room is rebuilt */
+static const int64_t TEMPLATE_REBUILD_INTERVAL = 10;
+
+/**
+ * The mempool part of the last block template. Until the tip moves it is
+ * patched with the mempool journal instead of being selected again from all of
+ * mapTx. Transactions joining the pool are appended when their in-pool parents
+ * are already selected and the same fee/priority policy admits them.
+ * Protected by cs_main and mempool.cs.
+ */
+class CTemplateCache
+{
+private:
+    const CBlockIndex* pindexPrev; //! Tip the template builds on, NULL if there is none
+    std::vector<CTransaction> vtx; //! Selected transactions, parents before children
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    std::set<uint256> setTx;
+    uint64_t nBlockSize;
+    int nBlockSigOps;
+    CAmount nFees;
+    int64_t nTimeBuilt;
+    bool fOutdated; //! A transaction did not fit; a full selection may choose better
+
+    void Remove(const std::set<uint256>& setRemoved);
+    bool Add(const CTxMemPoolEntry& entry, int nHeight, CCoinsViewCache& view,
+             unsigned int nBlockMaxSize, unsigned int nBlockPrioritySize, unsigned int nBlockMinSize);
+
+public:
+    CTemplateCache() : pindexPrev(NULL), nBlockSize(0), nBlockSigOps(0), nFees(0), nTimeBuilt(0), fOutdated(false) {}
+
+    /**
+     * Apply mempool changes, collecting the transactions appended in setAdded;
+     * returns false if the template has to be selected from scratch
+     */
+    bool Patch(const CBlockIndex* pindexPrevIn, const std::vector<std::pair<uint256, bool> >& vChanges,
+               unsigned int nBlockMaxSize, unsigned int nBlockPrioritySize, unsigned int nBlockMinSize,
+               std::set<uint256>& setAdded);
+    /** Remember the transactions of a freshly selected template */
+    void Store(const CBlockIndex* pindexPrevIn, const CBlockTemplate& tmpl, uint64_t nBlockSizeIn, int nBlockSigOpsIn, CAmount nFeesIn);
+    /** Append the cached transactions to a template holding only the coinbase */
+    void Fill(CBlockTemplate& tmpl, uint64_t& nBlockSizeOut, uint64_t& nBlockTxOut, CAmount& nFeesOut) const;
+    /** Forget the template, so the next one is selected from scratch */
+    void Invalidate() { pindexPrev = NULL; }
+};
+
+void CTemplateCache::Remove(const std::set<uint256>& setRemoved)
+{
+    // Children follow their parents, so one pass also drops dependants
+    std::set<uint256> setDropped;
+    size_t j = 0;
+    for (size_t i = 0; i < vtx.size(); i++)
+    {
+        const uint256& hash = vtx[i].GetHash();
+        bool fDrop = setRemoved.count(hash) > 0;
+        for (size_t k = 0; !fDrop && k < vtx[i].vin.size(); k++)
+            fDrop = setDropped.count(vtx[i].vin[k].prevout.hash) > 0;
+        if (fDrop)
+        {
+            setDropped.insert(hash);
+            setTx.erase(hash);
+            nBlockSize -= ::GetSerializeSize(vtx[i], SER_NETWORK, PROTOCOL_VERSION);
+            nBlockSigOps -= vTxSigOps[i];
+            nFees -= vTxFees[i];
+            continue;
+        }
+        if (i != j)
+        {
+            vtx[j] = vtx[i];
+            vTxFees[j] = vTxFees[i];
+            vTxSigOps[j] = vTxSigOps[i];
+        }
+        j++;
+    }
+    vtx.resize(j);
+    vTxFees.resize(j);
+    vTxSigOps.resize(j);
+}
+
+bool CTemplateCache::Add(const CTxMemPoolEntry& entry, int nHeight, CCoinsViewCache& view,
+                         unsigned int nBlockMaxSize, unsigned int nBlockPrioritySize, unsigned int nBlockMinSize)
+{
+    const CTransaction& tx = entry.GetTx();
+    const uint256& hash = tx.GetHash();
+    if (setTx.count(hash) || !IsFinalTx(tx, nHeight) || !view.HaveInputs(tx))
+        return false;
+
+    // Parents still waiting in the pool must already be part of the template
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        if (mempool.mapTx.count(txin.prevout.hash) && !setTx.count(txin.prevout.hash))
+            return false;
+
+    unsigned int nTxSize = entry.GetTxSize();
+    double dPriorityDelta = 0;
+    CAmount nFeeDelta = 0;
+    mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+    CFeeRate feeRate(entry.GetFee() + nFeeDelta, nTxSize);
+    double dPriority = entry.GetPriority(nHeight) + dPriorityDelta;
+
+    // The policy of the full selection: paying transactions anywhere, free ones
+    // in the priority area or until the block reaches its minimum size
+    if (feeRate < ::minRelayTxFee && dPriorityDelta <= 0 && nFeeDelta <= 0 &&
+        nBlockSize + nTxSize >= nBlockMinSize &&
+        !(AllowFree(dPriority) && nBlockSize + nTxSize < nBlockPrioritySize))
+        return false;
+
+    if (nBlockSize + nTxSize >= nBlockMaxSize)
+    {
+        fOutdated = true;
+        return false;
+    }
+    unsigned int nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, view);
+    if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+    {
+        fOutdated = true;
+        return false;
+    }
+
+    vtx.push_back(tx);
+    vTxFees.push_back(entry.GetFee());
+    vTxSigOps.push_back(nTxSigOps);
+    setTx.insert(hash);
+    nBlockSize += nTxSize;
+    nBlockSigOps += nTxSigOps;
+    nFees += entry.GetFee();
+    return true;
+}
+
+bool CTemplateCache::Patch(const CBlockIndex* pindexPrevIn, const std::vector<std::pair<uint256, bool> >& vChanges,
+                           unsigned int nBlockMaxSize, unsigned int nBlockPrioritySize, unsigned int nBlockMinSize,
+                           std::set<uint256>& setAdded)
+{
+    if (pindexPrev == NULL || pindexPrev != pindexPrevIn)
+        return false;
+    if (fOutdated && GetTime() - nTimeBuilt >= TEMPLATE_REBUILD_INTERVAL)
+        return false;
+
+    std::set<uint256> setRemoved;
+    for (size_t i = 0; i < vChanges.size(); i++)
+        if (!vChanges[i].second && setTx.count(vChanges[i].first))
+            setRemoved.insert(vChanges[i].first);
+    if (!setRemoved.empty())
+        Remove(setRemoved);
+
+    const int nHeight = pindexPrev->nHeight + 1;
+    CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+    CCoinsViewCache view(&viewMemPool);
+    for (size_t i = 0; i < vChanges.size(); i++)
+    {
+        if (!vChanges[i].second)
+            continue;
+        map<uint256, CTxMemPoolEntry>::const_iterator mi = mempool.mapTx.find(vChanges[i].first);
+        if (mi != mempool.mapTx.end() && Add(mi->second, nHeight, view, nBlockMaxSize, nBlockPrioritySize, nBlockMinSize))
+            setAdded.insert(vChanges[i].first);
+    }
+    return true;
+}
+
+void CTemplateCache::Store(const CBlockIndex* pindexPrevIn, const CBlockTemplate& tmpl, uint64_t nBlockSizeIn, int nBlockSigOpsIn, CAmount nFeesIn)
+{
+    pindexPrev = pindexPrevIn;
+    vtx.assign(tmpl.block.vtx.begin() + 1, tmpl.block.vtx.end());
+    vTxFees.assign(tmpl.vTxFees.begin() + 1, tmpl.vTxFees.end());
+    vTxSigOps.assign(tmpl.vTxSigOps.begin() + 1, tmpl.vTxSigOps.end());
+    setTx.clear();
+    BOOST_FOREACH(const CTransaction& tx, vtx)
+        setTx.insert(tx.GetHash());
+    nBlockSize = nBlockSizeIn;
+    nBlockSigOps = nBlockSigOpsIn;
+    nFees = nFeesIn;
+    nTimeBuilt = GetTime();
+    fOutdated = false;
+}
+
+void CTemplateCache::Fill(CBlockTemplate& tmpl, uint64_t& nBlockSizeOut, uint64_t& nBlockTxOut, CAmount& nFeesOut) const
+{
+    tmpl.block.vtx.insert(tmpl.block.vtx.end(), vtx.begin(), vtx.end());
+    tmpl.vTxFees.insert(tmpl.vTxFees.end(), vTxFees.begin(), vTxFees.end());
+    tmpl.vTxSigOps.insert(tmpl.vTxSigOps.end(), vTxSigOps.begin(), vTxSigOps.end());
+    nBlockSizeOut = nBlockSize;
+    nBlockTxOut = vtx.size();
+    nFeesOut = nFees;
+}
+
+static CTemplateCache templateCache;
+
+/**
+ * Check a patched template without connecting it again. The transactions it
+ * kept were validated with the template they come from, and the scripts of
+ * those in setAdded were verified against this tip by AcceptToMemoryPool, so
+ * only the block-level rules and the inputs of the added ones are checked.
+ */
+static bool TestPatchedBlock(CValidationState& state, const CBlock& block, CBlockIndex* pindexPrev, const std::set<uint256>& setAdded)
+{
+    if (!ContextualCheckBlockHeader(block, state, pindexPrev))
+        return false;
+    if (!CheckBlock(block, state, false, false))
+        return false;
+    if (!ContextualCheckBlock(block, state, pindexPrev))
+        return false;
+
+    const int nHeight = pindexPrev->nHeight + 1;
+    CCoinsViewCache view(pcoinsTip);
+    std::map<uint256, const CTransaction*> mapInBlock;
+    std::set<uint256> setLoaded;
+    for (size_t i = 1; i < block.vtx.size(); i++)
+    {
+        const CTransaction& tx = block.vtx[i];
+        if (setAdded.count(tx.GetHash()))
+        {
+            // Earlier transactions of the template are not in pcoinsTip
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            {
+                std::map<uint256, const CTransaction*>::const_iterator it = mapInBlock.find(txin.prevout.hash);
+                if (it != mapInBlock.end() && setLoaded.insert(it->first).second)
+                    view.ModifyCoins(it->first)->FromTx(*it->second, nHeight);
+            }
+            if (!CheckInputs(tx, state, view, false, 0, false, NULL))
+                return false;
+            CTxUndo txundo;
+            UpdateCoins(tx, state, view, txundo, nHeight);
+        }
+        mapInBlock[tx.GetHash()] = &tx;
+    }
+    return true;
+}
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
@@ -138,187 +444,122 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         const int nHeight = pindexPrev->nHeight + 1;
         CCoinsViewCache view(pcoinsTip);
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
+        std::vector<std::pair<uint256, bool> > vChanges;
+        std::set<uint256> setAdded;
+        bool fPatched = mempool.ReadJournal(vChanges) &&
+                        templateCache.Patch(pindexPrev, vChanges, nBlockMaxSize, nBlockPrioritySize, nBlockMinSize, setAdded);
+        uint64_t nBlockSize = 1000;
+        uint64_t nBlockTx = 0;
+        if (fPatched)
+            templateCache.Fill(*pblocktemplate, nBlockSize, nBlockTx, nFees);
+        else
         {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            CTemplateBuilder builder(*pblocktemplate, view, nHeight, nBlockMaxSize);
+
+            // High-priority transactions first. Priority grows with every block,
+            // so unlike fee rate it has no standing order in the mempool.
+            if (nBlockPrioritySize > 0)
             {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
+                TxPriorityCompare comparer(false);
+                vector<TxPriority> vecPriority;
+                set<uint256> setQueued;
+                for (map<uint256, CTxMemPoolEntry>::const_iterator mi = mempool.mapTx.begin();
+                     mi != mempool.mapTx.end(); ++mi)
                 {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
+                    if (mi->second.GetCountWithAncestors() == 1 && IsFinalTx(mi->second.GetTx(), nHeight))
                     {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
+                        vecPriority.push_back(PriorityOf(mi->second, nHeight));
+                        setQueued.insert(mi->first);
                     }
+                }
+                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
 
-                    // Has to wait for dependencies
-                    if (!porphan)
+                while (!vecPriority.empty())
+                {
+                    // Take highest priority transaction off the priority queue:
+                    double dPriority = vecPriority.front().get<0>();
+                    const CTxMemPoolEntry& entry = *(vecPriority.front().get<2>());
+                    std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                    vecPriority.pop_back();
+
+                    // The rest of the block goes by fee rate
+                    if (builder.nBlockSize + entry.GetTxSize() >= nBlockPrioritySize || !AllowFree(dPriority))
+                        break;
+                    if (!builder.Add(entry, dPriority))
+                        continue;
+
+                    // Children whose unconfirmed parents are all in the block now qualify
+                    const uint256& hash = entry.GetTx().GetHash();
+                    map<COutPoint, CInPoint>::const_iterator it = mempool.mapNextTx.lower_bound(COutPoint(hash, 0));
+                    for (; it != mempool.mapNextTx.end() && it->first.hash == hash; ++it)
                     {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
+                        const CTxMemPoolEntry& child = mempool.mapTx.find(it->second.ptx->GetHash())->second;
+                        if (setQueued.count(child.GetTx().GetHash()) || !IsFinalTx(child.GetTx(), nHeight))
+                            continue;
+                        bool fParentsIn = true;
+                        BOOST_FOREACH(const CTxIn& txin, child.GetTx().vin)
+                            if (mempool.mapTx.count(txin.prevout.hash) && !builder.setInBlock.count(txin.prevout.hash))
+                                fParentsIn = false;
+                        if (!fParentsIn)
+                            continue;
+                        vecPriority.push_back(PriorityOf(child, nHeight));
+                        std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
+                        setQueued.insert(child.GetTx().GetHash());
                     }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
                 }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
             }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
 
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
-
-            if (porphan)
+            // Fill up by the fee rate of each transaction together with its
+            // unconfirmed ancestors, taken straight off the mempool's ordering
+            BOOST_FOREACH(const CTxMemPoolEntry* pentry, mempool.setByAncestorFeeRate)
             {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            }
-            else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
+                const uint256& hash = pentry->GetTx().GetHash();
+                if (builder.setInBlock.count(hash))
+                    continue;
 
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
+                set<uint256> setAncestors;
+                mempool.CalculateAncestors(hash, setAncestors);
+                vector<const CTxMemPoolEntry*> vPackage(1, pentry);
+                BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+                    if (!builder.setInBlock.count(hashAncestor))
+                        vPackage.push_back(&mempool.mapTx.find(hashAncestor)->second);
+
+                uint64_t nPackageSize = 0;
+                CAmount nPackageFees = 0;
+                bool fFinal = true;
+                BOOST_FOREACH(const CTxMemPoolEntry* p, vPackage)
+                {
+                    nPackageSize += p->GetTxSize();
+                    nPackageFees += p->GetModifiedFee();
+                    fFinal = fFinal && IsFinalTx(p->GetTx(), nHeight);
+                }
+                if (!fFinal || builder.nBlockSize + nPackageSize >= nBlockMaxSize)
+                    continue;
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+                // Skip free transactions if we're past the minimum block size:
+                double dPriorityDelta = 0;
+                CAmount nFeeDelta = 0;
+                mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+                if ((dPriorityDelta <= 0) && (nFeeDelta <= 0) && (CFeeRate(nPackageFees, nPackageSize) < ::minRelayTxFee) &&
+                    (builder.nBlockSize + nPackageSize >= nBlockMinSize))
+                    continue;
 
-            if (fPrintPriority)
-            {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
+                // An ancestor always has fewer ancestors than its descendants
+                std::sort(vPackage.begin(), vPackage.end(), CompareTxMemPoolEntryByAncestorCount());
+                BOOST_FOREACH(const CTxMemPoolEntry* p, vPackage)
+                    if (!builder.Add(*p, p->GetPriority(nHeight)))
+                        break;
             }
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
-            {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
+            nBlockSize = builder.nBlockSize;
+            nBlockTx = builder.nBlockTx;
+            nFees = builder.nFees;
+            templateCache.Store(pindexPrev, *pblocktemplate, nBlockSize, builder.nBlockSigOps, nFees);
         }
 
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
-        LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
+        LogPrintf("CreateNewBlock(): total size %u%s\n", nBlockSize, fPatched ? " (patched)" : "");
 
         // Compute final coinbase transaction.
         txNew.vout[0].nValue = GetBlockValue(nHeight, nFees);
@@ -333,8 +574,18 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         pblock->nNonce         = 0;
         pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
 
+        // A patched template only needs the cheap checks; a freshly selected one
+        // is connected in full, scripts included
         CValidationState state;
-        if (!TestBlockValidity(state, *pblock, pindexPrev, false, false))
+        if (fPatched && !TestPatchedBlock(state, *pblock, pindexPrev, setAdded))
+        {
+            // The journal is already drained, so keeping this template would
+            // fail every later call until the tip moves: select from scratch
+            LogPrintf("CreateNewBlock(): patched template invalid (%s), selecting again\n", state.GetRejectReason());
+            templateCache.Invalidate();
+            return CreateNewBlock(scriptPubKeyIn);
+        }
+        if (!fPatched && !TestBlockValidity(state, *pblock, pindexPrev, false, false))
             throw std::runtime_error("CreateNewBlock() : TestBlockValidity failed");
     }
 
@@ -360,14 +611,100 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 }
 
+uint64_t ScanNonces(const CBlockHeader& header, uint32_t nNonceBegin, uint64_t nNonceEnd, const uint256& hashTarget,
+                    std::vector<CNonceHit>& vHits, const boost::function<bool()>& fnStop, unsigned int nMaxHits)
+{
+    // Serialize the header once and only patch the nonce between hashes
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header;
+    assert(ss.size() == 80);
+    char *pnonce = &ss[76];
+
+    worldcoin_argon2d_context *ctx = worldcoin_argon2d_thread_context();
+    uint64_t nHashes = 0;
+    uint256 hash;
+    for (uint64_t nNonce = nNonceBegin; nNonce < nNonceEnd; nNonce++) {
+        WriteLE32((unsigned char*)pnonce, (uint32_t)nNonce);
+        worldcoin_argon2d_ctx(ctx, &ss[0], BEGIN(hash));
+        nHashes++;
+        if (hash <= hashTarget) {
+            CNonceHit hit;
+            hit.nNonce = (uint32_t)nNonce;
+            hit.hashPoW = hash;
+            vHits.push_back(hit);
+            if (vHits.size() >= nMaxHits)
+                break;
+        }
+        if (fnStop && fnStop())
+            break;
+    }
+    return nHashes;
+}
+
+CMinerThreadStats::CMinerThreadStats() : nHashes(0), nHashesPerSec(0), nRateTime(0), nTemplates(0), nStaleTemplates(0),
+                                         nTemplateMicros(0), nMaxTemplateMicros(0), nBlocksFound(0)
+{
+}
+
+void CMinerThreadStats::AddTemplate(int64_t nMicros)
+{
+    Add(nTemplates, 1);
+    Add(nTemplateMicros, nMicros);
+    if ((uint64_t)nMicros > nMaxTemplateMicros.load(boost::memory_order_relaxed))
+        nMaxTemplateMicros.store(nMicros, boost::memory_order_relaxed);
+}
+
+static CCriticalSection cs_minerstats;
+static std::vector<boost::shared_ptr<CMinerThreadStats> > vMinerStats;
+
+boost::shared_ptr<CMinerThreadStats> RegisterMinerThread()
+{
+    boost::shared_ptr<CMinerThreadStats> stats(new CMinerThreadStats());
+    LOCK(cs_minerstats);
+    vMinerStats.push_back(stats);
+    return stats;
+}
+
+void ResetMinerStats()
+{
+    LOCK(cs_minerstats);
+    vMinerStats.clear();
+}
+
+void GetMinerStats(std::vector<CMinerStats>& vStats)
+{
+    vStats.clear();
+    int64_t nNow = GetTimeMillis();
+    LOCK(cs_minerstats);
+    BOOST_FOREACH(const boost::shared_ptr<CMinerThreadStats>& stats, vMinerStats) {
+        CMinerStats s;
+        s.nHashes = stats->nHashes.load(boost::memory_order_relaxed);
+        // A rate that has not been refreshed for two intervals belongs to a thread that stopped hashing
+        s.nHashesPerSec = nNow - stats->nRateTime.load(boost::memory_order_relaxed) > 8000 ? 0 : stats->nHashesPerSec.load(boost::memory_order_relaxed);
+        s.nTemplates = stats->nTemplates.load(boost::memory_order_relaxed);
+        s.nStaleTemplates = stats->nStaleTemplates.load(boost::memory_order_relaxed);
+        s.nTemplateMicros = stats->nTemplateMicros.load(boost::memory_order_relaxed);
+        s.nMaxTemplateMicros = stats->nMaxTemplateMicros.load(boost::memory_order_relaxed);
+        s.nBlocksFound = stats->nBlocksFound.load(boost::memory_order_relaxed);
+        vStats.push_back(s);
+    }
+}
+
+uint64_t GetMinerHashesPerSec()
+{
+    std::vector<CMinerStats> vStats;
+    GetMinerStats(vStats);
+    uint64_t nTotal = 0;
+    BOOST_FOREACH(const CMinerStats& s, vStats)
+        nTotal += s.nHashesPerSec;
+    return nTotal;
+}
+
 #ifdef ENABLE_WALLET
 //////////////////////////////////////////////////////////////////////////////
 //
 // Internal miner
 //
-double dHashesPerSec = 0.0;
-int64_t nHPSTimerStart = 0;
-
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey)
 {
     CPubKey pubkey;
@@ -407,7 +744,13 @@ bool ProcessBlockFound(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
     return true;
 }
 
-void static BitcoinMiner(CWallet *pwallet)
+/** Called for every nonce, so it must not touch chainActive without cs_main */
+static bool IsTipStale(const CBlockIndex* pindexPrev)
+{
+    return pindexPrev != GetActiveTip();
+}
+
+void static BitcoinMiner(CWallet *pwallet, boost::shared_ptr<CMinerThreadStats> stats)
 {
     LogPrintf("WorldcoinMiner started\n");
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
@@ -417,6 +760,10 @@ void static BitcoinMiner(CWallet *pwallet)
     CReserveKey reservekey(pwallet);
     unsigned int nExtraNonce = 0;
 
+    // Hash meter, private to this thread
+    int64_t nRateStart = GetTimeMillis();
+    uint64_t nRateHashes = 0;
+
     try {
         while (true) {
             if (Params().MiningRequiresPeers()) {
@@ -438,8 +785,9 @@ void static BitcoinMiner(CWallet *pwallet)
             // Create new block
             //
             unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-            CBlockIndex* pindexPrev = chainActive.Tip();
+            CBlockIndex* pindexPrev = GetActiveTip();
 
+            int64_t nTemplateStart = GetTimeMicros();
             auto_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey));
             if (!pblocktemplate.get())
             {
@@ -448,6 +796,7 @@ void static BitcoinMiner(CWallet *pwallet)
             }
             CBlock *pblock = &pblocktemplate->block;
             IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
+            stats->AddTemplate(GetTimeMicros() - nTemplateStart);
 
             LogPrintf("Running WorldcoinMiner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
                 ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
@@ -457,61 +806,44 @@ void static BitcoinMiner(CWallet *pwallet)
             //
             int64_t nStart = GetTime();
             uint256 hashTarget = uint256().SetCompact(pblock->nBits);
-            uint256 thash;
+            // Abandon the current batch as soon as the tip changes
+            boost::function<bool()> fnStop = boost::bind(&IsTipStale, pindexPrev);
             while (true) {
-                unsigned int nHashesDone = 0;
-                char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
-                while(true)
+                // Search the next 256 nonces for a solution
+                std::vector<CNonceHit> vHits;
+                uint64_t nHashesDone = ScanNonces(*pblock, pblock->nNonce, (uint64_t)pblock->nNonce + 0x100,
+                                                  hashTarget, vHits, fnStop);
+                pblock->nNonce += nHashesDone;
+                if (!vHits.empty())
                 {
-                    thash = pblock->GetPoWHash();
-                    if (thash <= hashTarget)
-                    {
-                        // Found a solution
-                        SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                        LogPrintf("WorldcoinMiner:\n");
-                        LogPrintf("proof-of-work found  \n  powhash: %s  \ntarget: %s\n", thash.GetHex(), hashTarget.GetHex());
-                        ProcessBlockFound(pblock, *pwallet, reservekey);
-                        SetThreadPriority(THREAD_PRIORITY_LOWEST);
-
-                        // In regression test mode, stop mining after a block is found.
-                        if (Params().MineBlocksOnDemand())
-                            throw boost::thread_interrupted();
-
-                        break;
-                    }
-                    pblock->nNonce += 1;
-                    nHashesDone += 1;
-                    if ((pblock->nNonce & 0xFF) == 0)
-                        break;
+                    // Found a solution
+                    pblock->nNonce = vHits[0].nNonce;
+                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
+                    LogPrintf("WorldcoinMiner:\n");
+                    LogPrintf("proof-of-work found  \n  powhash: %s  \ntarget: %s\n", vHits[0].hashPoW.GetHex(), hashTarget.GetHex());
+                    if (ProcessBlockFound(pblock, *pwallet, reservekey))
+                        stats->AddBlockFound();
+                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+
+                    // In regression test mode, stop mining after a block is found.
+                    if (Params().MineBlocksOnDemand())
+                        throw boost::thread_interrupted();
                 }
 
                 // Meter hashes/sec
-                static int64_t nHashCounter;
-                if (nHPSTimerStart == 0)
+                stats->AddHashes(nHashesDone);
+                nRateHashes += nHashesDone;
+                int64_t nNow = GetTimeMillis();
+                if (nNow - nRateStart > 4000)
                 {
-                    nHPSTimerStart = GetTimeMillis();
-                    nHashCounter = 0;
-                }
-                else
-                    nHashCounter += nHashesDone;
-                if (GetTimeMillis() - nHPSTimerStart > 4000)
-                {
-                    static CCriticalSection cs;
-                    {
-                        LOCK(cs);
-                        if (GetTimeMillis() - nHPSTimerStart > 4000)
-                        {
-                            dHashesPerSec = 1000.0 * nHashCounter / (GetTimeMillis() - nHPSTimerStart);
-                            nHPSTimerStart = GetTimeMillis();
-                            nHashCounter = 0;
-                            static int64_t nLogTime;
-                            if (GetTime() - nLogTime > 30 * 60)
-                            {
-                                nLogTime = GetTime();
-                                LogPrintf("hashmeter %6.0f khash/s\n", dHashesPerSec/1000.0);
-                            }
-                        }
-                    }
+                    stats->nHashesPerSec.store(1000 * nRateHashes / (nNow - nRateStart), boost::memory_order_relaxed);
+                    stats->nRateTime.store(nNow, boost::memory_order_relaxed);
+                    nRateStart = nNow;
+                    nRateHashes = 0;
+                    static boost::atomic<int64_t> nLogTime(0);
+                    int64_t nLast = nLogTime.load(boost::memory_order_relaxed);
+                    if (GetTime() - nLast > 30 * 60 && nLogTime.compare_exchange_strong(nLast, GetTime()))
+                        LogPrintf("hashmeter %6.0f khash/s\n", GetMinerHashesPerSec()/1000.0);
                 }
 
                 // Check for stop or if block needs to be rebuilt
@@ -523,7 +855,11 @@ void static BitcoinMiner(CWallet *pwallet)
                     break;
                 if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
                     break;
-                if (pindexPrev != chainActive.Tip())
+                if (IsTipStale(pindexPrev)) {
+                    stats->AddStaleTemplate();
+                    break;
+                }
+                if (!vHits.empty())
                     break;
 
                 // Update nTime every few seconds
@@ -566,13 +902,14 @@ void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads)
         delete minerThreads;
         minerThreads = NULL;
     }
+    ResetMinerStats();
 
     if (nThreads == 0 || !fGenerate)
         return;
 
     minerThreads = new boost::thread_group();
     for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(boost::bind(&BitcoinMiner, pwallet));
+        minerThreads->create_thread(boost::bind(&BitcoinMiner, pwallet, RegisterMinerThread()));
 }
 
 #endif // ENABLE_WALLET
@@ -6,7 +6,15 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include "uint256.h"
+
 #include <stdint.h>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 
 class CBlock;
 class CBlockHeader;
@@ -17,6 +25,65 @@ class CWallet;
 
 struct CBlockTemplate;
 
+/** A nonce whose Argon2d hash meets the target */
+struct CNonceHit
+{
+    uint32_t nNonce;
+    uint256 hashPoW;
+};
+
+/**
+ * Counters of a single miner thread. Only the owning thread writes them, so
+ * the hashing loop never takes a lock; readers take a snapshot with relaxed loads.
+ */
+class CMinerThreadStats : boost::noncopyable
+{
+public:
+    boost::atomic<uint64_t> nHashes;          //! Argon2d hashes computed
+    boost::atomic<uint64_t> nHashesPerSec;    //! Rate over the last metering interval
+    boost::atomic<int64_t> nRateTime;         //! GetTimeMillis() when nHashesPerSec was last set
+    boost::atomic<uint64_t> nTemplates;       //! Block templates built
+    boost::atomic<uint64_t> nStaleTemplates;  //! Templates abandoned because the tip moved
+    boost::atomic<uint64_t> nTemplateMicros;  //! Total template build time
+    boost::atomic<uint64_t> nMaxTemplateMicros;
+    boost::atomic<uint64_t> nBlocksFound;
+
+    CMinerThreadStats();
+
+    void AddHashes(uint64_t nCount) { Add(nHashes, nCount); }
+    void AddTemplate(int64_t nMicros);
+    void AddStaleTemplate() { Add(nStaleTemplates, 1); }
+    void AddBlockFound() { Add(nBlocksFound, 1); }
+
+private:
+    //! Single writer, so a relaxed load and store replace a locked read-modify-write
+    static void Add(boost::atomic<uint64_t>& counter, uint64_t n)
+    {
+        counter.store(counter.load(boost::memory_order_relaxed) + n, boost::memory_order_relaxed);
+    }
+};
+
+/** Point-in-time copy of CMinerThreadStats */
+struct CMinerStats
+{
+    uint64_t nHashes;
+    uint64_t nHashesPerSec;
+    uint64_t nTemplates;
+    uint64_t nStaleTemplates;
+    uint64_t nTemplateMicros;
+    uint64_t nMaxTemplateMicros;
+    uint64_t nBlocksFound;
+};
+
+/** Register the counters of a new miner thread */
+boost::shared_ptr<CMinerThreadStats> RegisterMinerThread();
+/** Forget all miner threads, called when the threads are restarted */
+void ResetMinerStats();
+/** Snapshot the counters of every running miner thread */
+void GetMinerStats(std::vector<CMinerStats>& vStats);
+/** Sum of the recent hash rates of all miner threads, 0 if none is hashing */
+uint64_t GetMinerHashesPerSec();
+
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads);
 /** Generate a new block, without valid proof-of-work */
@@ -27,8 +94,15 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
 /** Check mined block */
 bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey);
 void UpdateTime(CBlockHeader* block, const CBlockIndex* pindexPrev);
-
-extern double dHashesPerSec;
-extern int64_t nHPSTimerStart;
+/**
+ * Hash the nonces nNonceBegin..nNonceEnd-1 of a header template with the calling
+ * thread's Argon2d memory and collect those at or below hashTarget in vHits.
+ * The header is serialized once, only the nonce is patched between hashes.
+ * Stops after nMaxHits hits, or as soon as fnStop (if set) returns true.
+ * Returns the number of hashes computed.
+ */
+uint64_t ScanNonces(const CBlockHeader& header, uint32_t nNonceBegin, uint64_t nNonceEnd, const uint256& hashTarget,
+                    std::vector<CNonceHit>& vHits, const boost::function<bool()>& fnStop = boost::function<bool()>(),
+                    unsigned int nMaxHits = 1);
 
 #endif // BITCOIN_MINER_H
@@ -101,6 +101,36 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     return bnNew.GetCompact();
 }
 
+bool PermittedDifficultyTransition(int64_t nHeight, unsigned int nOldBits, unsigned int nNewBits)
+{
+    // Min-difficulty blocks may come at any height
+    if (Params().AllowMinDifficultyBlocks())
+        return true;
+
+    int64_t retargetInterval = nHeight >= nDiffChangeTarget ? Params().Interval2() : Params().Interval();
+    if (nHeight % retargetInterval != 0)
+        return nNewBits == nOldBits;
+
+    bool fNegative;
+    bool fOverflow;
+    uint256 bnOld;
+    bnOld.SetCompact(nOldBits, &fNegative, &fOverflow);
+    if (fNegative || fOverflow || bnOld == 0 || bnOld > Params().ProofOfWorkLimit())
+        return false;
+    uint256 bnNew;
+    bnNew.SetCompact(nNewBits, &fNegative, &fOverflow);
+    if (fNegative || fOverflow || bnNew == 0)
+        return false;
+
+    // Only an easier target saves the sender work; rounded through the
+    // compact encoding like GetNextWorkRequired's result
+    uint256 bnLargest = bnOld * 4;
+    if (bnLargest > Params().ProofOfWorkLimit())
+        bnLargest = Params().ProofOfWorkLimit();
+    bnLargest.SetCompact(bnLargest.GetCompact());
+    return bnNew <= bnLargest;
+}
+
 bool CheckProofOfWork(uint256 hash, unsigned int nBits)
 {
     bool fNegative;
@@ -117,12 +147,12 @@ bool CheckProofOfWork(uint256 hash, unsigned int nBits)
         return error("CheckProofOfWork() : nBits below minimum work");
 
     // Debug output to see what's happening
-    LogPrintf("CheckProofOfWork: hash=%s, target=%s, nBits=%08x\n", 
+    LogPrint("pow", "CheckProofOfWork: hash=%s, target=%s, nBits=%08x\n", 
               hash.ToString(), bnTarget.ToString(), nBits);
 
     // Check proof of work matches claimed amount
     if (hash > bnTarget) {
-        LogPrintf("CheckProofOfWork FAILED: hash > target\n");
+        LogPrint("pow", "CheckProofOfWork FAILED: hash > target\n");
         return error("CheckProofOfWork() : hash doesn't match nBits");
     }
         
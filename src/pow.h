@@ -14,6 +14,14 @@ class uint256;
 
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock);
 
+/**
+ * Check whether a block at nHeight may have nNewBits after a parent with
+ * nOldBits: the target only changes at a retarget and then gets at most four
+ * times easier, as GetNextWorkRequired allows. This lets a chain of headers
+ * be checked before any of them is in the block index.
+ */
+bool PermittedDifficultyTransition(int64_t nHeight, unsigned int nOldBits, unsigned int nNewBits);
+
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckProofOfWork(uint256 hash, unsigned int nBits);
 uint256 GetBlockProof(const CBlockIndex& block);
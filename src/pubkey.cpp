@@ -12,6 +12,24 @@
 #include "ecwrapper.h"
 #endif
 
+#ifdef USE_SECP256K1
+//! anonymous namespace
+namespace {
+
+class CSecp256k1VerifyInit {
+public:
+    CSecp256k1VerifyInit() {
+        secp256k1_start(SECP256K1_START_VERIFY);
+    }
+    ~CSecp256k1VerifyInit() {
+        secp256k1_stop();
+    }
+};
+static CSecp256k1VerifyInit instance_of_csecp256k1verifyinit;
+
+} // anon namespace
+#endif
+
 bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
     if (!IsValid())
         return false;
@@ -28,6 +46,37 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
     return true;
 }
 
+void CSignatureBatch::Add(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) {
+    vHash.push_back(hash);
+    vSig.push_back(vchSig);
+    vPubKey.push_back(pubkey);
+}
+
+bool CSignatureBatch::Verify() const {
+#ifdef USE_SECP256K1
+    std::vector<const unsigned char*> vpHash, vpSig, vpPubKey;
+    std::vector<int> vSigLen, vPubKeyLen;
+    for (size_t i = 0; i < vHash.size(); i++) {
+        if (!vPubKey[i].IsValid() || vSig[i].empty())
+            return false;
+        vpHash.push_back(vHash[i].begin());
+        vpSig.push_back(&vSig[i][0]);
+        vSigLen.push_back(vSig[i].size());
+        vpPubKey.push_back(vPubKey[i].begin());
+        vPubKeyLen.push_back(vPubKey[i].size());
+    }
+    if (vHash.empty())
+        return true;
+    return secp256k1_ecdsa_verify_batch(vHash.size(), &vpHash[0], &vpSig[0], &vSigLen[0], &vpPubKey[0], &vPubKeyLen[0]) == 1;
+#else
+    for (size_t i = 0; i < vHash.size(); i++) {
+        if (!vPubKey[i].Verify(vHash[i], vSig[i]))
+            return false;
+    }
+    return true;
+#endif
+}
+
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
     if (vchSig.size() != 65)
         return false;
@@ -53,7 +102,7 @@ bool CPubKey::IsFullyValid() const {
     if (!IsValid())
         return false;
 #ifdef USE_SECP256K1
-    if (!secp256k1_ecdsa_pubkey_verify(begin(), size()))
+    if (!secp256k1_ec_pubkey_verify(begin(), size()))
         return false;
 #else
     CECKey key;
@@ -68,7 +117,7 @@ bool CPubKey::Decompress() {
         return false;
 #ifdef USE_SECP256K1
     int clen = size();
-    int ret = secp256k1_ecdsa_pubkey_decompress((unsigned char*)begin(), &clen);
+    int ret = secp256k1_ec_pubkey_decompress((unsigned char*)begin(), &clen);
     assert(ret);
     assert(clen == (int)size());
 #else
@@ -91,7 +140,7 @@ bool CPubKey::Derive(CPubKey& pubkeyChild, unsigned char ccChild[32], unsigned i
     memcpy(ccChild, out+32, 32);
 #ifdef USE_SECP256K1
     pubkeyChild = *this;
-    bool ret = secp256k1_ecdsa_pubkey_tweak_add((unsigned char*)pubkeyChild.begin(), pubkeyChild.size(), out);
+    bool ret = secp256k1_ec_pubkey_tweak_add((unsigned char*)pubkeyChild.begin(), pubkeyChild.size(), out);
 #else
     CECKey key;
     bool ret = key.SetPubKey(begin(), size());
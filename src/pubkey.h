@@ -185,6 +185,30 @@ public:
     bool Derive(CPubKey& pubkeyChild, unsigned char ccChild[32], unsigned int nChild, const unsigned char cc[32]) const;
 };
 
+/**
+ * Signatures that are verified together. With libsecp256k1 part of the work
+ * is shared by the whole batch; otherwise they are verified one by one.
+ */
+class CSignatureBatch
+{
+private:
+    std::vector<uint256> vHash;
+    std::vector<std::vector<unsigned char> > vSig;
+    std::vector<CPubKey> vPubKey;
+
+public:
+    void Add(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey);
+
+    //! Whether every signature in the batch is valid (but not which one is not).
+    bool Verify() const;
+
+    size_t size() const { return vHash.size(); }
+    bool empty() const { return vHash.empty(); }
+    const uint256& GetHash(size_t i) const { return vHash[i]; }
+    const std::vector<unsigned char>& GetSig(size_t i) const { return vSig[i]; }
+    const CPubKey& GetPubKey(size_t i) const { return vPubKey[i]; }
+};
+
 struct CExtPubKey {
     unsigned char nDepth;
     unsigned char vchFingerprint[4];
@@ -7,10 +7,13 @@
 #include "main.h"
 #include "rpcserver.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <stdint.h>
 
+#include <boost/filesystem.hpp>
+
 #include "json/json_spirit_value.h"
 
 using namespace json_spirit;
@@ -310,7 +313,8 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
         throw runtime_error(
             "gettxoutsetinfo\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time. The set is scanned from a snapshot of the chainstate\n"
+            "database, so the node keeps processing blocks and transactions meanwhile.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -318,8 +322,10 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) Hash of the best block and of the unspent outputs, independent of their order\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"cache_usage\": n,       (numeric) Memory used by the coins cache before this call flushed it, in bytes\n"
+            "  \"cache_max\": n,         (numeric) Memory the coins cache may use before it is flushed (see -dbcache)\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
@@ -329,8 +335,13 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
     Object ret;
 
     CCoinsStats stats;
+    size_t nCacheUsage;
+    {
+        LOCK(cs_main);
+        nCacheUsage = pcoinsTip->DynamicMemoryUsage();
+    }
     FlushStateToDisk();
-    if (pcoinsTip->GetStats(stats)) {
+    if (pcoinsdbview->GetStats(stats)) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
@@ -338,10 +349,112 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        ret.push_back(Pair("cache_usage", (int64_t)nCacheUsage));
+        ret.push_back(Pair("cache_max", (int64_t)nCoinCacheUsage));
     }
     return ret;
 }
 
+/** Paths given to the UTXO snapshot calls are relative to the data directory */
+static boost::filesystem::path GetTxOutSetPath(const string& strPath)
+{
+    boost::filesystem::path path(strPath);
+    if (!path.is_absolute())
+        path = GetDataDir() / path;
+    return path;
+}
+
+static Object TxOutSetSnapshotToJSON(const boost::filesystem::path& path, const CCoinsStats& stats)
+{
+    Object ret;
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+    ret.push_back(Pair("bytes", (int64_t)stats.nSerializedSize));
+    ret.push_back(Pair("checksum", stats.hashSerialized.GetHex()));
+    return ret;
+}
+
+Value dumptxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites a snapshot of the unspent transaction output set at the current tip to a file.\n"
+            "It can be loaded with loadtxoutset or -loadsnapshot by a node that has the blocks up to\n"
+            "that tip, but no chainstate yet. The node keeps processing blocks meanwhile.\n"
+            "\nArguments:\n"
+            "1. \"path\"   (string, required) The file to write, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",        (string) The file written\n"
+            "  \"height\": n,            (numeric) Height of the block the snapshot belongs to\n"
+            "  \"bestblock\": \"hex\",     (string) Hash of that block\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs\n"
+            "  \"txouts\": n,            (numeric) The number of unspent outputs\n"
+            "  \"total_amount\": x.xxx,  (numeric) The total amount\n"
+            "  \"bytes\": n,             (numeric) Size of the file\n"
+            "  \"checksum\": \"hex\"       (string) Checksum of the file, which loadtxoutset needs to accept it\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = GetTxOutSetPath(params[0].get_str());
+    CCoinsStats stats;
+    if (!DumpTxOutSet(path, stats))
+        throw JSONRPCError(RPC_MISC_ERROR, "Failed to write the UTXO snapshot (see debug.log)");
+    return TxOutSetSnapshotToJSON(path, stats);
+}
+
+Value loadtxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "loadtxoutset \"path\" ( \"checksum\" )\n"
+            "\nReplaces the unspent transaction output set with a snapshot written by dumptxoutset, and\n"
+            "continues the active chain from the block it belongs to. Only possible while the chain has\n"
+            "not moved beyond the genesis block, and if that block and its ancestors are stored.\n"
+            "The blocks up to the snapshot are not validated, so the snapshot must have the expected\n"
+            "checksum, and the chain can never be reorganized below it.\n"
+            "\nArguments:\n"
+            "1. \"path\"       (string, required) The file to read, relative to the data directory unless absolute\n"
+            "2. \"checksum\"   (string, optional) The checksum dumptxoutset reported for it; required unless one is built in for its block\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",        (string) The file read\n"
+            "  \"height\": n,            (numeric) Height of the block the snapshot belongs to\n"
+            "  \"bestblock\": \"hex\",     (string) Hash of that block\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs\n"
+            "  \"txouts\": n,            (numeric) The number of unspent outputs\n"
+            "  \"total_amount\": x.xxx,  (numeric) The total amount\n"
+            "  \"bytes\": n,             (numeric) Size of the file\n"
+            "  \"checksum\": \"hex\"       (string) Checksum of the file\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"checksum\"")
+            + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"checksum\"")
+        );
+
+    boost::filesystem::path path = GetTxOutSetPath(params[0].get_str());
+    uint256 hashExpected = 0;
+    if (params.size() > 1)
+        hashExpected = ParseHashV(params[1], "checksum");
+    CCoinsStats stats;
+    if (!LoadTxOutSet(path, hashExpected, stats))
+        throw JSONRPCError(RPC_MISC_ERROR, "Failed to load the UTXO snapshot (see debug.log)");
+
+    CValidationState state;
+    ActivateBestChain(state);
+    if (!state.IsValid())
+        throw JSONRPCError(RPC_DATABASE_ERROR, state.GetRejectReason());
+    return TxOutSetSnapshotToJSON(path, stats);
+}
+
 Value gettxout(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -591,6 +704,11 @@ Value getmempoolinfo(const Array& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool (see -maxmempool)\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee per kB for a transaction to be accepted\n"
+            "  \"evicted\": xxxxx             (numeric) Transactions evicted to stay below maxmempool\n"
+            "  \"coinscacheusage\": xxxxx     (numeric) Memory used by the coins cache the mempool is validated against\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -600,7 +718,84 @@ Value getmempoolinfo(const Array& params, bool fHelp)
     Object ret;
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
+    size_t nMaxMempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("maxmempool", (int64_t) nMaxMempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(std::max(mempool.GetMinFee(nMaxMempool), ::minRelayTxFee).GetFeePerK())));
+    ret.push_back(Pair("evicted", (int64_t) mempool.GetEvictedCount()));
+    {
+        LOCK(cs_main);
+        ret.push_back(Pair("coinscacheusage", (int64_t) pcoinsTip->DynamicMemoryUsage()));
+    }
+
+    return ret;
+}
+
+static Object DBStatsToJSON(const CLevelDBProfile& profile, const CLevelDBStats& stats)
+{
+    Object objProfile;
+    objProfile.push_back(Pair("blocksize", (uint64_t)profile.nBlockSize));
+    objProfile.push_back(Pair("maxopenfiles", profile.nMaxOpenFiles));
+    objProfile.push_back(Pair("compression", profile.fCompression));
+    objProfile.push_back(Pair("bloombits", profile.nBloomBits));
+    objProfile.push_back(Pair("writebuffer", profile.nWriteBufferPercent));
+
+    Object ret;
+    ret.push_back(Pair("profile", objProfile));
+    ret.push_back(Pair("approximate_size", (uint64_t)stats.nApproximateSize));
+    ret.push_back(Pair("cache_hits", (uint64_t)stats.nCacheHits));
+    ret.push_back(Pair("cache_misses", (uint64_t)stats.nCacheMisses));
+    uint64_t nLookups = stats.nCacheHits + stats.nCacheMisses;
+    ret.push_back(Pair("cache_hit_ratio", nLookups ? (double)stats.nCacheHits / nLookups : 0.0));
+    ret.push_back(Pair("writes", (uint64_t)stats.nWrites));
+    ret.push_back(Pair("write_time", stats.nWriteMicros * 0.000001));
+    ret.push_back(Pair("write_stall_time", stats.nStallMicros * 0.000001));
+    ret.push_back(Pair("bulk_loading", stats.fBulkLoading));
+    ret.push_back(Pair("leveldb_stats", stats.strLevelDBStats));
+    return ret;
+}
+
+Value getdbstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "\nReturns statistics about the chainstate and block index databases.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {               (object) The chainstate (UTXO set) database\n"
+            "    \"profile\": {                (object) Tuning the database was opened with (see -chainstateprofile)\n"
+            "      \"blocksize\": xxxxx,        (numeric) Size of a table block in bytes\n"
+            "      \"maxopenfiles\": xxxxx,     (numeric) Number of table files kept open\n"
+            "      \"compression\": true|false, (boolean) Whether blocks are compressed\n"
+            "      \"bloombits\": xxxxx,        (numeric) Bloom filter bits per key, 0 for none\n"
+            "      \"writebuffer\": xxxxx       (numeric) Percentage of the database cache used per write buffer\n"
+            "    },\n"
+            "    \"approximate_size\": xxxxx,   (numeric) Approximate size on disk in bytes\n"
+            "    \"cache_hits\": xxxxx,         (numeric) Block cache lookups that found the block\n"
+            "    \"cache_misses\": xxxxx,       (numeric) Block cache lookups that read the block from disk\n"
+            "    \"cache_hit_ratio\": x.xxx,    (numeric) Share of block cache lookups that were hits\n"
+            "    \"writes\": xxxxx,             (numeric) Number of batches written\n"
+            "    \"write_time\": x.xxx,         (numeric) Seconds spent writing batches\n"
+            "    \"write_stall_time\": x.xxx,   (numeric) Seconds writes were slowed down for level-0 compactions\n"
+            "    \"bulk_loading\": true|false, (boolean) Whether the database is still written in bulk, until the initial block download is over\n"
+            "    \"leveldb_stats\": \"...\"      (string) LevelDB's own per-level file and compaction statistics\n"
+            "  },\n"
+            "  \"blockindex\": {...}           (object) The block index database, same fields (see -blockindexprofile)\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
 
+    LOCK(cs_main);
+    Object ret;
+    CLevelDBStats stats;
+    pcoinsdbview->GetDBStats(stats);
+    ret.push_back(Pair("chainstate", DBStatsToJSON(pcoinsdbview->GetDBProfile(), stats)));
+    stats = CLevelDBStats();
+    pblocktree->GetStats(stats);
+    ret.push_back(Pair("blockindex", DBStatsToJSON(pblocktree->GetProfile(), stats)));
     return ret;
 }
 
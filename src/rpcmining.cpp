@@ -178,11 +178,13 @@ Value setgenerate(const Array& params, bool fHelp)
                 LOCK(cs_main);
                 IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
             }
-            while (!CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits)) {
-                // Yes, there is a chance every nonce could fail to satisfy the -regtest
-                // target -- 1 in 2^(2^32). That ain't gonna happen.
-                ++pblock->nNonce;
-            }
+            // Yes, there is a chance every nonce could fail to satisfy the -regtest
+            // target -- 1 in 2^(2^32). That ain't gonna happen.
+            std::vector<CNonceHit> vHits;
+            ScanNonces(*pblock, pblock->nNonce, 0x100000000ULL, uint256().SetCompact(pblock->nBits), vHits);
+            if (vHits.empty())
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "No nonce satisfies the target");
+            pblock->nNonce = vHits[0].nNonce;
             CValidationState state;
             if (!ProcessNewBlock(state, NULL, pblock))
                 throw JSONRPCError(RPC_INTERNAL_ERROR, "ProcessNewBlock, block not accepted");
@@ -215,9 +217,67 @@ Value gethashespersec(const Array& params, bool fHelp)
             + HelpExampleRpc("gethashespersec", "")
         );
 
-    if (GetTimeMillis() - nHPSTimerStart > 8000)
-        return (int64_t)0;
-    return (int64_t)dHashesPerSec;
+    return (int64_t)GetMinerHashesPerSec();
+}
+
+Value getminerstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getminerstats\n"
+            "\nReturns counters of the internal miner threads started by setgenerate or -gen.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"threads\": n,               (numeric) The number of miner threads\n"
+            "  \"hashespersec\": n,          (numeric) The recent hashes per second of all threads\n"
+            "  \"hashes\": n,                (numeric) The hashes computed by all threads\n"
+            "  \"blocksfound\": n,           (numeric) The blocks found and accepted by all threads\n"
+            "  \"perthread\": [              (array) One entry per miner thread\n"
+            "    {\n"
+            "      \"hashes\": n,            (numeric) The hashes computed by this thread\n"
+            "      \"hashespersec\": n,      (numeric) The recent hashes per second of this thread\n"
+            "      \"templates\": n,         (numeric) The block templates built\n"
+            "      \"staletemplates\": n,    (numeric) The templates abandoned because the chain tip changed\n"
+            "      \"avgtemplatemicros\": n, (numeric) The average template build time in microseconds\n"
+            "      \"maxtemplatemicros\": n, (numeric) The longest template build time in microseconds\n"
+            "      \"blocksfound\": n        (numeric) The blocks found and accepted\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getminerstats", "")
+            + HelpExampleRpc("getminerstats", "")
+        );
+
+    std::vector<CMinerStats> vStats;
+    GetMinerStats(vStats);
+
+    uint64_t nHashesPerSec = 0, nHashes = 0, nBlocksFound = 0;
+    Array threads;
+    BOOST_FOREACH(const CMinerStats& stats, vStats) {
+        nHashesPerSec += stats.nHashesPerSec;
+        nHashes += stats.nHashes;
+        nBlocksFound += stats.nBlocksFound;
+
+        Object entry;
+        entry.push_back(Pair("hashes",            stats.nHashes));
+        entry.push_back(Pair("hashespersec",      stats.nHashesPerSec));
+        entry.push_back(Pair("templates",         stats.nTemplates));
+        entry.push_back(Pair("staletemplates",    stats.nStaleTemplates));
+        entry.push_back(Pair("avgtemplatemicros", stats.nTemplates ? stats.nTemplateMicros / stats.nTemplates : 0));
+        entry.push_back(Pair("maxtemplatemicros", stats.nMaxTemplateMicros));
+        entry.push_back(Pair("blocksfound",       stats.nBlocksFound));
+        threads.push_back(entry);
+    }
+
+    Object obj;
+    obj.push_back(Pair("threads",      (uint64_t)vStats.size()));
+    obj.push_back(Pair("hashespersec", nHashesPerSec));
+    obj.push_back(Pair("hashes",       nHashes));
+    obj.push_back(Pair("blocksfound",  nBlocksFound));
+    obj.push_back(Pair("perthread",    threads));
+    return obj;
 }
 #endif
 
@@ -238,6 +298,7 @@ Value getmininginfo(const Array& params, bool fHelp)
             "  \"generate\": true|false     (boolean) If the generation is on or off (see getgenerate or setgenerate calls)\n"
             "  \"genproclimit\": n          (numeric) The processor limit for generation. -1 if no generation. (see getgenerate or setgenerate calls)\n"
             "  \"hashespersec\": n          (numeric) The hashes per second of the generation, or 0 if no generation.\n"
+            "  \"minerthreads\": n          (numeric) The number of running miner threads (see getminerstats)\n"
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
@@ -261,6 +322,9 @@ Value getmininginfo(const Array& params, bool fHelp)
 #ifdef ENABLE_WALLET
     obj.push_back(Pair("generate",         getgenerate(params, false)));
     obj.push_back(Pair("hashespersec",     gethashespersec(params, false)));
+    std::vector<CMinerStats> vStats;
+    GetMinerStats(vStats);
+    obj.push_back(Pair("minerthreads",     (uint64_t)vStats.size()));
 #endif
     return obj;
 }
@@ -492,10 +556,11 @@ Value getblocktemplate(const Array& params, bool fHelp)
 
     // Update block
     static CBlockIndex* pindexPrev;
-    static int64_t nStart;
     static CBlockTemplate* pblocktemplate;
+    // CreateNewBlock patches its cached selection with mempool changes, so
+    // refreshing on every change is cheap
     if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
+        mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast)
     {
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
         pindexPrev = NULL;
@@ -503,7 +568,6 @@ Value getblocktemplate(const Array& params, bool fHelp)
         // Store the pindexBest used before CreateNewBlock, to avoid races
         nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
         CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
 
         // Create new block
         if(pblocktemplate)
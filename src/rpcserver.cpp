@@ -159,17 +159,20 @@ static const CRPCCommand vRPCCommands[] =
 	{ "network",            "ping",                   &ping,                   true,      false,      false },
 
 	/* Block chain and UTXO */
+	{ "blockchain",         "dumptxoutset",           &dumptxoutset,           true,      true,       false },
 	{ "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      false,      false },
 	{ "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      false,      false },
 	{ "blockchain",         "getblockcount",          &getblockcount,          true,      false,      false },
 	{ "blockchain",         "getblock",               &getblock,               true,      false,      false },
 	{ "blockchain",         "getblockhash",           &getblockhash,           true,      false,      false },
 	{ "blockchain",         "getchaintips",           &getchaintips,           true,      false,      false },
+	{ "blockchain",         "getdbstats",             &getdbstats,             true,      true,       false },
 	{ "blockchain",         "getdifficulty",          &getdifficulty,          true,      false,      false },
 	{ "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true,       false },
 	{ "blockchain",         "getrawmempool",          &getrawmempool,          true,      false,      false },
 	{ "blockchain",         "gettxout",               &gettxout,               true,      false,      false },
-	{ "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
+	{ "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      true,       false },
+	{ "blockchain",         "loadtxoutset",           &loadtxoutset,           true,      true,       false },
 	{ "blockchain",         "verifychain",            &verifychain,            true,      false,      false },
 	{ "blockchain",         "invalidateblock",        &invalidateblock,        true,      true,       false },
 	{ "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      true,       false },
@@ -185,6 +188,7 @@ static const CRPCCommand vRPCCommands[] =
 	/* Coin generation */
 	{ "generating",         "getgenerate",            &getgenerate,            true,      false,      false },
 	{ "generating",         "gethashespersec",        &gethashespersec,        true,      false,      false },
+	{ "generating",         "getminerstats",          &getminerstats,          true,      false,      false },
 	{ "generating",         "setgenerate",            &setgenerate,            true,      true,       false },
 #endif
 
@@ -5,78 +5,121 @@
 
 #include "sigcache.h"
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
+#include <string.h>
 
-namespace {
+#include <boost/thread/locks.hpp>
 
-/**
- * Valid signature cache, to avoid doing expensive ECDSA signature checking
- * twice for every transaction (once when accepted into memory pool, and
- * again when accepted into the block chain)
- */
-class CSignatureCache
+int64_t GetSigCacheSizeMiB(int64_t nArg)
 {
-private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
-
-public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
+    if (nArg > MAX_MAX_SIG_CACHE_SIZE) {
+        int64_t nMiB = (nArg * (int64_t)sizeof(uint256) + (1 << 20) - 1) >> 20;
+        LogPrintf("-maxsigcachesize=%d is above %d MiB, taking it as a number of entries: %d MiB\n", nArg, MAX_MAX_SIG_CACHE_SIZE, nMiB);
+        nArg = nMiB;
+    }
+    return std::min(std::max((int64_t)0, nArg), MAX_MAX_SIG_CACHE_SIZE);
+}
+
+uint256 CSignatureCache::ComputeEntry(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey) const
+{
+    // The signature is preceded by its length, so where it ends and the
+    // public key begins is never ambiguous
+    unsigned char pchSigSize[4];
+    WriteLE32(pchSigSize, vchSig.size());
+    uint256 entry;
+    CSHA256().Write(nonce, sizeof(nonce)).Write(hash.begin(), 32).Write(pchSigSize, sizeof(pchSigSize)).Write(&vchSig[0], vchSig.size()).Write(pubKey.begin(), pubKey.size()).Finalize(entry.begin());
+    return entry;
+}
+
+//! The digest is uniformly random, so its words select the stripe and the first slot
+unsigned int CSignatureCache::GetStripe(const uint256& entry) const
+{
+    return entry.GetLow64() % STRIPES;
+}
+
+size_t CSignatureCache::GetFirstSlot(const uint256& entry) const
+{
+    uint64_t n;
+    memcpy(&n, entry.begin() + 8, sizeof(n));
+    return GetStripe(entry) * nStripeSlots + n % nStripeSlots;
+}
+
+size_t CSignatureCache::GetSlot(const uint256& entry, size_t nFirst, unsigned int nProbe) const
+{
+    size_t nStripeBegin = GetStripe(entry) * nStripeSlots;
+    return nStripeBegin + (nFirst - nStripeBegin + nProbe) % nStripeSlots;
+}
+
+CSignatureCache::CSignatureCache(size_t nBytes) : nStripeSlots(0)
+{
+    GetRandBytes(nonce, sizeof(nonce));
+    nStripeSlots = nBytes / sizeof(uint256) / STRIPES;
+    if (nStripeSlots < PROBES)
+        nStripeSlots = 0;
+    vTable.resize(nStripeSlots * STRIPES);
+}
+
+bool CSignatureCache::Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+{
+    if (nStripeSlots == 0 || vchSig.empty())
         return false;
+    uint256 entry = ComputeEntry(hash, vchSig, pubKey);
+    size_t nFirst = GetFirstSlot(entry);
+
+    boost::shared_lock<boost::shared_mutex> lock(cs_stripe[GetStripe(entry)]);
+    for (unsigned int i = 0; i < PROBES; i++) {
+        if (vTable[GetSlot(entry, nFirst, i)] == entry)
+            return true;
     }
+    return false;
+}
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+void CSignatureCache::Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+{
+    if (nStripeSlots == 0 || vchSig.empty())
+        return;
+    uint256 entry = ComputeEntry(hash, vchSig, pubKey);
+    size_t nFirst = GetFirstSlot(entry);
+    // If all probed slots are taken, one of them is evicted at random. Random
+    // because that helps foil would-be DoS attackers who might try to
+    // pre-generate and re-use a set of valid signatures just-slightly-
+    // greater than our cache size. Drawn before the lock is taken, as
+    // GetRand takes locks of its own.
+    unsigned int nEvict = GetRand(PROBES);
+
+    boost::unique_lock<boost::shared_mutex> lock(cs_stripe[GetStripe(entry)]);
+    for (unsigned int i = 0; i < PROBES; i++) {
+        uint256& slot = vTable[GetSlot(entry, nFirst, i)];
+        if (slot == entry)
+            return;
+        if (slot == 0) {
+            slot = entry;
+            return;
         }
-
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
     }
-};
+    vTable[GetSlot(entry, nFirst, nEvict)] = entry;
+}
+
+namespace {
+
+CSignatureCache& GetSignatureCache()
+{
+    // Constructed on first use, after the arguments are parsed
+    static CSignatureCache signatureCache(GetSigCacheSizeMiB(GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE)) << 20);
+    return signatureCache;
+}
 
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
 
     if (signatureCache.Get(sighash, vchSig, pubkey))
         return true;
@@ -88,3 +131,19 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
         signatureCache.Set(sighash, vchSig, pubkey);
     return true;
 }
+
+bool BatchingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
+    if (GetSignatureCache().Get(sighash, vchSig, pubkey))
+        return true;
+
+    pbatch->Add(sighash, vchSig, pubkey);
+    return true;
+}
+
+void CacheSignatures(const CSignatureBatch& batch, size_t nBegin, size_t nEnd)
+{
+    CSignatureCache& signatureCache = GetSignatureCache();
+    for (size_t i = nBegin; i < nEnd; i++)
+        signatureCache.Set(batch.GetHash(i), batch.GetSig(i), batch.GetPubKey(i));
+}
@@ -7,10 +7,66 @@
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
 #include "script/interpreter.h"
+#include "uint256.h"
 
 #include <vector>
 
+#include <boost/thread/shared_mutex.hpp>
+
 class CPubKey;
+class CSignatureBatch;
+
+//! -maxsigcachesize default (MiB)
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+//! max. -maxsigcachesize (MiB)
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 256;
+
+/**
+ * Size in MiB for a -maxsigcachesize value. The option used to count
+ * entries, so values above MAX_MAX_SIG_CACHE_SIZE are taken as the number
+ * of entries of that time and converted.
+ */
+int64_t GetSigCacheSizeMiB(int64_t nArg);
+
+/**
+ * Valid signature cache, to avoid doing expensive ECDSA signature checking
+ * twice for every transaction (once when accepted into memory pool, and
+ * again when accepted into the block chain)
+ *
+ * Only a 32-byte digest of each (signature hash, signature, public key) is
+ * kept, salted with a random nonce so that nobody can construct entries that
+ * collide. The digests live in one open addressing table, split in stripes
+ * that each have their own lock, so checks running in parallel rarely wait
+ * for each other.
+ */
+class CSignatureCache
+{
+private:
+    //! Number of independently locked parts of the table
+    static const unsigned int STRIPES = 64;
+    //! Slots looked at for one digest before an entry is evicted
+    static const unsigned int PROBES = 8;
+
+    unsigned char nonce[32];
+    //! STRIPES parts of nStripeSlots digests each; an empty slot holds 0
+    std::vector<uint256> vTable;
+    size_t nStripeSlots;
+    boost::shared_mutex cs_stripe[STRIPES];
+
+    uint256 ComputeEntry(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey) const;
+    unsigned int GetStripe(const uint256& entry) const;
+    size_t GetFirstSlot(const uint256& entry) const;
+    size_t GetSlot(const uint256& entry, size_t nFirst, unsigned int nProbe) const;
+
+public:
+    //! A cache that takes about nBytes; too small a size disables it
+    explicit CSignatureCache(size_t nBytes);
+
+    //! Number of digests the cache can hold
+    size_t GetCapacity() const { return vTable.size(); }
+    bool Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey);
+    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey);
+};
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
@@ -23,4 +79,25 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/**
+ * Signature checker that does not verify the signatures missing from the
+ * cache, but assumes them valid and adds them to a batch that is verified
+ * afterwards. The outcome of the script is only meaningful if the whole
+ * batch turns out valid. Not for scripts with CHECKMULTISIG, which tries
+ * signatures against keys they need not belong to.
+ */
+class BatchingTransactionSignatureChecker : public TransactionSignatureChecker
+{
+private:
+    CSignatureBatch* pbatch;
+
+public:
+    BatchingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, CSignatureBatch* pbatchIn) : TransactionSignatureChecker(txToIn, nInIn), pbatch(pbatchIn) {}
+
+    bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+};
+
+//! Add signatures nBegin up to nEnd of a batch that was verified to the cache.
+void CacheSignatures(const CSignatureBatch& batch, size_t nBegin, size_t nEnd);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
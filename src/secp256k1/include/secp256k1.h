@@ -79,6 +79,28 @@ SECP256K1_WARN_UNUSED_RESULT int secp256k1_ecdsa_verify(
   int pubkeylen
 ) SECP256K1_ARG_NONNULL(1) SECP256K1_ARG_NONNULL(3) SECP256K1_ARG_NONNULL(5);
 
+/** Verify a batch of ECDSA signatures.
+ *  Returns: 1: all signatures are correct
+ *           0: at least one signature or public key is incorrect or invalid
+ *              (verify them one by one to find which)
+ * In:       n:          the number of signatures (0 is allowed)
+ *           msgs32:     the 32-byte messages being verified (cannot be NULL)
+ *           sigs:       the signatures being verified (cannot be NULL)
+ *           siglens:    the lengths of the signatures
+ *           pubkeys:    the public keys to verify with (cannot be NULL)
+ *           pubkeylens: the lengths of the public keys
+ * Faster than verifying the signatures one by one, as some of the work is
+ * shared by the batch. Requires starting using SECP256K1_START_VERIFY.
+ */
+SECP256K1_WARN_UNUSED_RESULT int secp256k1_ecdsa_verify_batch(
+  int n,
+  const unsigned char * const *msgs32,
+  const unsigned char * const *sigs,
+  const int *siglens,
+  const unsigned char * const *pubkeys,
+  const int *pubkeylens
+) SECP256K1_ARG_NONNULL(2) SECP256K1_ARG_NONNULL(3) SECP256K1_ARG_NONNULL(4) SECP256K1_ARG_NONNULL(5) SECP256K1_ARG_NONNULL(6);
+
 /** Create an ECDSA signature.
  *  Returns: 1: signature created
  *           0: nonce invalid, try another one
@@ -0,0 +1,54 @@
+/**********************************************************************
+ * Copyright (c) 2014 Pieter Wuille                                   *
+ * Distributed under the MIT software license, see the accompanying   *
+ * file COPYING or http://www.opensource.org/licenses/mit-license.php.*
+ **********************************************************************/
+
+#ifndef _SECP256K1_BENCH_H_
+#define _SECP256K1_BENCH_H_
+
+#include <stdio.h>
+#include <sys/time.h>
+
+static double gettimedouble(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_usec * 0.000001 + tv.tv_sec;
+}
+
+/** Print the build options that matter for speed, so the results of
+ *  differently configured builds can be compared. */
+static void print_config(void) {
+    const char *field = "unknown";
+#if defined(USE_FIELD_5X52_ASM)
+    field = "64bit_asm";
+#elif defined(USE_FIELD_5X52_INT128)
+    field = "64bit";
+#elif defined(USE_FIELD_10X26)
+    field = "32bit";
+#elif defined(USE_FIELD_GMP)
+    field = "gmp";
+#endif
+    const char *scalar = "unknown";
+#if defined(USE_SCALAR_4X64)
+    scalar = "64bit";
+#elif defined(USE_SCALAR_8X32)
+    scalar = "32bit";
+#endif
+#ifdef USE_ENDOMORPHISM
+    const char *endomorphism = "yes";
+#else
+    const char *endomorphism = "no";
+#endif
+#ifdef ECMULT_WINDOW_SIZE
+    printf("field=%s scalar=%s endomorphism=%s ecmult_window=%d\n", field, scalar, endomorphism, ECMULT_WINDOW_SIZE);
+#else
+    printf("field=%s scalar=%s endomorphism=%s ecmult_window=default\n", field, scalar, endomorphism);
+#endif
+}
+
+static void print_rate(const char *name, int count, double seconds) {
+    printf("%s: %.0f per second (%.1f us each)\n", name, count / seconds, seconds * 1000000.0 / count);
+}
+
+#endif
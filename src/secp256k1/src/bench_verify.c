@@ -9,35 +9,61 @@
 
 #include "include/secp256k1.h"
 #include "util.h"
+#include "bench.h"
+
+#define SIGS 64
+#define ROUNDS 300
 
 int main(void) {
-    secp256k1_start(SECP256K1_START_VERIFY);
-
-    unsigned char msg[32];
-    unsigned char sig[64];
-
-    for (int i = 0; i < 32; i++) msg[i] = 1 + i;
-    for (int i = 0; i < 64; i++) sig[i] = 65 + i;
-
-    unsigned char pubkey[33];
-    for (int i=0; i<1000000; i++) {
-        int pubkeylen = 33;
-        CHECK(secp256k1_ecdsa_recover_compact(msg, 32, sig, pubkey, &pubkeylen, 1, i % 2));
-        for (int j = 0; j < 32; j++) {
-            sig[j + 32] = msg[j];    /* Move former message to S. */
-            msg[j] = sig[j];         /* Move former R to message. */
-            sig[j] = pubkey[j + 1];  /* Move recovered pubkey X coordinate to R (which must be a valid X coordinate). */
+    secp256k1_start(SECP256K1_START_SIGN | SECP256K1_START_VERIFY);
+
+    unsigned char msg[SIGS][32];
+    unsigned char sig[SIGS][72];
+    unsigned char pubkey[SIGS][33];
+    const unsigned char *msgs[SIGS], *sigs[SIGS], *pubkeys[SIGS];
+    int siglen[SIGS], pubkeylen[SIGS];
+
+    for (int i = 0; i < SIGS; i++) {
+        unsigned char key[32];
+        unsigned char nonce[32];
+        for (int j = 0; j < 32; j++) msg[i][j] = 1 + i + j;
+        for (int j = 0; j < 32; j++) key[j] = 65 + i + j;
+        for (int j = 0; j < 32; j++) nonce[j] = 33 + i + j;
+        pubkeylen[i] = 33;
+        CHECK(secp256k1_ec_pubkey_create(pubkey[i], &pubkeylen[i], key, 1));
+        siglen[i] = 72;
+        CHECK(secp256k1_ecdsa_sign(msg[i], 32, sig[i], &siglen[i], key, nonce));
+        msgs[i] = msg[i];
+        sigs[i] = sig[i];
+        pubkeys[i] = pubkey[i];
+    }
+
+    print_config();
+
+    double begin = gettimedouble();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < SIGS; i++) {
+            CHECK(secp256k1_ecdsa_verify(msgs[i], 32, sigs[i], siglen[i], pubkeys[i], pubkeylen[i]) == 1);
         }
     }
+    print_rate("ecdsa_verify", ROUNDS * SIGS, gettimedouble() - begin);
+
+    begin = gettimedouble();
+    for (int r = 0; r < ROUNDS; r++) {
+        CHECK(secp256k1_ecdsa_verify_batch(SIGS, msgs, sigs, siglen, pubkeys, pubkeylen) == 1);
+    }
+    print_rate("ecdsa_verify_batch", ROUNDS * SIGS, gettimedouble() - begin);
 
-    static const unsigned char fini[33] = {
-        0x02,
-        0x52, 0x63, 0xae, 0x9a, 0x9d, 0x47, 0x1f, 0x1a,
-        0xb2, 0x36, 0x65, 0x89, 0x11, 0xe7, 0xcc, 0x86,
-        0xa3, 0xab, 0x97, 0xb6, 0xf1, 0xaf, 0xfd, 0x8f,
-        0x9b, 0x38, 0xb6, 0x18, 0x55, 0xe5, 0xc2, 0x43
-    };
-    CHECK(memcmp(fini, pubkey, 33) == 0);
+    unsigned char recpubkey[33];
+    unsigned char csig[64];
+    int recid = 0;
+    CHECK(secp256k1_ecdsa_sign_compact(msg[0], 32, csig, msg[1], msg[2], &recid));
+    begin = gettimedouble();
+    for (int r = 0; r < ROUNDS * SIGS; r++) {
+        int recpubkeylen = 33;
+        CHECK(secp256k1_ecdsa_recover_compact(msg[0], 32, csig, recpubkey, &recpubkeylen, 1, recid));
+    }
+    print_rate("ecdsa_recover_compact", ROUNDS * SIGS, gettimedouble() - begin);
 
     secp256k1_stop();
     return 0;
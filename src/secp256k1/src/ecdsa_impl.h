@@ -166,6 +166,58 @@ static int secp256k1_ecdsa_sig_verify(const secp256k1_ecdsa_sig_t *sig, const se
     return ret;
 }
 
+/** Verify n signatures at once, returning 1 only if all of them are valid.
+ *  Instead of one scalar inversion for every s and one field inversion for
+ *  every resulting point, a single inversion of each kind is shared by the
+ *  whole batch (Montgomery's trick). */
+static int secp256k1_ecdsa_sig_verify_batch(int n, const secp256k1_ecdsa_sig_t *sigs, const secp256k1_ge_t *pubkeys, const secp256k1_scalar_t *messages) {
+    VERIFY_CHECK(n <= SECP256K1_ECDSA_VERIFY_BATCH);
+    if (n <= 0)
+        return 1;
+    for (int i = 0; i < n; i++) {
+        if (secp256k1_scalar_is_zero(&sigs[i].r) || secp256k1_scalar_is_zero(&sigs[i].s))
+            return 0;
+    }
+
+    /* sn[i] = 1/s[i], from the inverse of the product of all s values. */
+    secp256k1_scalar_t sn[SECP256K1_ECDSA_VERIFY_BATCH];
+    sn[0] = sigs[0].s;
+    for (int i = 1; i < n; i++)
+        secp256k1_scalar_mul(&sn[i], &sn[i - 1], &sigs[i].s);
+    secp256k1_scalar_t u; secp256k1_scalar_inverse_var(&u, &sn[n - 1]);
+    for (int i = n - 1; i > 0; i--) {
+        secp256k1_scalar_mul(&sn[i], &sn[i - 1], &u);
+        secp256k1_scalar_mul(&u, &u, &sigs[i].s);
+    }
+    sn[0] = u;
+
+    secp256k1_gej_t pr[SECP256K1_ECDSA_VERIFY_BATCH];
+    secp256k1_fe_t z[SECP256K1_ECDSA_VERIFY_BATCH];
+    for (int i = 0; i < n; i++) {
+        secp256k1_scalar_t u1, u2;
+        secp256k1_scalar_mul(&u1, &sn[i], &messages[i]);
+        secp256k1_scalar_mul(&u2, &sn[i], &sigs[i].r);
+        secp256k1_gej_t pubkeyj; secp256k1_gej_set_ge(&pubkeyj, &pubkeys[i]);
+        secp256k1_ecmult(&pr[i], &pubkeyj, &u2, &u1);
+        if (secp256k1_gej_is_infinity(&pr[i]))
+            return 0;
+        z[i] = pr[i].z;
+    }
+
+    secp256k1_fe_t zi[SECP256K1_ECDSA_VERIFY_BATCH];
+    secp256k1_fe_inv_all_var(n, zi, z);
+    for (int i = 0; i < n; i++) {
+        secp256k1_fe_t zi2; secp256k1_fe_sqr(&zi2, &zi[i]);
+        secp256k1_fe_t xr; secp256k1_fe_mul(&xr, &pr[i].x, &zi2);
+        secp256k1_fe_normalize(&xr);
+        unsigned char xrb[32]; secp256k1_fe_get_b32(xrb, &xr);
+        secp256k1_scalar_t r2; secp256k1_scalar_set_b32(&r2, xrb, NULL);
+        if (!secp256k1_scalar_eq(&sigs[i].r, &r2))
+            return 0;
+    }
+    return 1;
+}
+
 static int secp256k1_ecdsa_sig_sign(secp256k1_ecdsa_sig_t *sig, const secp256k1_scalar_t *seckey, const secp256k1_scalar_t *message, const secp256k1_scalar_t *nonce, int *recid) {
     secp256k1_gej_t rp;
     secp256k1_ecmult_gen(&rp, nonce);
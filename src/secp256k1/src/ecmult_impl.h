@@ -15,13 +15,20 @@
 #define WINDOW_A 5
 
 /** larger numbers may result in slightly better performance, at the cost of
-    exponentially larger precomputed tables. WINDOW_G == 14 results in 640 KiB. */
-#ifdef USE_ENDOMORPHISM
+    exponentially larger precomputed tables. WINDOW_G == 14 results in 640 KiB.
+    configure sets it with --with-ecmult-window. */
+#if defined(ECMULT_WINDOW_SIZE)
+#define WINDOW_G ECMULT_WINDOW_SIZE
+#elif defined(USE_ENDOMORPHISM)
 #define WINDOW_G 14
 #else
 #define WINDOW_G 15
 #endif
 
+#if WINDOW_G < 2 || WINDOW_G > 24
+#error "Set ECMULT_WINDOW_SIZE to a value in the range [2..24]"
+#endif
+
 /** Fill a table 'pre' with precomputed odd multiples of a. W determines the size of the table.
  *  pre will contains the values [1*a,3*a,5*a,...,(2^(w-1)-1)*a], so it needs place for
  *  2^(w-2) entries.
@@ -43,13 +50,19 @@ static void secp256k1_ecmult_table_precomp_gej_var(secp256k1_gej_t *pre, const s
 
 static void secp256k1_ecmult_table_precomp_ge_var(secp256k1_ge_t *pre, const secp256k1_gej_t *a, int w) {
     const int table_size = 1 << (w-2);
-    secp256k1_gej_t prej[table_size];
+    /* Large windows make tables that do not fit on the stack, so the jacobian
+     * points go on the heap, and are converted in chunks. */
+    secp256k1_gej_t *prej = (secp256k1_gej_t*)malloc(sizeof(secp256k1_gej_t) * table_size);
     prej[0] = *a;
     secp256k1_gej_t d; secp256k1_gej_double_var(&d, a);
     for (int i=1; i<table_size; i++) {
         secp256k1_gej_add_var(&prej[i], &d, &prej[i-1]);
     }
-    secp256k1_ge_set_all_gej_var(table_size, pre, prej);
+    for (int i=0; i<table_size; i+=1024) {
+        int len = table_size - i < 1024 ? table_size - i : 1024;
+        secp256k1_ge_set_all_gej_var(len, &pre[i], &prej[i]);
+    }
+    free(prej);
 }
 
 /** The number of entries a table with precomputed multiples needs to have. */
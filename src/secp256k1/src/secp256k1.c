@@ -72,6 +72,35 @@ end:
     return ret;
 }
 
+int secp256k1_ecdsa_verify_batch(int n, const unsigned char * const *msgs32, const unsigned char * const *sigs, const int *siglens, const unsigned char * const *pubkeys, const int *pubkeylens) {
+    DEBUG_CHECK(secp256k1_ecmult_consts != NULL);
+    DEBUG_CHECK(msgs32 != NULL);
+    DEBUG_CHECK(sigs != NULL);
+    DEBUG_CHECK(siglens != NULL);
+    DEBUG_CHECK(pubkeys != NULL);
+    DEBUG_CHECK(pubkeylens != NULL);
+
+    secp256k1_scalar_t m[SECP256K1_ECDSA_VERIFY_BATCH];
+    secp256k1_ecdsa_sig_t s[SECP256K1_ECDSA_VERIFY_BATCH];
+    secp256k1_ge_t q[SECP256K1_ECDSA_VERIFY_BATCH];
+    for (int i = 0; i < n; i += SECP256K1_ECDSA_VERIFY_BATCH) {
+        int nChunk = n - i < SECP256K1_ECDSA_VERIFY_BATCH ? n - i : SECP256K1_ECDSA_VERIFY_BATCH;
+        for (int j = 0; j < nChunk; j++) {
+            DEBUG_CHECK(msgs32[i + j] != NULL);
+            DEBUG_CHECK(sigs[i + j] != NULL);
+            DEBUG_CHECK(pubkeys[i + j] != NULL);
+            secp256k1_scalar_set_b32(&m[j], msgs32[i + j], NULL);
+            if (!secp256k1_eckey_pubkey_parse(&q[j], pubkeys[i + j], pubkeylens[i + j]))
+                return 0;
+            if (!secp256k1_ecdsa_sig_parse(&s[j], sigs[i + j], siglens[i + j]))
+                return 0;
+        }
+        if (!secp256k1_ecdsa_sig_verify_batch(nChunk, s, q, m))
+            return 0;
+    }
+    return 1;
+}
+
 int secp256k1_ecdsa_sign(const unsigned char *message, int messagelen, unsigned char *signature, int *signaturelen, const unsigned char *seckey, const unsigned char *nonce) {
     DEBUG_CHECK(secp256k1_ecmult_gen_consts != NULL);
     DEBUG_CHECK(message != NULL);
@@ -879,6 +879,61 @@ void run_ecdsa_sign_verify(void) {
     }
 }
 
+void test_ecdsa_verify_batch(void) {
+    /* More than one internal batch, so the chunking is covered as well. */
+    const int n = SECP256K1_ECDSA_VERIFY_BATCH + 6;
+    unsigned char msg[SECP256K1_ECDSA_VERIFY_BATCH + 6][32];
+    unsigned char sig[SECP256K1_ECDSA_VERIFY_BATCH + 6][72];
+    unsigned char pub[SECP256K1_ECDSA_VERIFY_BATCH + 6][65];
+    const unsigned char *msgs[SECP256K1_ECDSA_VERIFY_BATCH + 6], *sigs[SECP256K1_ECDSA_VERIFY_BATCH + 6], *pubs[SECP256K1_ECDSA_VERIFY_BATCH + 6];
+    int siglens[SECP256K1_ECDSA_VERIFY_BATCH + 6], publens[SECP256K1_ECDSA_VERIFY_BATCH + 6];
+    for (int i = 0; i < n; i++) {
+        secp256k1_scalar_t m, key;
+        random_scalar_order_test(&m);
+        random_scalar_order_test(&key);
+        secp256k1_scalar_get_b32(msg[i], &m);
+        unsigned char privkey[32];
+        secp256k1_scalar_get_b32(privkey, &key);
+        publens[i] = 65;
+        CHECK(secp256k1_ec_pubkey_create(pub[i], &publens[i], privkey, secp256k1_rand32() % 2) == 1);
+        siglens[i] = 72;
+        while (1) {
+            unsigned char rnd[32];
+            secp256k1_rand256_test(rnd);
+            if (secp256k1_ecdsa_sign(msg[i], 32, sig[i], &siglens[i], privkey, rnd) == 1)
+                break;
+        }
+        msgs[i] = msg[i];
+        sigs[i] = sig[i];
+        pubs[i] = pub[i];
+    }
+    CHECK(secp256k1_ecdsa_verify_batch(n, msgs, sigs, siglens, pubs, publens) == 1);
+    CHECK(secp256k1_ecdsa_verify_batch(1, msgs, sigs, siglens, pubs, publens) == 1);
+    CHECK(secp256k1_ecdsa_verify_batch(0, msgs, sigs, siglens, pubs, publens) == 1);
+
+    /* A single wrong message fails the batch. */
+    int bad = secp256k1_rand32() % n;
+    msg[bad][secp256k1_rand32() % 32] ^= 1 << (secp256k1_rand32() % 8);
+    CHECK(secp256k1_ecdsa_verify_batch(n, msgs, sigs, siglens, pubs, publens) == 0);
+    CHECK(secp256k1_ecdsa_verify(msgs[bad], 32, sigs[bad], siglens[bad], pubs[bad], publens[bad]) == 0);
+    memcpy(msg[bad], msg[(bad + 1) % n], 32);
+    memcpy(sig[bad], sig[(bad + 1) % n], 72);
+    siglens[bad] = siglens[(bad + 1) % n];
+    memcpy(pub[bad], pub[(bad + 1) % n], 65);
+    publens[bad] = publens[(bad + 1) % n];
+    CHECK(secp256k1_ecdsa_verify_batch(n, msgs, sigs, siglens, pubs, publens) == 1);
+
+    /* So does an invalid public key. */
+    pub[bad][0] = 0x05;
+    CHECK(secp256k1_ecdsa_verify_batch(n, msgs, sigs, siglens, pubs, publens) == 0);
+}
+
+void run_ecdsa_verify_batch(void) {
+    for (int i=0; i<count; i++) {
+        test_ecdsa_verify_batch();
+    }
+}
+
 void test_ecdsa_end_to_end(void) {
     unsigned char privkey[32];
     unsigned char message[32];
@@ -1202,6 +1257,7 @@ int main(int argc, char **argv) {
     /* ecdsa tests */
     run_ecdsa_sign_verify();
     run_ecdsa_end_to_end();
+    run_ecdsa_verify_batch();
     run_ecdsa_edge_cases();
 #ifdef ENABLE_OPENSSL_TESTS
     run_ecdsa_openssl();
@@ -6,6 +6,9 @@
 
 #include "allocators.h"
 
+#include <list>
+#include <vector>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_AUTO_TEST_SUITE(allocator_tests)
@@ -116,4 +119,60 @@ BOOST_AUTO_TEST_CASE(test_LockedPageManagerBase)
     BOOST_CHECK((last_unlock_len & (test_page_size-1)) == 0); // always unlock entire pages
 }
 
+BOOST_AUTO_TEST_CASE(test_CPoolArena)
+{
+    CPoolArena arena;
+    BOOST_CHECK(arena.Allocate(CPoolArena::MAX_OBJECT_SIZE + 1) == NULL);
+
+    // Freed slots are reused for objects of the same size class
+    void* p1 = arena.Allocate(40);
+    void* p2 = arena.Allocate(48);
+    BOOST_CHECK(p1 != NULL && p2 != NULL && p1 != p2);
+    BOOST_CHECK_EQUAL((size_t)p1 % CPoolArena::ALIGNMENT, 0U);
+    BOOST_CHECK_EQUAL(arena.GetObjectCount(), 2U);
+    BOOST_CHECK_EQUAL(arena.DynamicMemoryUsage(), CPoolArena::CHUNK_MIN_SIZE);
+    arena.Deallocate(p1, 40);
+    BOOST_CHECK(arena.Allocate(33) == p1);
+
+    // Nothing is released while objects are alive
+    std::vector<void*> vp;
+    for (int i = 0; i < 10000; i++)
+        vp.push_back(arena.Allocate(100));
+    size_t nUsage = arena.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage >= 10000 * 112);
+    BOOST_CHECK(nUsage < 10000 * 112 * 2 + CPoolArena::CHUNK_MAX_SIZE);
+    arena.Release();
+    BOOST_CHECK_EQUAL(arena.DynamicMemoryUsage(), nUsage);
+
+    for (std::vector<void*>::iterator it = vp.begin(); it != vp.end(); ++it)
+        arena.Deallocate(*it, 100);
+    arena.Deallocate(p1, 33);
+    arena.Deallocate(p2, 48);
+    BOOST_CHECK_EQUAL(arena.GetObjectCount(), 0U);
+    arena.Release();
+    BOOST_CHECK_EQUAL(arena.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_pooled_allocator)
+{
+    CPoolArena arena;
+    {
+        std::list<int, pooled_allocator<int> > l((pooled_allocator<int>(&arena)));
+        for (int i = 0; i < 1000; i++)
+            l.push_back(i);
+        BOOST_CHECK_EQUAL(arena.GetObjectCount(), 1000U);
+
+        // Arrays too large for the arena come from the heap
+        std::vector<int, pooled_allocator<int> > v((pooled_allocator<int>(&arena)));
+        v.resize(1000);
+        BOOST_CHECK_EQUAL(arena.GetObjectCount(), 1000U);
+    }
+    BOOST_CHECK_EQUAL(arena.GetObjectCount(), 0U);
+
+    // Without an arena it is a plain heap allocator
+    std::list<int, pooled_allocator<int> > l;
+    l.push_back(1);
+    BOOST_CHECK_EQUAL(arena.GetObjectCount(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
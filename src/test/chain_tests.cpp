@@ -0,0 +1,296 @@
+// Copyright (c) 2025 The Worldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "checkqueue.h"
+#include "clientversion.h"
+#include "main.h"
+#include "pow.h"
+#include "random.h"
+#include "streams.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(chain_tests)
+
+static CDiskBlockIndex MakeDiskIndex()
+{
+    CDiskBlockIndex index;
+    index.nHeight = 1234;
+    index.nStatus = BLOCK_VALID_TREE;
+    index.nVersion = 4;
+    index.hashPrev = uint256("0x0000000000000000000000000000000000000000000000000000000000001234");
+    index.hashMerkleRoot = uint256("0x00000000000000000000000000000000000000000000000000000000deadbeef");
+    index.nTime = 1700000000;
+    index.nBits = 0x1e0ffff0;
+    index.nNonce = 42;
+    return index;
+}
+
+BOOST_AUTO_TEST_CASE(diskblockindex_powhash)
+{
+    uint256 hashPoW("0x000001c4a8b75e1a9bd7bfc3b13f6d7c2e1a7a8bdf6f0bc8a3c0e6a5d4b3a291");
+
+    // Entries without a stored PoW hash keep the old layout
+    CDiskBlockIndex legacy = MakeDiskIndex();
+    CDataStream ssLegacy(SER_DISK, CLIENT_VERSION);
+    ssLegacy << legacy;
+
+    CDiskBlockIndex index = MakeDiskIndex();
+    index.SetPoWHash(hashPoW);
+    BOOST_CHECK(index.nStatus & BLOCK_HAVE_POWHASH);
+    BOOST_CHECK(index.GetBlockPoWHash() == hashPoW);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << index;
+    BOOST_CHECK(ss.size() > ssLegacy.size());
+
+    CDiskBlockIndex loaded;
+    ss >> loaded;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(loaded.nStatus & BLOCK_HAVE_POWHASH);
+    BOOST_CHECK(loaded.hashPoW == hashPoW);
+    BOOST_CHECK(loaded.GetBlockHash() == index.GetBlockHash());
+
+    CDiskBlockIndex loadedLegacy;
+    ssLegacy >> loadedLegacy;
+    BOOST_CHECK(ssLegacy.empty());
+    BOOST_CHECK(!(loadedLegacy.nStatus & BLOCK_HAVE_POWHASH));
+    BOOST_CHECK(loadedLegacy.hashPoW == 0);
+    BOOST_CHECK(loadedLegacy.GetBlockHash() == legacy.GetBlockHash());
+}
+
+/** Find a nonce for header meeting its nBits, giving up after a bounded number of tries */
+static bool FindPoW(CBlockHeader& header, uint256& hashPoW)
+{
+    for (int i = 0; i < 1000; i++) {
+        header.nNonce++;
+        hashPoW = header.GetPoWHash();
+        if (CheckProofOfWork(hashPoW, header.nBits))
+            return true;
+    }
+    return false;
+}
+
+/** Write one block index entry with the given stored PoW hash and load it back */
+static bool LoadPoWHash(const CBlockHeader& header, const uint256& hashPoW, unsigned int nPoWCheckSample)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CBlockIndex index(header);
+    index.nStatus = BLOCK_VALID_TREE;
+    index.SetPoWHash(hashPoW);
+    BOOST_REQUIRE(db.WriteBlockIndex(CDiskBlockIndex(&index)));
+
+    LOCK(cs_main);
+    bool fLoaded = db.LoadBlockIndexGuts(nPoWCheckSample);
+    BlockMap::iterator mi = mapBlockIndex.find(header.GetHash());
+    BOOST_REQUIRE(mi != mapBlockIndex.end());
+    if (fLoaded) {
+        BOOST_CHECK(mi->second->nStatus & BLOCK_HAVE_POWHASH);
+        BOOST_CHECK(mi->second->hashPoW == hashPoW);
+    }
+    delete mi->second;
+    mapBlockIndex.erase(mi);
+    return fLoaded;
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_load_powhash)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    header.hashPrevBlock = 0;
+    header.nBits = 0x207fffff; // regtest limit, about every other nonce is valid
+    uint256 hashPoW;
+    BOOST_REQUIRE(FindPoW(header, hashPoW));
+
+    // The right hash loads, whether or not it is recomputed
+    BOOST_CHECK(LoadPoWHash(header, hashPoW, 1));
+    BOOST_CHECK(LoadPoWHash(header, hashPoW, 0));
+
+    // A hash that does not meet nBits is always rejected
+    BOOST_CHECK(!LoadPoWHash(header, ~uint256(0), 0));
+
+    // A hash that meets nBits but belongs to another header is trusted from
+    // disk unless it is recomputed
+    uint256 hashOther = 1;
+    BOOST_CHECK(LoadPoWHash(header, hashOther, 0));
+    BOOST_CHECK(!LoadPoWHash(header, hashOther, 1));
+
+    SelectParams(CBaseChainParams::UNITTEST);
+}
+
+BOOST_AUTO_TEST_CASE(powcheck_closure)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+
+    CBlockHeader genesis = Params().GenesisBlock().GetBlockHeader();
+    uint256 hashPoW;
+    CPoWCheck check(genesis, &hashPoW);
+    BOOST_CHECK(check());
+    BOOST_CHECK(hashPoW == genesis.GetPoWHash());
+
+    // A zero target can never be met, but the hash is still reported
+    CBlockHeader header = genesis;
+    header.nBits = 0;
+    uint256 hashBad;
+    CPoWCheck bad(header, &hashBad);
+    BOOST_CHECK(!bad());
+    BOOST_CHECK(hashBad == header.GetPoWHash());
+
+    // Hashes computed on a check queue land in the right slots
+    std::vector<CBlockHeader> headers;
+    std::vector<uint256> vExpected;
+    header = genesis;
+    header.nBits = 0x207fffff; // regtest limit, about every other nonce is valid
+    while (headers.size() < 4) {
+        uint256 hash;
+        BOOST_REQUIRE(FindPoW(header, hash));
+        headers.push_back(header);
+        vExpected.push_back(hash);
+    }
+    CCheckQueue<CPoWCheck> queue(1);
+    std::vector<uint256> vHashPoW(headers.size());
+    std::vector<CPoWCheck> vChecks;
+    for (unsigned int i = 0; i < headers.size(); i++)
+        vChecks.push_back(CPoWCheck(headers[i], &vHashPoW[i]));
+    {
+        CCheckQueueControl<CPoWCheck> control(&queue);
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+    }
+    BOOST_CHECK(vHashPoW == vExpected);
+
+    // One invalid header fails the whole batch
+    headers[1].nBits = 0;
+    vHashPoW.assign(headers.size(), uint256(0));
+    vChecks.clear();
+    for (unsigned int i = 0; i < headers.size(); i++)
+        vChecks.push_back(CPoWCheck(headers[i], &vHashPoW[i]));
+    {
+        CCheckQueueControl<CPoWCheck> control(&queue);
+        control.Add(vChecks);
+        BOOST_CHECK(!control.Wait());
+    }
+
+    SelectParams(CBaseChainParams::UNITTEST);
+}
+
+BOOST_AUTO_TEST_CASE(checkblockheader_given_powhash)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    header.nBits = 0x207fffff;
+    uint256 hashPoW;
+    BOOST_REQUIRE(FindPoW(header, hashPoW));
+    CValidationState state;
+    BOOST_CHECK(CheckBlockHeader(header, state));
+    BOOST_CHECK(CheckBlockHeader(header, state, true, &hashPoW));
+
+    // The given hash is checked instead of the header's own
+    uint256 hashBad = ~uint256(0);
+    BOOST_CHECK(!CheckBlockHeader(header, state, true, &hashBad));
+    BOOST_CHECK(state.GetRejectReason() == "high-hash");
+
+    SelectParams(CBaseChainParams::UNITTEST);
+}
+
+BOOST_AUTO_TEST_CASE(permitted_difficulty_transition)
+{
+    SelectParams(CBaseChainParams::MAIN);
+
+    unsigned int nBits = 0x1c0ffff0;
+    uint256 bnTarget;
+    bnTarget.SetCompact(nBits);
+    int64_t nRetarget = 10 * Params().Interval();
+
+    // Between retargets the target stays the same
+    BOOST_CHECK(PermittedDifficultyTransition(nRetarget + 1, nBits, nBits));
+    BOOST_CHECK(!PermittedDifficultyTransition(nRetarget + 1, nBits, uint256(bnTarget * 2).GetCompact()));
+    BOOST_CHECK(!PermittedDifficultyTransition(nRetarget + 1, nBits, uint256(bnTarget / 2).GetCompact()));
+
+    // A retarget makes it at most four times easier, up to the limit; a harder
+    // target only costs the sender
+    BOOST_CHECK(PermittedDifficultyTransition(nRetarget, nBits, uint256(bnTarget * 4).GetCompact()));
+    BOOST_CHECK(PermittedDifficultyTransition(nRetarget, nBits, uint256(bnTarget / 4).GetCompact()));
+    BOOST_CHECK(!PermittedDifficultyTransition(nRetarget, nBits, uint256(bnTarget * 5).GetCompact()));
+    BOOST_CHECK(!PermittedDifficultyTransition(nRetarget, nBits, uint256(Params().ProofOfWorkLimit() * 2).GetCompact()));
+    unsigned int nBitsLimit = Params().ProofOfWorkLimit().GetCompact();
+    BOOST_CHECK(PermittedDifficultyTransition(nRetarget, nBitsLimit, nBitsLimit));
+
+    // From nDiffChangeTarget on, retargets follow the new interval
+    int64_t nHeight = nDiffChangeTarget;
+    while (nHeight % Params().Interval() != 0 || nHeight % Params().Interval2() == 0)
+        nHeight++;
+    BOOST_CHECK(!PermittedDifficultyTransition(nHeight, nBits, uint256(bnTarget * 2).GetCompact()));
+    while (nHeight % Params().Interval2() != 0)
+        nHeight++;
+    BOOST_CHECK(PermittedDifficultyTransition(nHeight, nBits, uint256(bnTarget * 2).GetCompact()));
+
+    // Networks with min-difficulty blocks are not checked
+    SelectParams(CBaseChainParams::TESTNET);
+    BOOST_CHECK(PermittedDifficultyTransition(nRetarget + 1, nBits, nBitsLimit));
+
+    SelectParams(CBaseChainParams::UNITTEST);
+}
+
+BOOST_AUTO_TEST_CASE(verifydb_snapshot_floor)
+{
+    // A stored, valid block on top of genesis, without undo data like any
+    // block a snapshot is loaded for
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+    BOOST_REQUIRE(pindexGenesis && chainActive.Height() == 0);
+    uint256 hashSnapshot = GetRandHash();
+    CBlockIndex* pindex = new CBlockIndex();
+    pindex->pprev = pindexGenesis;
+    pindex->nHeight = 1;
+    pindex->nTx = 1;
+    pindex->nChainTx = pindexGenesis->nChainTx + 1;
+    pindex->nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA;
+    {
+        LOCK(cs_main);
+        pindex->phashBlock = &mapBlockIndex.insert(std::make_pair(hashSnapshot, pindex)).first->first;
+    }
+
+    uint256 txid = GetRandHash();
+    pcoinsTip->ModifyCoins(txid)->vout.push_back(CTxOut(1, CScript() << OP_TRUE));
+    pcoinsTip->SetBestBlock(hashSnapshot);
+    BOOST_CHECK(pcoinsTip->Flush());
+    boost::filesystem::path path = GetDataDir() / "snapshot.dat";
+    CCoinsStats statsDump;
+    {
+        CAutoFile file(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(pcoinsdbview->DumpSnapshot(file, statsDump));
+    }
+    pcoinsTip->SetBestBlock(pindexGenesis->GetBlockHash());
+    BOOST_CHECK(pcoinsTip->Flush());
+
+    CCoinsStats stats;
+    BOOST_CHECK(LoadTxOutSet(path, statsDump.hashSerialized, stats));
+    BOOST_CHECK(chainActive.Tip() == pindex);
+
+    // A restart verifies the chainstate at the default level and depth; the
+    // snapshot block has no undo data and is not disconnected
+    BOOST_CHECK(CVerifyDB().VerifyDB(pcoinsdbview, 3, 288));
+
+    // Back to the genesis chainstate
+    pcoinsTip->ModifyCoins(txid)->Clear();
+    pcoinsTip->SetBestBlock(pindexGenesis->GetBlockHash());
+    BOOST_CHECK(pcoinsTip->Flush());
+    {
+        LOCK(cs_main);
+        pindexBestHeader = NULL;
+        UnloadBlockIndex();
+        BOOST_CHECK(LoadBlockIndex());
+    }
+    BOOST_CHECK_EQUAL(chainActive.Height(), 0);
+    delete pindex;
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
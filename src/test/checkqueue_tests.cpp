@@ -0,0 +1,259 @@
+// Copyright (c) 2025 The Worldcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+
+#include "key.h"
+#include "keystore.h"
+#include "main.h"
+#include "random.h"
+#include "script/sign.h"
+#include "script/standard.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+/** Check that counts how often it ran, and fails if asked to */
+struct CCountingCheck
+{
+    std::vector<unsigned int>* pvRuns;
+    unsigned int n;
+    bool fResult;
+
+    CCountingCheck() : pvRuns(NULL), n(0), fResult(true) {}
+    CCountingCheck(std::vector<unsigned int>* pvRunsIn, unsigned int nIn, bool fResultIn = true) : pvRuns(pvRunsIn), n(nIn), fResult(fResultIn) {}
+
+    bool operator()()
+    {
+        // Every check has its own element, so no locking is needed
+        (*pvRuns)[n]++;
+        return fResult;
+    }
+
+    void swap(CCountingCheck& check)
+    {
+        std::swap(pvRuns, check.pvRuns);
+        std::swap(n, check.n);
+        std::swap(fResult, check.fResult);
+    }
+};
+
+/** Run nBatches batches of checks through a queue with nThreads workers, the master included */
+static void RunChecks(int nThreads, unsigned int nBatches)
+{
+    CCheckQueue<CCountingCheck> queue(16);
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<CCountingCheck>::Thread, &queue));
+
+    // The queue is reused, as for consecutive blocks
+    for (int nRound = 0; nRound < 3; nRound++) {
+        std::vector<unsigned int> vRuns(nBatches * (nBatches + 1) / 2);
+        unsigned int n = 0;
+        {
+            CCheckQueueControl<CCountingCheck> control(&queue);
+            for (unsigned int i = 1; i <= nBatches; i++) {
+                std::vector<CCountingCheck> vChecks;
+                for (unsigned int j = 0; j < i; j++)
+                    vChecks.push_back(CCountingCheck(&vRuns, n++));
+                control.Add(vChecks);
+            }
+            BOOST_CHECK(control.Wait());
+        }
+        // Every check ran exactly once
+        for (unsigned int i = 0; i < vRuns.size(); i++)
+            BOOST_CHECK_EQUAL(vRuns[i], 1U);
+        BOOST_CHECK(queue.IsIdle());
+
+        // One failing check fails the whole batch and is handed back, and the
+        // queue recovers afterwards
+        std::vector<unsigned int> vRunsFail(100);
+        {
+            CCheckQueueControl<CCountingCheck> control(&queue);
+            std::vector<CCountingCheck> vChecks;
+            for (unsigned int i = 0; i < vRunsFail.size(); i++)
+                vChecks.push_back(CCountingCheck(&vRunsFail, i, i != 57));
+            control.Add(vChecks);
+            CCountingCheck checkFailed;
+            BOOST_CHECK(!control.Wait(&checkFailed));
+            BOOST_CHECK_EQUAL(checkFailed.n, 57U);
+            BOOST_CHECK(!checkFailed.fResult);
+        }
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_checks_run)
+{
+    RunChecks(1, 50);
+    RunChecks(2, 50);
+    RunChecks(4, 100);
+    RunChecks(16, 100);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_empty)
+{
+    CCheckQueue<CCountingCheck> queue(16);
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<CCountingCheck>::Thread, &queue));
+    {
+        CCheckQueueControl<CCountingCheck> control(&queue);
+        std::vector<CCountingCheck> vChecks;
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+    }
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+/** Run one round of checks through a queue as its master, failing check nFail if it is in range */
+static void RunRound(CCheckQueue<CCountingCheck>* pqueue, std::vector<unsigned int>* pvRuns, unsigned int nFail, bool* pfOk)
+{
+    CCheckQueueControl<CCountingCheck> control(pqueue);
+    for (unsigned int i = 0; i < pvRuns->size(); i += 10) {
+        std::vector<CCountingCheck> vChecks;
+        for (unsigned int j = i; j < std::min(i + 10, (unsigned int)pvRuns->size()); j++)
+            vChecks.push_back(CCountingCheck(pvRuns, j, j != nFail));
+        control.Add(vChecks);
+    }
+    *pfOk = control.Wait();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_shared_workers)
+{
+    // Two queues, each with a master of its own, helped by the same threads
+    CCheckQueueWorkers workers;
+    CCheckQueue<CCountingCheck> queueA(16, &workers);
+    CCheckQueue<CCountingCheck> queueB(4, &workers);
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(boost::bind(&CCheckQueueWorkers::Thread, &workers));
+
+    for (unsigned int nRound = 0; nRound < 10; nRound++) {
+        std::vector<unsigned int> vRunsA(1000), vRunsB(300);
+        bool fOkA = false, fOkB = false;
+        // Every other round, queue B has a failing check that must not affect queue A
+        unsigned int nFailB = nRound % 2 ? 123 : vRunsB.size();
+        boost::thread threadB(boost::bind(&RunRound, &queueB, &vRunsB, nFailB, &fOkB));
+        RunRound(&queueA, &vRunsA, vRunsA.size(), &fOkA);
+        threadB.join();
+
+        BOOST_CHECK(fOkA);
+        BOOST_CHECK_EQUAL(fOkB, nRound % 2 == 0);
+        for (unsigned int i = 0; i < vRunsA.size(); i++)
+            BOOST_CHECK_EQUAL(vRunsA[i], 1U);
+        // After a failure, the rest may be skipped
+        for (unsigned int i = 0; i < vRunsB.size(); i++)
+            BOOST_CHECK(vRunsB[i] == 1U || (nRound % 2 && vRunsB[i] == 0));
+        BOOST_CHECK(queueA.IsIdle());
+        BOOST_CHECK(queueB.IsIdle());
+    }
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_script_batch)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+
+    // The second output is spent by an invalid signature: a script that
+    // assumes it valid fails, so the batch has to fall back to checking them
+    // one by one.
+    CMutableTransaction txFrom;
+    txFrom.vout.resize(2);
+    txFrom.vout[0].scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    txFrom.vout[1].scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG << OP_NOT;
+    txFrom.vout[0].nValue = txFrom.vout[1].nValue = COIN;
+    CCoins coins(txFrom, 0);
+
+    CMutableTransaction txTo;
+    txTo.vin.resize(2);
+    txTo.vout.resize(1);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        txTo.vin[i].prevout = COutPoint(txFrom.GetHash(), i);
+    BOOST_REQUIRE(SignSignature(keystore, txFrom, txTo, 0));
+    std::vector<unsigned char> vchSig;
+    BOOST_REQUIRE(key.Sign(GetRandHash(), vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    txTo.vin[1].scriptSig = CScript() << vchSig;
+
+    CTransaction tx(txTo);
+    std::vector<CScriptCheck> vChecks;
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+        vChecks.push_back(CScriptCheck(coins, tx, i, SCRIPT_VERIFY_P2SH, false));
+    BOOST_CHECK(CheckAll(vChecks));
+
+    // The same signature on the first output fails the batch for real
+    txTo.vin[0].scriptSig = txTo.vin[1].scriptSig;
+    CTransaction txBad(txTo);
+    vChecks.clear();
+    for (unsigned int i = 0; i < txBad.vin.size(); i++)
+        vChecks.push_back(CScriptCheck(coins, txBad, i, SCRIPT_VERIFY_P2SH, false));
+    std::vector<CScriptCheck> vFirst(1, vChecks[0]), vSecond(1, vChecks[1]);
+    BOOST_CHECK(!CheckAll(vChecks));
+    BOOST_CHECK(!CheckAll(vFirst));
+    BOOST_CHECK(CheckAll(vSecond));
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_script_batch_multisig)
+{
+    // A 2-of-3 multisig signed by the first and the last key, so that
+    // CHECKMULTISIG tries a signature against the middle key on the way
+    CKey key[3];
+    std::vector<CPubKey> vPubKeys;
+    CBasicKeyStore keystore;
+    for (unsigned int i = 0; i < 3; i++) {
+        key[i].MakeNewKey(true);
+        vPubKeys.push_back(key[i].GetPubKey());
+        if (i != 1)
+            keystore.AddKey(key[i]);
+    }
+    CScript scriptMultisig = GetScriptForMultisig(2, vPubKeys);
+    keystore.AddCScript(scriptMultisig);
+
+    CMutableTransaction txFrom;
+    txFrom.vout.resize(2);
+    txFrom.vout[0].scriptPubKey = scriptMultisig;
+    txFrom.vout[1].scriptPubKey = GetScriptForDestination(CScriptID(scriptMultisig));
+    txFrom.vout[0].nValue = txFrom.vout[1].nValue = COIN;
+    CCoins coins(txFrom, 0);
+
+    CMutableTransaction txTo;
+    txTo.vin.resize(2);
+    txTo.vout.resize(1);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        txTo.vin[i].prevout = COutPoint(txFrom.GetHash(), i);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+        BOOST_REQUIRE(SignSignature(keystore, txFrom, txTo, i));
+
+    // Both the bare and the P2SH spend pass the batched run, and the batch
+    // holds no signature paired with a key it does not belong to, so it
+    // verifies without falling back to the checks one by one
+    CTransaction tx(txTo);
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        CSignatureBatch batch;
+        CScriptCheck check(coins, tx, i, SCRIPT_VERIFY_P2SH, false);
+        BOOST_CHECK(check.VerifyBatched(batch));
+        BOOST_CHECK(batch.Verify());
+    }
+    std::vector<CScriptCheck> vChecks;
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+        vChecks.push_back(CScriptCheck(coins, tx, i, SCRIPT_VERIFY_P2SH, false));
+    BOOST_CHECK(CheckAll(vChecks));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,11 +4,13 @@
 
 #include "coins.h"
 #include "random.h"
+#include "txdb.h"
 #include "uint256.h"
 
 #include <vector>
 #include <map>
 
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
 
 namespace
@@ -58,6 +60,40 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    //! Check the incrementally maintained memory usage against a recount
+    void SelfTest() const
+    {
+        size_t ret = 0;
+        for (CCoinsMap::const_iterator it = cacheCoins.begin(); it != cacheCoins.end(); ++it)
+            ret += it->second.coins.DynamicMemoryUsage();
+        BOOST_CHECK_EQUAL(cachedCoinsUsage, ret);
+        BOOST_CHECK(arena.GetObjectCount() >= cacheCoins.size());
+        BOOST_CHECK(DynamicMemoryUsage() >= ret + arena.GetObjectCount() * sizeof(CCoinsMap::value_type));
+    }
+};
+
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    //! Store a record in the per-transaction layout used before the upgrade
+    void WriteLegacyCoins(const uint256& txid, const CCoins& coins)
+    {
+        db.Write(std::make_pair('c', txid), coins);
+    }
+
+    bool HaveLegacyCoins(const uint256& txid)
+    {
+        return db.Exists(std::make_pair('c', txid));
+    }
+};
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -89,8 +125,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -135,6 +171,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            for (std::vector<CCoinsViewCacheTest*>::const_iterator it = stack.begin(); it != stack.end(); ++it)
+                (*it)->SelfTest();
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -151,7 +189,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -175,4 +213,452 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+BOOST_AUTO_TEST_CASE(coins_partial_flush_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    std::vector<uint256> txids;
+    for (unsigned int i = 0; i < 1000; i++) {
+        txids.push_back(GetRandHash());
+        CCoinsModifier coins = cache.ModifyCoins(txids.back());
+        coins->vout.resize(1);
+        coins->vout[0].nValue = i;
+        coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+    }
+    // Spend one entirely, and touch the first ones again so they are the hottest
+    cache.ModifyCoins(txids[999])->Clear();
+    for (unsigned int i = 0; i < 100; i++)
+        BOOST_CHECK(cache.AccessCoins(txids[i]));
+    size_t nUsage = cache.DynamicMemoryUsage();
+
+    BOOST_CHECK(cache.PartialFlush(nUsage / 4));
+    cache.SelfTest();
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nUsage / 4);
+    BOOST_CHECK(cache.GetCacheSize() >= 100);
+    BOOST_CHECK(cache.GetCacheSize() < 999);
+
+    // Every change reached the base, and the hot entries are still cached
+    for (unsigned int i = 0; i < 999; i++) {
+        CCoins coins;
+        BOOST_CHECK(base.GetCoins(txids[i], coins));
+        BOOST_CHECK_EQUAL(coins.vout[0].nValue, i);
+    }
+    CCoins coins;
+    BOOST_CHECK(!base.GetCoins(txids[999], coins) || coins.IsPruned());
+
+    // A full budget keeps everything that is left
+    size_t nSize = cache.GetCacheSize();
+    BOOST_CHECK(cache.PartialFlush(nUsage));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), nSize);
+    cache.SelfTest();
+}
+
+static bool PreCommit(bool fResult, int* pnCalls)
+{
+    (*pnCalls)++;
+    return fResult;
+}
+
+BOOST_AUTO_TEST_CASE(coins_warm_test)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+
+    uint256 txid = GetRandHash();
+    cache.ModifyCoins(txid)->vout.push_back(CTxOut(1, CScript() << OP_TRUE));
+    BOOST_CHECK(cache.HaveCoinsInCache(txid));
+    BOOST_CHECK_EQUAL(cache.GetFlushCount(), 0U);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetFlushCount(), 1U);
+    BOOST_CHECK(!cache.HaveCoinsInCache(txid));
+
+    // Coins read from the base directly end up in the cache, clean
+    CCoins coins;
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    BOOST_CHECK(cache.WarmCoins(txid, coins));
+    BOOST_CHECK(cache.HaveCoinsInCache(txid));
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txid)->vout[0].nValue, 1);
+
+    // An entry that is already cached is newer, and is kept
+    cache.ModifyCoins(txid)->vout[0].nValue = 2;
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    BOOST_CHECK(!cache.WarmCoins(txid, coins));
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txid)->vout[0].nValue, 2);
+    BOOST_CHECK(cache.PartialFlush(0));
+    BOOST_CHECK_EQUAL(cache.GetFlushCount(), 2U);
+    BOOST_CHECK(base.GetCoins(txid, coins));
+    BOOST_CHECK_EQUAL(coins.vout[0].nValue, 2);
+}
+
+BOOST_AUTO_TEST_CASE(coins_async_writer_test)
+{
+    CCoinsViewDBTest db;
+    CCoinsViewAsyncWriter writer(&db);
+    uint256 hashBlock = GetRandHash();
+
+    std::vector<uint256> txids;
+    int nCalls = 0;
+    {
+        CCoinsViewCache cache(&writer);
+        for (unsigned int i = 0; i < 100; i++) {
+            txids.push_back(GetRandHash());
+            CCoinsModifier coins = cache.ModifyCoins(txids.back());
+            coins->vout.resize(1);
+            coins->vout[0].nValue = i;
+            coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+        }
+        cache.SetBestBlock(hashBlock);
+        writer.SetPreCommit(boost::bind(&PreCommit, true, &nCalls));
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // Whether or not the batch is still in flight, it is visible through the writer
+    for (unsigned int i = 0; i < txids.size(); i++) {
+        CCoins coins;
+        BOOST_CHECK(writer.GetCoins(txids[i], coins));
+        BOOST_CHECK_EQUAL(coins.vout[0].nValue, i);
+    }
+    BOOST_CHECK(writer.GetBestBlock() == hashBlock);
+
+    BOOST_CHECK(writer.Sync());
+    BOOST_CHECK_EQUAL(nCalls, 1);
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    for (unsigned int i = 0; i < txids.size(); i++)
+        BOOST_CHECK(db.HaveCoins(txids[i]));
+
+    // Spends reach the database the same way
+    {
+        CCoinsViewCache cache(&writer);
+        cache.ModifyCoins(txids[0])->Clear();
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!writer.HaveCoins(txids[0]));
+    BOOST_CHECK(writer.Sync());
+    BOOST_CHECK(!db.HaveCoins(txids[0]));
+
+    // A failing pre-commit step drops the batch and fails later writes
+    {
+        CCoinsViewCache cache(&writer);
+        cache.ModifyCoins(txids[1])->Clear();
+        cache.SetBestBlock(GetRandHash());
+        writer.SetPreCommit(boost::bind(&PreCommit, false, &nCalls));
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!writer.Sync());
+    BOOST_CHECK_EQUAL(nCalls, 2);
+    BOOST_CHECK(db.HaveCoins(txids[1]));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    CCoinsMap mapEmpty;
+    BOOST_CHECK(!writer.BatchWrite(mapEmpty, hashBlock));
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_per_output_test)
+{
+    CCoinsViewDBTest db;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(200);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        tx.vout[i].nValue = 1000 + i;
+        tx.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    uint256 txid = tx.GetHash();
+    CCoins coinsExpected(tx, 7);
+
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->FromTx(tx, 7);
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsExpected);
+
+    // Spending outputs, including the last ones, leaves the rest in place
+    {
+        CCoinsViewCache cache(&db);
+        CCoinsModifier modifier = cache.ModifyCoins(txid);
+        modifier->Spend(5);
+        modifier->Spend(199);
+        modifier->Spend(198);
+    }
+    coinsExpected.Spend(5);
+    coinsExpected.Spend(199);
+    coinsExpected.Spend(198);
+    {
+        CCoinsViewCache cache(&db);
+        {
+            CCoinsModifier modifier = cache.ModifyCoins(txid);
+            modifier->Spend(5);
+            modifier->Spend(199);
+            modifier->Spend(198);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsExpected);
+    BOOST_CHECK_EQUAL(coins.vout.size(), 198U);
+
+    // Outputs restored by a disconnect are written back
+    {
+        CCoinsViewCache cache(&db);
+        {
+            CCoinsModifier modifier = cache.ModifyCoins(txid);
+            modifier->vout.resize(200);
+            modifier->vout[199] = tx.vout[199];
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    coinsExpected.vout.resize(200);
+    coinsExpected.vout[199] = tx.vout[199];
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsExpected);
+
+    // A fully spent transaction disappears
+    {
+        CCoinsViewCache cache(&db);
+        {
+            CCoinsModifier modifier = cache.ModifyCoins(txid);
+            for (unsigned int i = 0; i < tx.vout.size(); i++)
+                modifier->Spend(i);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.GetCoins(txid, coins));
+    BOOST_CHECK(!db.HaveCoins(txid));
+
+    // Records of the old per-transaction layout are converted in place
+    CCoins coinsLegacy(tx, 9);
+    coinsLegacy.fCoinBase = true;
+    coinsLegacy.Spend(0);
+    db.WriteLegacyCoins(txid, coinsLegacy);
+    BOOST_CHECK(!db.HaveCoins(txid));
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(!db.HaveLegacyCoins(txid));
+    BOOST_CHECK(db.HaveCoins(txid));
+    BOOST_CHECK(db.GetCoins(txid, coins));
+    BOOST_CHECK(coins == coinsLegacy);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_stats_test)
+{
+    CCoinsViewDBTest db;
+    uint256 hashBlock = GetRandHash();
+    CAmount nTotal = 0;
+    {
+        CCoinsViewCache cache(&db);
+        for (unsigned int i = 0; i < 1000; i++) {
+            CCoinsModifier coins = cache.ModifyCoins(GetRandHash());
+            coins->nHeight = i;
+            coins->vout.resize(1 + i % 3);
+            for (unsigned int n = 0; n < coins->vout.size(); n++) {
+                coins->vout[n].nValue = i * 10 + n;
+                coins->vout[n].scriptPubKey = CScript() << OP_TRUE;
+                nTotal += i * 10 + n;
+            }
+        }
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // The parts scanned by each thread add up to the same totals and hash
+    int nScriptCheckThreadsSaved = nScriptCheckThreads;
+    CCoinsStats stats, statsParallel;
+    nScriptCheckThreads = 0;
+    BOOST_CHECK(db.GetStats(stats));
+    nScriptCheckThreads = 4;
+    BOOST_CHECK(db.GetStats(statsParallel));
+    nScriptCheckThreads = nScriptCheckThreadsSaved;
+
+    BOOST_CHECK(stats.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(stats.nTransactions, 1000U);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 1999U);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, nTotal);
+    BOOST_CHECK(statsParallel.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(statsParallel.nTransactions, stats.nTransactions);
+    BOOST_CHECK_EQUAL(statsParallel.nTransactionOutputs, stats.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(statsParallel.nSerializedSize, stats.nSerializedSize);
+    BOOST_CHECK_EQUAL(statsParallel.nTotalAmount, stats.nTotalAmount);
+    BOOST_CHECK(statsParallel.hashSerialized == stats.hashSerialized);
+
+    // Any change to an output changes the hash
+    uint256 txid = GetRandHash();
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->vout.push_back(CTxOut(1, CScript() << OP_TRUE));
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoinsStats statsAdded;
+    BOOST_CHECK(db.GetStats(statsAdded));
+    BOOST_CHECK_EQUAL(statsAdded.nTransactionOutputs, 2000U);
+    BOOST_CHECK(statsAdded.hashSerialized != stats.hashSerialized);
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->vout[0].nValue = 2;
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoinsStats statsChanged;
+    BOOST_CHECK(db.GetStats(statsChanged));
+    BOOST_CHECK(statsChanged.hashSerialized != statsAdded.hashSerialized);
+    BOOST_CHECK(statsChanged.hashSerialized != stats.hashSerialized);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_snapshot_test)
+{
+    CCoinsViewDBTest db;
+    uint256 hashBlock = GetRandHash();
+    {
+        CCoinsViewCache cache(&db);
+        for (unsigned int i = 0; i < 500; i++) {
+            CCoinsModifier coins = cache.ModifyCoins(GetRandHash());
+            coins->nVersion = 1;
+            coins->nHeight = i;
+            coins->fCoinBase = (i % 5 == 0);
+            coins->vout.resize(1 + i % 4);
+            for (unsigned int n = 0; n < coins->vout.size(); n++) {
+                // Leave a spent output in the middle of some transactions
+                if (n == 1 && i % 2 == 0 && coins->vout.size() > 2)
+                    continue;
+                coins->vout[n].nValue = i * 10 + n;
+                coins->vout[n].scriptPubKey = CScript() << OP_TRUE;
+            }
+        }
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    CCoinsStats statsDump;
+    BOOST_CHECK(db.DumpSnapshot(file, statsDump));
+    BOOST_CHECK(statsDump.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(statsDump.nTransactions, 500U);
+    BOOST_CHECK_EQUAL((uint64_t)ftell(file.Get()), statsDump.nSerializedSize);
+
+    // Loading replaces all outputs the database held before
+    CCoinsViewDBTest dbLoaded;
+    uint256 txidOld = GetRandHash();
+    {
+        CCoinsViewCache cache(&dbLoaded);
+        cache.ModifyCoins(txidOld)->vout.push_back(CTxOut(1, CScript() << OP_TRUE));
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    rewind(file.Get());
+    CCoinsSnapshotReader reader(file);
+    BOOST_CHECK(reader.ReadHeader());
+    BOOST_CHECK(reader.header.hashBlock == hashBlock);
+    CCoinsStats statsLoad;
+    BOOST_CHECK(dbLoaded.LoadSnapshot(reader, statsDump.nSerializedSize, statsDump.hashSerialized, statsLoad));
+    BOOST_CHECK(!dbLoaded.IsLoadingSnapshot());
+    BOOST_CHECK(dbLoaded.GetBestBlock() == hashBlock);
+    BOOST_CHECK(!dbLoaded.HaveCoins(txidOld));
+    BOOST_CHECK_EQUAL(statsLoad.nTransactions, statsDump.nTransactions);
+    BOOST_CHECK_EQUAL(statsLoad.nTransactionOutputs, statsDump.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(statsLoad.nTotalAmount, statsDump.nTotalAmount);
+    BOOST_CHECK_EQUAL(statsLoad.nSerializedSize, statsDump.nSerializedSize);
+    BOOST_CHECK(statsLoad.hashSerialized == statsDump.hashSerialized);
+
+    CCoinsStats stats, statsLoaded;
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK(dbLoaded.GetStats(statsLoaded));
+    BOOST_CHECK_EQUAL(statsLoaded.nTransactionOutputs, stats.nTransactionOutputs);
+    BOOST_CHECK(statsLoaded.hashSerialized == stats.hashSerialized);
+
+    // An intact snapshot with another checksum than expected is not used
+    rewind(file.Get());
+    CCoinsViewDBTest dbUnexpected;
+    CCoinsSnapshotReader readerUnexpected(file);
+    BOOST_CHECK(readerUnexpected.ReadHeader());
+    CCoinsStats statsUnexpected;
+    BOOST_CHECK(!dbUnexpected.LoadSnapshot(readerUnexpected, statsDump.nSerializedSize, GetRandHash(), statsUnexpected));
+    BOOST_CHECK(dbUnexpected.IsLoadingSnapshot());
+    BOOST_CHECK(dbUnexpected.GetBestBlock() == 0);
+
+    // A damaged snapshot is rejected, and the chainstate stays marked as incomplete
+    long nPos = statsDump.nSerializedSize / 2;
+    fseek(file.Get(), nPos, SEEK_SET);
+    int ch = fgetc(file.Get());
+    fseek(file.Get(), nPos, SEEK_SET);
+    fputc(ch ^ 0x01, file.Get());
+    rewind(file.Get());
+    CCoinsViewDBTest dbDamaged;
+    CCoinsSnapshotReader readerDamaged(file);
+    BOOST_CHECK(readerDamaged.ReadHeader());
+    CCoinsStats statsDamaged;
+    BOOST_CHECK(!dbDamaged.LoadSnapshot(readerDamaged, statsDump.nSerializedSize, statsDump.hashSerialized, statsDamaged));
+    BOOST_CHECK(dbDamaged.IsLoadingSnapshot());
+    BOOST_CHECK(dbDamaged.GetBestBlock() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_profile_test)
+{
+    CLevelDBProfile profile;
+    BOOST_CHECK(profile.IsValid());
+    BOOST_CHECK(profile.SetPreset("hdd"));
+    BOOST_CHECK(profile.IsValid());
+    BOOST_CHECK(profile.nBlockSize > CLevelDBProfile().nBlockSize);
+    BOOST_CHECK(profile.SetPreset("ssd"));
+    BOOST_CHECK(profile.IsValid());
+    BOOST_CHECK(!profile.SetPreset("floppy"));
+    profile.nWriteBufferPercent = 50;
+    BOOST_CHECK(!profile.IsValid());
+
+    BOOST_CHECK(profile.SetPreset("hdd"));
+    profile.nBloomBits = 0;
+    CCoinsViewDB db(1 << 20, true, false, profile);
+    BOOST_CHECK_EQUAL(db.GetDBProfile().nBlockSize, profile.nBlockSize);
+
+    CLevelDBStats stats;
+    db.GetDBStats(stats);
+    BOOST_CHECK_EQUAL(stats.nWrites, 0U);
+    BOOST_CHECK(stats.strLevelDBStats.find("Compactions") != std::string::npos);
+
+    CCoinsViewCache cache(&db);
+    cache.ModifyCoins(GetRandHash())->vout.push_back(CTxOut(1, CScript() << OP_TRUE));
+    BOOST_CHECK(cache.Flush());
+    db.GetDBStats(stats);
+    BOOST_CHECK_EQUAL(stats.nWrites, 1U);
+    BOOST_CHECK(stats.nWriteMicros >= 0);
+    BOOST_CHECK_EQUAL(stats.nStallMicros, 0);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_bulk_load_test)
+{
+    CLevelDBProfile profile;
+    profile.fBulkLoad = true;
+    CCoinsViewDB db(1 << 20, true, false, profile);
+    CLevelDBStats stats;
+    db.GetDBStats(stats);
+    BOOST_CHECK(stats.fBulkLoading);
+
+    std::vector<uint256> vTxid;
+    for (int nBatch = 0; nBatch < 4; nBatch++) {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 500; i++) {
+            vTxid.push_back(GetRandHash());
+            cache.ModifyCoins(vTxid.back())->vout.push_back(CTxOut(i + 1, CScript() << OP_TRUE));
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // Ending the bulk load compacts the database without changing its contents
+    CCoinsStats statsBefore, statsAfter;
+    BOOST_CHECK(db.GetStats(statsBefore));
+    db.EndBulkLoad();
+    db.GetDBStats(stats);
+    BOOST_CHECK(!stats.fBulkLoading);
+    BOOST_CHECK(db.GetStats(statsAfter));
+    BOOST_CHECK_EQUAL(statsAfter.nTransactionOutputs, 2000U);
+    BOOST_CHECK(statsAfter.hashSerialized == statsBefore.hashSerialized);
+    BOOST_FOREACH(const uint256& txid, vTxid)
+        BOOST_CHECK(db.HaveCoins(txid));
+    // A second call has nothing left to do
+    db.EndBulkLoad();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
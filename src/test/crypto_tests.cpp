@@ -2,6 +2,9 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "crypto/argon2.h"
+#include "crypto/common.h"
+#include "crypto/muhash.h"
 #include "crypto/rfc6979_hmac_sha256.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
@@ -282,4 +285,99 @@ BOOST_AUTO_TEST_CASE(rfc6979_hmac_sha256)
             ("7597887cbd76321f32e30440679a22cf7f8d9d2eac390e581fea091ce202ba94"));
 }
 
+static void TestArgon2d(const std::string &hexin, const std::string &hexout)
+{
+    std::vector<unsigned char> in = ParseHex(hexin);
+    std::vector<unsigned char> out = ParseHex(hexout);
+    BOOST_CHECK(in.size() == 80);
+    std::vector<unsigned char> hash(32);
+    worldcoin_argon2d((const char*)&in[0], (char*)&hash[0]);
+    BOOST_CHECK(hash == out);
+}
+
+BOOST_AUTO_TEST_CASE(argon2d_testvectors)
+{
+    // Test vectors computed with the libargon2 reference implementation:
+    // argon2d_hash_raw(1, 4096, 1, header, 80, "WorldcoinArgon2dSalt2025", 24, hash, 32)
+    for (int kernel = WDC_ARGON2D_GENERIC; kernel < WDC_ARGON2D_KERNELS; kernel++) {
+        if (!worldcoin_argon2d_use_kernel(kernel))
+            continue;
+        TestArgon2d(std::string(160, '0'),
+                    "e60d4d55b0691dd7a957cd409d5d75c3336faca9843708547a8aeb799e1808fe");
+        TestArgon2d("000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+                    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+                    "404142434445464748494a4b4c4d4e4f",
+                    "00310df05afed3199dcc117a1e17b4f97158c02af29dcdf21a2df62c93a03dd8");
+        TestArgon2d(std::string(160, 'f'),
+                    "3c63615fce60e47c6026f8a3622b1283cb0a0797431f3fd974f86de9bb58926e");
+    }
+    worldcoin_argon2d_detect();
+}
+
+BOOST_AUTO_TEST_CASE(argon2d_context)
+{
+    worldcoin_argon2d_context *ctx = worldcoin_argon2d_context_create();
+    BOOST_CHECK(ctx != NULL);
+    for (int i = 0; i < 8; i++) {
+        unsigned char header[80];
+        GetRandBytes(header, sizeof(header));
+        unsigned char expected[32], hash[32], hashThread[32];
+        worldcoin_argon2d_use_kernel(WDC_ARGON2D_GENERIC);
+        worldcoin_argon2d_ctx(NULL, (const char*)header, (char*)expected);
+        // Every compression function and a reused context must give the same
+        // result as a fresh allocation
+        for (int kernel = WDC_ARGON2D_GENERIC; kernel < WDC_ARGON2D_KERNELS; kernel++) {
+            if (!worldcoin_argon2d_use_kernel(kernel))
+                continue;
+            worldcoin_argon2d_ctx(ctx, (const char*)header, (char*)hash);
+            BOOST_CHECK(memcmp(hash, expected, sizeof(hash)) == 0);
+            worldcoin_argon2d((const char*)header, (char*)hashThread);
+            BOOST_CHECK(memcmp(hashThread, expected, sizeof(hashThread)) == 0);
+        }
+    }
+    worldcoin_argon2d_detect();
+    worldcoin_argon2d_context_destroy(ctx);
+    BOOST_CHECK(worldcoin_argon2d_thread_context() == worldcoin_argon2d_thread_context());
+}
+
+static std::string MuHashHex(const CMuHash3072& muhash)
+{
+    unsigned char hash[CMuHash3072::OUTPUT_SIZE];
+    muhash.Finalize(hash);
+    return HexStr(hash, hash + sizeof(hash));
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    // Computed with a separate implementation of the modular arithmetic
+    CMuHash3072 muhash;
+    const char* elements[] = {"a", "bc", "", "worldcoin"};
+    for (unsigned int i = 0; i < 4; i++)
+        muhash.Insert((const unsigned char*)elements[i], strlen(elements[i]));
+    BOOST_CHECK_EQUAL(MuHashHex(muhash), "ad71f32839c555cd57b75be8547b6d3c4388630e5205b0d6604326bd77522789");
+    CMuHash3072 muhashSquare, muhashInts;
+    muhashSquare.Insert((const unsigned char*)"x", 1);
+    for (int32_t i = 0; i < 50; i++) {
+        unsigned char buf[4];
+        WriteLE32(buf, i);
+        muhashInts.Insert(buf, sizeof(buf));
+    }
+    muhashSquare *= muhashInts;
+    muhashSquare *= muhashSquare;
+    BOOST_CHECK_EQUAL(MuHashHex(muhashSquare), "7aaa2bbd933f837023b6894869cdd38bc3b670e12240e1a056de6db4f774ef73");
+
+    // Insertion order and how the set is split do not matter, the contents do
+    CMuHash3072 muhashReversed, muhashFirst, muhashLast;
+    for (int i = 3; i >= 0; i--)
+        muhashReversed.Insert((const unsigned char*)elements[i], strlen(elements[i]));
+    BOOST_CHECK_EQUAL(MuHashHex(muhashReversed), MuHashHex(muhash));
+    muhashFirst.Insert((const unsigned char*)elements[0], strlen(elements[0])).Insert((const unsigned char*)elements[2], strlen(elements[2]));
+    muhashLast.Insert((const unsigned char*)elements[3], strlen(elements[3])).Insert((const unsigned char*)elements[1], strlen(elements[1]));
+    muhashFirst *= muhashLast;
+    BOOST_CHECK_EQUAL(MuHashHex(muhashFirst), MuHashHex(muhash));
+    muhashFirst.Insert((const unsigned char*)elements[0], strlen(elements[0]));
+    BOOST_CHECK(MuHashHex(muhashFirst) != MuHashHex(muhash));
+    BOOST_CHECK(MuHashHex(CMuHash3072()) != MuHashHex(muhash));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,11 +2,16 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "key.h"
+#include "keystore.h"
 #include "main.h"
+#include "script/sign.h"
 #include "txmempool.h"
 #include "util.h"
 
+#include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
+#include <limits>
 #include <list>
 
 BOOST_AUTO_TEST_SUITE(mempool_tests)
@@ -99,4 +104,521 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolJournalTest)
+{
+    CTxMemPool testPool(CFeeRate(0));
+    std::vector<std::pair<uint256, bool> > vChanges;
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 33000LL;
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout.hash = txParent.GetHash();
+    txChild.vin[0].prevout.n = 0;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 11000LL;
+
+    // Nothing was recorded before the first read
+    BOOST_CHECK(!testPool.ReadJournal(vChanges));
+    BOOST_CHECK(vChanges.empty());
+
+    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1));
+    testPool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 0, 0, 0.0, 1));
+    BOOST_CHECK(testPool.ReadJournal(vChanges));
+    BOOST_CHECK_EQUAL(vChanges.size(), 2);
+    BOOST_CHECK(vChanges[0] == std::make_pair(txParent.GetHash(), true));
+    BOOST_CHECK(vChanges[1] == std::make_pair(txChild.GetHash(), true));
+
+    // Reading drains the journal
+    BOOST_CHECK(testPool.ReadJournal(vChanges));
+    BOOST_CHECK(vChanges.empty());
+
+    std::list<CTransaction> removed;
+    testPool.remove(txParent, removed, true);
+    BOOST_CHECK(testPool.ReadJournal(vChanges));
+    BOOST_CHECK_EQUAL(vChanges.size(), 2);
+    BOOST_CHECK(vChanges[0] == std::make_pair(txParent.GetHash(), false));
+    BOOST_CHECK(vChanges[1] == std::make_pair(txChild.GetHash(), false));
+
+    // Prioritisation changes the selection order, so the journal is incomplete
+    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1));
+    testPool.PrioritiseTransaction(txParent.GetHash(), txParent.GetHash().ToString(), 1e6, 1000);
+    BOOST_CHECK(!testPool.ReadJournal(vChanges));
+    BOOST_CHECK(vChanges.empty());
+    BOOST_CHECK(testPool.ReadJournal(vChanges));
+
+    // So is one that overflowed
+    for (unsigned int i = 0; i <= MEMPOOL_JOURNAL_MAX / 2; i++) {
+        testPool.remove(txParent, removed);
+        testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1));
+    }
+    BOOST_CHECK(!testPool.ReadJournal(vChanges));
+    BOOST_CHECK(vChanges.empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolIndexesTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // A chain parent <- child <- grandchild, plus an unrelated transaction
+    CMutableTransaction tx[4];
+    for (int i = 0; i < 4; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    tx[3].vin[0].scriptSig = CScript() << OP_12;
+    tx[1].vin[0].prevout = COutPoint(tx[0].GetHash(), 0);
+    tx[2].vin[0].prevout = COutPoint(tx[1].GetHash(), 0);
+
+    // The parent pays nothing, the child a lot; same sizes throughout
+    CAmount nFees[4] = {0, 30000, 1000, 12000};
+    for (int i = 0; i < 4; i++)
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], nFees[i], i, 0.0, 1));
+    const CTxMemPoolEntry* entry[4];
+    for (int i = 0; i < 4; i++)
+        entry[i] = &pool.mapTx[tx[i].GetHash()];
+    uint64_t nSize = entry[0]->GetTxSize();
+
+    BOOST_CHECK_EQUAL(entry[0]->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(entry[2]->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(entry[2]->GetSizeWithAncestors(), 3 * nSize);
+    BOOST_CHECK_EQUAL(entry[2]->GetModFeesWithAncestors(), 31000);
+
+    // Own fee rate puts the child first, the package rate puts the child's
+    // package (15000 per tx) ahead of the lone transaction (12000)
+    BOOST_CHECK(*pool.setByFeeRate.begin() == entry[1]);
+    BOOST_CHECK(*pool.setByAncestorFeeRate.begin() == entry[1]);
+    BOOST_CHECK(*++pool.setByAncestorFeeRate.begin() == entry[3]);
+    BOOST_CHECK(*pool.setByEntryTime.begin() == entry[0]);
+    BOOST_CHECK(*pool.setByEntryTime.rbegin() == entry[3]);
+
+    std::set<uint256> setAncestors, setDescendants;
+    pool.CalculateAncestors(tx[2].GetHash(), setAncestors);
+    BOOST_CHECK_EQUAL(setAncestors.size(), 2);
+    pool.CalculateDescendants(tx[0].GetHash(), setDescendants);
+    BOOST_CHECK_EQUAL(setDescendants.size(), 2);
+
+    // Prioritising the parent lifts all packages it is part of
+    pool.PrioritiseTransaction(tx[0].GetHash(), tx[0].GetHash().ToString(), 0, 50000);
+    BOOST_CHECK_EQUAL(entry[0]->GetModifiedFee(), 50000);
+    BOOST_CHECK_EQUAL(entry[2]->GetModFeesWithAncestors(), 81000);
+    BOOST_CHECK(*pool.setByAncestorFeeRate.begin() == entry[0]);
+
+    // Confirming the parent leaves shorter packages behind
+    std::list<CTransaction> removed;
+    pool.remove(tx[0], removed, false);
+    BOOST_CHECK_EQUAL(entry[1]->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(entry[2]->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(entry[2]->GetSizeWithAncestors(), 2 * nSize);
+    BOOST_CHECK_EQUAL(entry[2]->GetModFeesWithAncestors(), 31000);
+    BOOST_CHECK_EQUAL(pool.setByFeeRate.size(), 3);
+    BOOST_CHECK_EQUAL(pool.setByAncestorFeeRate.size(), 3);
+    BOOST_CHECK_EQUAL(pool.setByEntryTime.size(), 3);
+
+    // Re-adding it, as after a reorg, extends the packages of the children again
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 0, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(entry[2]->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(pool.mapTx[tx[0].GetHash()].GetModifiedFee(), 50000);
+
+    pool.clear();
+    BOOST_CHECK(pool.setByFeeRate.empty());
+    BOOST_CHECK(pool.setByAncestorFeeRate.empty());
+    BOOST_CHECK(pool.setByEntryTime.empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolReaddPackagesTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // The child spends both the parent and the middle transaction
+    CMutableTransaction txParent, txMiddle, txChild;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 10 * COIN;
+    }
+    txMiddle.vin.resize(1);
+    txMiddle.vin[0].scriptSig = CScript() << OP_11;
+    txMiddle.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txMiddle.vout.resize(1);
+    txMiddle.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txMiddle.vout[0].nValue = 10 * COIN;
+    txChild.vin.resize(2);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout = COutPoint(txMiddle.GetHash(), 0);
+    txChild.vin[1].scriptSig = CScript() << OP_11;
+    txChild.vin[1].prevout = COutPoint(txParent.GetHash(), 1);
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 20 * COIN;
+
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 0.0, 1));
+    pool.addUnchecked(txMiddle.GetHash(), CTxMemPoolEntry(txMiddle, 2000, 0, 0.0, 1));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 4000, 0, 0.0, 1));
+    const CTxMemPoolEntry& parent = pool.mapTx[txParent.GetHash()];
+    const CTxMemPoolEntry& child = pool.mapTx[txChild.GetHash()];
+    uint64_t nSizeParent = parent.GetTxSize();
+    uint64_t nSizeMiddle = pool.mapTx[txMiddle.GetHash()].GetTxSize();
+    uint64_t nSizeChild = child.GetTxSize();
+    BOOST_CHECK_EQUAL(parent.GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(child.GetCountWithAncestors(), 3);
+
+    // Confirming the middle one leaves the parent and the child linked
+    std::list<CTransaction> removed;
+    pool.remove(txMiddle, removed, false);
+    BOOST_CHECK_EQUAL(parent.GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(parent.GetSizeWithDescendants(), nSizeParent + nSizeChild);
+    BOOST_CHECK_EQUAL(child.GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(child.GetModFeesWithAncestors(), 5000);
+
+    // Re-adding it, as after a reorg, only adds it to both packages
+    pool.addUnchecked(txMiddle.GetHash(), CTxMemPoolEntry(txMiddle, 2000, 0, 0.0, 1));
+    const CTxMemPoolEntry& middle = pool.mapTx[txMiddle.GetHash()];
+    BOOST_CHECK_EQUAL(middle.GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(middle.GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(middle.GetModFeesWithDescendants(), 6000);
+    BOOST_CHECK_EQUAL(parent.GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(parent.GetSizeWithDescendants(), nSizeParent + nSizeMiddle + nSizeChild);
+    BOOST_CHECK_EQUAL(parent.GetModFeesWithDescendants(), 7000);
+    BOOST_CHECK_EQUAL(child.GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(child.GetSizeWithAncestors(), nSizeParent + nSizeMiddle + nSizeChild);
+    BOOST_CHECK_EQUAL(child.GetModFeesWithAncestors(), 7000);
+
+    // A re-added transaction whose ancestor was not linked to its child yet
+    // links the two
+    pool.remove(txParent, removed, false);
+    BOOST_CHECK_EQUAL(middle.GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(child.GetCountWithAncestors(), 2);
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 0.0, 1));
+    const CTxMemPoolEntry& parentReadded = pool.mapTx[txParent.GetHash()];
+    BOOST_CHECK_EQUAL(parentReadded.GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(parentReadded.GetModFeesWithDescendants(), 7000);
+    BOOST_CHECK_EQUAL(middle.GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(child.GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(child.GetModFeesWithAncestors(), 7000);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPackageLimitsTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // A chain of five transactions, the first with a spare output
+    CMutableTransaction tx[5];
+    for (int i = 0; i < 5; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        if (i > 0)
+            tx[i].vin[0].prevout = COutPoint(tx[i - 1].GetHash(), 0);
+        tx[i].vout.resize(i == 0 ? 2 : 1);
+        for (unsigned int j = 0; j < tx[i].vout.size(); j++) {
+            tx[i].vout[j].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+            tx[i].vout[j].nValue = COIN;
+        }
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], 0, 0, 0.0, 1));
+    }
+    uint64_t nSize = pool.mapTx[tx[1].GetHash()].GetTxSize();
+    uint64_t nUnlimited = std::numeric_limits<uint64_t>::max();
+    std::string errString;
+
+    // Extending the chain makes six with the ancestors
+    CMutableTransaction txTail;
+    txTail.vin.resize(1);
+    txTail.vin[0].prevout = COutPoint(tx[4].GetHash(), 0);
+    txTail.vout = tx[1].vout;
+    BOOST_CHECK(pool.CheckPackageLimits(txTail, 6, nUnlimited, nUnlimited, nUnlimited, errString));
+    BOOST_CHECK(!pool.CheckPackageLimits(txTail, 5, nUnlimited, nUnlimited, nUnlimited, errString));
+    BOOST_CHECK(errString.find("too many unconfirmed ancestors") == 0);
+    BOOST_CHECK(pool.CheckPackageLimits(txTail, 6, 6 * nSize + 100, nUnlimited, nUnlimited, errString));
+    BOOST_CHECK(!pool.CheckPackageLimits(txTail, 6, 5 * nSize, nUnlimited, nUnlimited, errString));
+    BOOST_CHECK(errString.find("exceeds ancestor size limit") == 0);
+
+    // Spending the spare output gives the first transaction six descendants,
+    // itself included, but the new transaction only one ancestor
+    CMutableTransaction txSide;
+    txSide.vin.resize(1);
+    txSide.vin[0].prevout = COutPoint(tx[0].GetHash(), 1);
+    txSide.vout = tx[1].vout;
+    BOOST_CHECK(pool.CheckPackageLimits(txSide, 2, nUnlimited, 6, nUnlimited, errString));
+    BOOST_CHECK(!pool.CheckPackageLimits(txSide, 2, nUnlimited, 5, nUnlimited, errString));
+    BOOST_CHECK(errString.find("too many descendants") == 0);
+    BOOST_CHECK(!pool.CheckPackageLimits(txSide, 2, nUnlimited, 6, 5 * nSize, errString));
+    BOOST_CHECK(errString.find("exceeds descendant size limit") == 0);
+
+    // Transactions without parents in the pool are never limited
+    CMutableTransaction txAlone;
+    txAlone.vin.resize(1);
+    txAlone.vin[0].prevout = COutPoint(uint256(5), 0);
+    txAlone.vout = tx[1].vout;
+    BOOST_CHECK(pool.CheckPackageLimits(txAlone, 1, 0, 1, 0, errString));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    // Two independent transactions and a child of the cheaper one that pays
+    // well, but not enough to lift their package above the other transaction
+    CMutableTransaction tx1, tx2, tx3;
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_1;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    tx2 = tx1;
+    tx2.vin[0].scriptSig = CScript() << OP_2;
+    tx3 = tx1;
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+
+    pool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 10000, 0, 0.0, 1));
+    pool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 1000, 0, 0.0, 1));
+    size_t nUsageTwo = pool.DynamicMemoryUsage();
+    pool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 5000, 0, 0.0, 1));
+    BOOST_CHECK(pool.DynamicMemoryUsage() > nUsageTwo);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1000000).GetFeePerK(), 0);
+
+    // Nothing goes while the pool fits
+    BOOST_CHECK_EQUAL(pool.TrimToSize(pool.DynamicMemoryUsage()), 0);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    // The cheap parent goes with its child
+    BOOST_CHECK_EQUAL(pool.TrimToSize(pool.DynamicMemoryUsage() - 1), 2);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(!pool.exists(tx2.GetHash()));
+    BOOST_CHECK(!pool.exists(tx3.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetEvictedCount(), 2);
+
+    // The minimum fee now exceeds the package that was dropped
+    CFeeRate minFee = pool.GetMinFee(1000000);
+    BOOST_CHECK(minFee > CFeeRate(6000, ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION) * 2));
+    BOOST_CHECK(minFee > CFeeRate(1000));
+
+    // It does not decay before a block, then halves quickly in an almost empty pool
+    SetMockTime(GetTime() + 3600);
+    BOOST_CHECK(pool.GetMinFee(1000000) == minFee);
+    std::vector<CTransaction> vtx;
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 1, conflicts);
+    SetMockTime(GetTime() + CTxMemPool::ROLLING_FEE_HALFLIFE / 4);
+    BOOST_CHECK(pool.GetMinFee(1000000) < minFee);
+    SetMockTime(GetTime() + CTxMemPool::ROLLING_FEE_HALFLIFE * 4);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1000000).GetFeePerK(), 0);
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolTrimDescendantScoreTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    // A lone transaction paying a modest fee, and a parent paying nothing
+    // whose child pays for both (CPFP)
+    CMutableTransaction txLone, txParent, txChild;
+    txLone.vin.resize(1);
+    txLone.vin[0].scriptSig = CScript() << OP_1;
+    txLone.vout.resize(1);
+    txLone.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    txLone.vout[0].nValue = 10 * COIN;
+    txParent = txLone;
+    txParent.vin[0].scriptSig = CScript() << OP_2;
+    txChild = txLone;
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+
+    pool.addUnchecked(txLone.GetHash(), CTxMemPoolEntry(txLone, 3000, 0, 0.0, 1));
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 0, 0, 0.0, 1));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 10000, 0, 0.0, 1));
+
+    const CTxMemPoolEntry& parent = pool.mapTx[txParent.GetHash()];
+    BOOST_CHECK_EQUAL(parent.GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(parent.GetSizeWithDescendants(), 2 * parent.GetTxSize());
+    BOOST_CHECK_EQUAL(parent.GetModFeesWithDescendants(), 10000);
+    BOOST_CHECK(*pool.setByDescendantScore.rbegin() == &pool.mapTx[txLone.GetHash()]);
+
+    // The package pays more per byte than the lone transaction, which goes first
+    BOOST_CHECK_EQUAL(pool.TrimToSize(pool.DynamicMemoryUsage() - 1), 1);
+    BOOST_CHECK(!pool.exists(txLone.GetHash()));
+    BOOST_CHECK(pool.exists(txParent.GetHash()));
+    BOOST_CHECK(pool.exists(txChild.GetHash()));
+
+    // Confirming the child leaves the parent on its own again
+    std::list<CTransaction> removed;
+    pool.remove(txChild, removed, false);
+    BOOST_CHECK_EQUAL(parent.GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(parent.GetSizeWithDescendants(), parent.GetTxSize());
+    BOOST_CHECK_EQUAL(parent.GetModFeesWithDescendants(), 0);
+
+    // Prioritising reaches the packages of the ancestors too
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 10000, 0, 0.0, 1));
+    pool.PrioritiseTransaction(txChild.GetHash(), txChild.GetHash().ToString(), 0, 500);
+    BOOST_CHECK_EQUAL(parent.GetModFeesWithDescendants(), 10500);
+    pool.clear();
+    BOOST_CHECK(pool.setByDescendantScore.empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPersistTest)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+
+    // A confirmed coin to spend, placed directly in the UTXO set
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(uint256(1), 0);
+    txFund.vout.resize(1);
+    txFund.vout[0].nValue = 50 * COIN;
+    txFund.vout[0].scriptPubKey = scriptPubKey;
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyCoins(txFund.GetHash())->FromTx(txFund, 0);
+    }
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txFund.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 49 * COIN;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    BOOST_REQUIRE(SignSignature(keystore, txFund, tx, 0));
+    uint256 hash = tx.GetHash();
+    uint256 hashAbsent = uint256(2);
+
+    // A child that sorts before its parent by txid, the order of mapTx
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(hash, 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].nValue = 48 * COIN;
+    txChild.vout[0].scriptPubKey = scriptPubKey;
+    do {
+        txChild.nLockTime++;
+        BOOST_REQUIRE(SignSignature(keystore, tx, txChild, 0));
+    } while (!(txChild.GetHash() < hash));
+    uint256 hashChild = txChild.GetHash();
+
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, tx, true, NULL, false, 1234));
+        BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, txChild, true, NULL, false, 1235));
+    }
+    mempool.PrioritiseTransaction(hash, hash.ToString(), 0, 500);
+    mempool.PrioritiseTransaction(hashAbsent, hashAbsent.ToString(), 1.5, 700);
+    BOOST_REQUIRE(DumpMempool());
+
+    mempool.clear();
+    mempool.mapDeltas.clear();
+    BOOST_REQUIRE(LoadMempool());
+
+    // Both transactions, entry times and fee deltas survive the round trip
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+    {
+        LOCK(mempool.cs);
+        std::map<uint256, CTxMemPoolEntry>::const_iterator it = mempool.mapTx.find(hash);
+        BOOST_REQUIRE(it != mempool.mapTx.end());
+        BOOST_CHECK_EQUAL(it->second.GetTime(), 1234);
+        BOOST_CHECK_EQUAL(it->second.GetModifiedFee(), COIN + 500);
+        it = mempool.mapTx.find(hashChild);
+        BOOST_REQUIRE(it != mempool.mapTx.end());
+        BOOST_CHECK_EQUAL(it->second.GetTime(), 1235);
+        BOOST_CHECK_EQUAL(it->second.GetCountWithAncestors(), 2U);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[hashAbsent].first, 1.5);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[hashAbsent].second, 700);
+    }
+
+    // Without a mempool.dat there is nothing to load
+    boost::filesystem::remove(GetDataDir() / "mempool.dat");
+    mempool.clear();
+    BOOST_CHECK(!LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+
+    mempool.mapDeltas.clear();
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyCoins(txFund.GetHash())->Clear();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolParallelScriptCheckTest)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+
+    // Confirmed coins to spend, placed directly in the UTXO set
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(uint256(3), 0);
+    txFund.vout.resize(8);
+    for (unsigned int i = 0; i < txFund.vout.size(); i++) {
+        txFund.vout[i].nValue = 10 * COIN;
+        txFund.vout[i].scriptPubKey = scriptPubKey;
+    }
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyCoins(txFund.GetHash())->FromTx(txFund, 0);
+    }
+
+    // Spend four of them, leaving the signature of the third one out
+    CMutableTransaction txBad;
+    txBad.vin.resize(4);
+    for (unsigned int i = 0; i < txBad.vin.size(); i++)
+        txBad.vin[i].prevout = COutPoint(txFund.GetHash(), i);
+    txBad.vout.resize(1);
+    txBad.vout[0].nValue = 39 * COIN;
+    txBad.vout[0].scriptPubKey = scriptPubKey;
+    for (unsigned int i = 0; i < txBad.vin.size(); i++)
+        if (i != 2)
+            BOOST_REQUIRE(SignSignature(keystore, txFund, txBad, i));
+
+    // The inputs are checked on the script check threads, and a failure
+    // reports the error of the input that failed
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(!AcceptToMemoryPool(mempool, state, txBad, true, NULL));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(SCRIPT_ERR_INVALID_STACK_OPERATION)));
+        BOOST_CHECK(!mempool.exists(txBad.GetHash()));
+    }
+
+    // The remaining four spent correctly
+    CMutableTransaction tx;
+    tx.vin.resize(4);
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+        tx.vin[i].prevout = COutPoint(txFund.GetHash(), 4 + i);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 39 * COIN;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+        BOOST_REQUIRE(SignSignature(keystore, txFund, tx, i));
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, tx, true, NULL));
+        BOOST_CHECK(mempool.exists(tx.GetHash()));
+    }
+
+    mempool.clear();
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyCoins(txFund.GetHash())->Clear();
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,12 +2,17 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "key.h"
+#include "keystore.h"
 #include "main.h"
 #include "miner.h"
 #include "pubkey.h"
+#include "script/sign.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
 BOOST_AUTO_TEST_SUITE(miner_tests)
@@ -263,4 +268,214 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     Checkpoints::fEnabled = true;
 }
 
+static bool StopAfter(int* pnCalls, int nMax)
+{
+    return ++*pnCalls >= nMax;
+}
+
+BOOST_AUTO_TEST_CASE(ScanNonces_hits)
+{
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    // About every other hash meets this target
+    uint256 hashTarget = ~uint256(0) >> 1;
+
+    std::vector<CNonceHit> vHits;
+    BOOST_CHECK_EQUAL(ScanNonces(header, 100, 132, hashTarget, vHits, boost::function<bool()>(), 32), 32U);
+    unsigned int nExpected = 0;
+    for (uint32_t nNonce = 100; nNonce < 132; nNonce++) {
+        header.nNonce = nNonce;
+        if (header.GetPoWHash() <= hashTarget)
+            nExpected++;
+    }
+    BOOST_CHECK_EQUAL(vHits.size(), nExpected);
+    BOOST_FOREACH(const CNonceHit& hit, vHits) {
+        header.nNonce = hit.nNonce;
+        BOOST_CHECK(hit.hashPoW == header.GetPoWHash());
+        BOOST_CHECK(hit.hashPoW <= hashTarget);
+    }
+
+    // By default the search ends at the first hit
+    std::vector<CNonceHit> vFirst;
+    uint64_t nHashes = ScanNonces(header, 100, 132, hashTarget, vFirst);
+    BOOST_CHECK_EQUAL(vFirst.size(), 1U);
+    BOOST_CHECK(vFirst[0].nNonce == vHits[0].nNonce);
+    BOOST_CHECK_EQUAL(nHashes, vHits[0].nNonce - 100 + 1);
+
+    // A stop request ends the search early
+    int nCalls = 0;
+    std::vector<CNonceHit> vStopped;
+    BOOST_CHECK_EQUAL(ScanNonces(header, 100, 132, uint256(0), vStopped, boost::bind(&StopAfter, &nCalls, 3)), 3U);
+    BOOST_CHECK(vStopped.empty());
+}
+
+BOOST_AUTO_TEST_CASE(MinerStats_snapshot)
+{
+    ResetMinerStats();
+    boost::shared_ptr<CMinerThreadStats> a = RegisterMinerThread();
+    boost::shared_ptr<CMinerThreadStats> b = RegisterMinerThread();
+
+    a->AddHashes(256);
+    a->AddHashes(44);
+    a->AddTemplate(1000);
+    a->AddTemplate(3000);
+    a->AddStaleTemplate();
+    a->nHashesPerSec.store(40);
+    a->nRateTime.store(GetTimeMillis());
+    b->AddHashes(7);
+    b->AddBlockFound();
+    // An outdated rate is reported as zero
+    b->nHashesPerSec.store(1000);
+    b->nRateTime.store(GetTimeMillis() - 60000);
+
+    std::vector<CMinerStats> vStats;
+    GetMinerStats(vStats);
+    BOOST_CHECK_EQUAL(vStats.size(), 2U);
+    BOOST_CHECK_EQUAL(vStats[0].nHashes, 300U);
+    BOOST_CHECK_EQUAL(vStats[0].nTemplates, 2U);
+    BOOST_CHECK_EQUAL(vStats[0].nTemplateMicros, 4000U);
+    BOOST_CHECK_EQUAL(vStats[0].nMaxTemplateMicros, 3000U);
+    BOOST_CHECK_EQUAL(vStats[0].nStaleTemplates, 1U);
+    BOOST_CHECK_EQUAL(vStats[0].nBlocksFound, 0U);
+    BOOST_CHECK_EQUAL(vStats[1].nHashes, 7U);
+    BOOST_CHECK_EQUAL(vStats[1].nBlocksFound, 1U);
+    BOOST_CHECK_EQUAL(vStats[1].nHashesPerSec, 0U);
+    BOOST_CHECK_EQUAL(GetMinerHashesPerSec(), 40U);
+
+    ResetMinerStats();
+    GetMinerStats(vStats);
+    BOOST_CHECK(vStats.empty());
+    BOOST_CHECK_EQUAL(GetMinerHashesPerSec(), 0U);
+}
+
+static bool TemplateHas(const CBlockTemplate* pblocktemplate, const uint256& hash)
+{
+    BOOST_FOREACH(const CTransaction& tx, pblocktemplate->block.vtx)
+        if (tx.GetHash() == hash)
+            return true;
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(CreateNewBlock_patched)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+
+    // A confirmed coin to spend, placed directly in the UTXO set
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(uint256(4), 0);
+    txFund.vout.resize(1);
+    txFund.vout[0].nValue = 50 * COIN;
+    txFund.vout[0].scriptPubKey = scriptPubKey;
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyCoins(txFund.GetHash())->FromTx(txFund, 0);
+    }
+
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].prevout = COutPoint(txFund.GetHash(), 0);
+    txParent.vout.resize(1);
+    txParent.vout[0].nValue = 49 * COIN;
+    txParent.vout[0].scriptPubKey = scriptPubKey;
+    BOOST_REQUIRE(SignSignature(keystore, txFund, txParent, 0));
+
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vout.resize(1);
+    txChild.vout[0].nValue = 48 * COIN;
+    txChild.vout[0].scriptPubKey = scriptPubKey;
+    BOOST_REQUIRE(SignSignature(keystore, txParent, txChild, 0));
+
+    mempool.clear();
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, txParent, false, NULL));
+    }
+
+    // A full selection, which the following templates are patched from.
+    // CreateNewBlock connects it with TestBlockValidity, and checks the
+    // patched ones with TestPatchedBlock.
+    CBlockTemplate *pblocktemplate;
+    BOOST_REQUIRE(pblocktemplate = CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2U);
+    BOOST_CHECK(TemplateHas(pblocktemplate, txParent.GetHash()));
+    delete pblocktemplate;
+
+    // A transaction joining the pool is appended after its parent
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, txChild, false, NULL));
+    }
+    BOOST_REQUIRE(pblocktemplate = CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txParent.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == txChild.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -2 * COIN);
+    delete pblocktemplate;
+
+    // Removing the parent drops the child from the template too
+    std::list<CTransaction> removed;
+    mempool.remove(txParent, removed, false);
+    BOOST_REQUIRE(pblocktemplate = CreateNewBlock(scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    delete pblocktemplate;
+
+    mempool.clear();
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyCoins(txFund.GetHash())->Clear();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(CreateNewBlock_patched_invalid)
+{
+    CScript scriptPubKey = CScript() << OP_TRUE;
+
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(uint256(5), 0);
+    txFund.vout.resize(1);
+    txFund.vout[0].nValue = 50 * COIN;
+    txFund.vout[0].scriptPubKey = scriptPubKey;
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyCoins(txFund.GetHash())->FromTx(txFund, 0);
+    }
+
+    mempool.clear();
+    CBlockTemplate *pblocktemplate;
+    BOOST_REQUIRE(pblocktemplate = CreateNewBlock(scriptPubKey));
+    delete pblocktemplate;
+
+    // A pool transaction that spends more than its input is appended to the
+    // cached template, which then fails its checks. The template is selected
+    // again, without it, both now and on the next call.
+    CMutableTransaction txBad;
+    txBad.vin.resize(1);
+    txBad.vin[0].prevout = COutPoint(txFund.GetHash(), 0);
+    txBad.vout.resize(1);
+    txBad.vout[0].nValue = 51 * COIN;
+    txBad.vout[0].scriptPubKey = scriptPubKey;
+    mempool.addUnchecked(txBad.GetHash(), CTxMemPoolEntry(txBad, COIN, GetTime(), 111.0, 11));
+    for (int i = 0; i < 2; i++)
+    {
+        BOOST_REQUIRE(pblocktemplate = CreateNewBlock(scriptPubKey));
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+        delete pblocktemplate;
+    }
+
+    mempool.clear();
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyCoins(txFund.GetHash())->Clear();
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -161,4 +161,32 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(span_reader)
+{
+    CDataStream ss(SER_DISK, 0);
+    std::string str("worldcoin");
+    ss << VARINT(300) << str << (uint32_t)7;
+    std::vector<char> vch(ss.begin(), ss.end());
+
+    // Reads the same values as CDataStream, without touching the buffer
+    CSpanReader reader(&vch[0], &vch[0] + vch.size(), SER_DISK, 0);
+    BOOST_CHECK_EQUAL(reader.size(), vch.size());
+    int n;
+    std::string strRead;
+    reader >> VARINT(n) >> strRead;
+    BOOST_CHECK_EQUAL(n, 300);
+    BOOST_CHECK_EQUAL(strRead, str);
+    BOOST_CHECK_EQUAL(reader.size(), 4U);
+    reader.ignore(2);
+    BOOST_CHECK_EQUAL(reader.size(), 2U);
+    BOOST_CHECK(std::equal(vch.begin(), vch.end(), ss.begin()));
+
+    // Reading past the end throws, like CDataStream
+    uint32_t nTooLong;
+    BOOST_CHECK_THROW(reader >> nTooLong, std::ios_base::failure);
+    BOOST_CHECK_THROW(reader.ignore(3), std::ios_base::failure);
+    reader.ignore(2);
+    BOOST_CHECK(reader.eof());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,122 @@
+// Copyright (c) 2025 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pubkey.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+static CPubKey RandomPubKey()
+{
+    std::vector<unsigned char> vch(33);
+    vch[0] = 0x02;
+    GetRandBytes(&vch[1], 32);
+    return CPubKey(vch);
+}
+
+static std::vector<unsigned char> RandomSig()
+{
+    std::vector<unsigned char> vch(72);
+    GetRandBytes(&vch[0], vch.size());
+    return vch;
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_get_set)
+{
+    CSignatureCache cache(1 << 20);
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig = RandomSig();
+    CPubKey pubkey = RandomPubKey();
+
+    BOOST_CHECK(!cache.Get(hash, vchSig, pubkey));
+    cache.Set(hash, vchSig, pubkey);
+    BOOST_CHECK(cache.Get(hash, vchSig, pubkey));
+    cache.Set(hash, vchSig, pubkey);
+    BOOST_CHECK(cache.Get(hash, vchSig, pubkey));
+
+    // Any other hash, signature or key is a different entry
+    BOOST_CHECK(!cache.Get(GetRandHash(), vchSig, pubkey));
+    BOOST_CHECK(!cache.Get(hash, RandomSig(), pubkey));
+    BOOST_CHECK(!cache.Get(hash, vchSig, RandomPubKey()));
+
+    // Empty signatures are never cached
+    std::vector<unsigned char> vchEmpty;
+    cache.Set(hash, vchEmpty, pubkey);
+    BOOST_CHECK(!cache.Get(hash, vchEmpty, pubkey));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_no_ambiguous_entries)
+{
+    CSignatureCache cache(1 << 20);
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig = RandomSig();
+    CPubKey pubkey = RandomPubKey();
+    cache.Set(hash, vchSig, pubkey);
+
+    // The same bytes split differently between signature and key: the key
+    // moved into the signature, with an invalid (empty) key left over
+    std::vector<unsigned char> vchSigWithKey(vchSig);
+    vchSigWithKey.insert(vchSigWithKey.end(), pubkey.begin(), pubkey.end());
+    CPubKey pubkeyInvalid;
+    BOOST_CHECK_EQUAL(pubkeyInvalid.size(), 0U);
+    BOOST_CHECK(!cache.Get(hash, vchSigWithKey, pubkeyInvalid));
+
+    // A signature byte moved into the key
+    std::vector<unsigned char> vchKey(1, vchSig.back());
+    vchKey.insert(vchKey.end(), pubkey.begin(), pubkey.end());
+    vchKey.resize(33);
+    std::vector<unsigned char> vchSigShort(vchSig.begin(), vchSig.end() - 1);
+    BOOST_CHECK(!cache.Get(hash, vchSigShort, CPubKey(vchKey)));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_eviction)
+{
+    // Too small to give every stripe its probes: disabled
+    CSignatureCache cacheNone(1024);
+    BOOST_CHECK_EQUAL(cacheNone.GetCapacity(), 0U);
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig = RandomSig();
+    CPubKey pubkey = RandomPubKey();
+    cacheNone.Set(hash, vchSig, pubkey);
+    BOOST_CHECK(!cacheNone.Get(hash, vchSig, pubkey));
+
+    // 64 stripes of 8 slots
+    CSignatureCache cache(64 * 8 * sizeof(uint256));
+    BOOST_CHECK_EQUAL(cache.GetCapacity(), 512U);
+    std::vector<uint256> vHashes;
+    for (unsigned int i = 0; i < 4 * cache.GetCapacity(); i++) {
+        vHashes.push_back(GetRandHash());
+        cache.Set(vHashes.back(), vchSig, pubkey);
+        // The newest entry always goes in, evicting an older one if it must
+        BOOST_CHECK(cache.Get(vHashes.back(), vchSig, pubkey));
+    }
+    unsigned int nFound = 0;
+    for (unsigned int i = 0; i < vHashes.size(); i++) {
+        if (cache.Get(vHashes[i], vchSig, pubkey))
+            nFound++;
+    }
+    BOOST_CHECK(nFound <= cache.GetCapacity());
+    BOOST_CHECK(nFound > cache.GetCapacity() / 2);
+    for (unsigned int i = 0; i < 100; i++)
+        BOOST_CHECK(!cache.Get(GetRandHash(), vchSig, pubkey));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_size_arg)
+{
+    BOOST_CHECK_EQUAL(GetSigCacheSizeMiB(DEFAULT_MAX_SIG_CACHE_SIZE), DEFAULT_MAX_SIG_CACHE_SIZE);
+    BOOST_CHECK_EQUAL(GetSigCacheSizeMiB(0), 0);
+    BOOST_CHECK_EQUAL(GetSigCacheSizeMiB(-1), 0);
+    BOOST_CHECK_EQUAL(GetSigCacheSizeMiB(MAX_MAX_SIG_CACHE_SIZE), MAX_MAX_SIG_CACHE_SIZE);
+    // The old default of 50000 entries, rounded up to whole MiB
+    BOOST_CHECK_EQUAL(GetSigCacheSizeMiB(50000), 2);
+    BOOST_CHECK_EQUAL(GetSigCacheSizeMiB(1000000000), MAX_MAX_SIG_CACHE_SIZE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
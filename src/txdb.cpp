@@ -5,40 +5,150 @@
 
 #include "txdb.h"
 
+#include "crypto/muhash.h"
 #include "pow.h"
+#include "random.h"
+#include "ui_interface.h"
 #include "uint256.h"
 
 #include <stdint.h>
 
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 
-void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
-    if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
-    else
-        batch.Write(make_pair('c', hash), coins);
+static const char DB_COINS = 'c';
+static const char DB_COIN = 'C';
+static const char DB_COIN_SLOTS = 'N';
+static const char DB_BEST_BLOCK = 'B';
+static const char DB_SNAPSHOT_LOADING = 'L';
+
+//! Outputs written per batch while upgrading an old chainstate or loading a snapshot
+static const unsigned int COINS_WRITE_BATCH = 10000;
+
+namespace {
+
+/** Chainstate key of a single unspent output: 'C' + txid + VARINT(output index) */
+struct CCoinsDBKey
+{
+    uint256 hash;
+    uint32_t n;
+
+    CCoinsDBKey(const uint256& hashIn, uint32_t nIn) : hash(hashIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        char chType = DB_COIN;
+        READWRITE(chType);
+        READWRITE(hash);
+        READWRITE(VARINT(n));
+    }
+};
+
+/**
+ * Chainstate value of a single unspent output. The transaction metadata is
+ * repeated in every output, so that spending one output only deletes its own
+ * record instead of rewriting the whole transaction.
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nHeight * 2 + fCoinBase)
+ * - the CTxOut (via CTxOutCompressor)
+ */
+struct CCoinsDBOutput
+{
+    int nVersion;
+    int nHeight;
+    bool fCoinBase;
+    CTxOut txout;
+
+    CCoinsDBOutput() : nVersion(0), nHeight(0), fCoinBase(false) {}
+    CCoinsDBOutput(const CCoins& coins, unsigned int n) : nVersion(coins.nVersion), nHeight(coins.nHeight), fCoinBase(coins.fCoinBase), txout(coins.vout[n]) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionIn) {
+        READWRITE(VARINT(nVersion));
+        unsigned int nCode = nHeight * 2 + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(nCode));
+        nHeight = nCode >> 1;
+        fCoinBase = nCode & 1;
+        READWRITE(REF(CTxOutCompressor(txout)));
+    }
+};
+
+/**
+ * Chainstate key of the number of output slots of a transaction that has
+ * unspent outputs: 'N' + txid, holding a uint32_t that no output index
+ * reaches. It lets a transaction be read with point lookups.
+ */
+std::pair<char, uint256> CoinsSlotsKey(const uint256& txid)
+{
+    return std::make_pair(DB_COIN_SLOTS, txid);
+}
+
+/** Parse the output record at the cursor; returns false once the cursor has left the outputs. */
+bool ReadCoinsCursor(leveldb::Iterator* pcursor, uint256& txid, uint32_t& n, CCoinsDBOutput& output)
+{
+    if (!pcursor->Valid())
+        return false;
+    leveldb::Slice slKey = pcursor->key();
+    if (slKey.size() == 0 || slKey[0] != DB_COIN)
+        return false;
+    CSpanReader ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+    char chType;
+    ssKey >> chType >> txid >> VARINT(n);
+    leveldb::Slice slValue = pcursor->value();
+    CSpanReader ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+    ssValue >> output;
+    return true;
+}
+
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
-    batch.Write('B', hash);
+    batch.Write(DB_BEST_BLOCK, hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const CLevelDBProfile& profile) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, profile) {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair('c', txid), coins);
+    coins.Clear();
+    uint32_t nSlots;
+    if (!db.Read(CoinsSlotsKey(txid), nSlots))
+        return false;
+
+    // vout keeps all the slots, so the cache above knows which ones a
+    // write has to cover
+    bool fFound = false;
+    coins.vout.resize(nSlots);
+    for (uint32_t n = 0; n < nSlots; n++) {
+        CCoinsDBOutput output;
+        if (!db.Read(CCoinsDBKey(txid, n), output))
+            continue;
+        coins.vout[n] = output.txout;
+        coins.nVersion = output.nVersion;
+        coins.nHeight = output.nHeight;
+        coins.fCoinBase = output.fCoinBase;
+        fFound = true;
+    }
+    if (!fFound)
+        coins.Clear();
+    return fFound;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair('c', txid));
+    return db.Exists(CoinsSlotsKey(txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
     uint256 hashBestChain;
-    if (!db.Read('B', hashBestChain))
+    if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256(0);
     return hashBestChain;
 }
@@ -47,23 +157,232 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    size_t written = 0;
+    size_t erased = 0;
+    // The map is left intact: CCoinsViewAsyncWriter keeps serving reads from
+    // it while it is being written.
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            // Written from the cache entry alone: every unspent output is
+            // (re)written, and the other slots that were on disk when the
+            // entry was read are erased.
+            const CCoins &coins = it->second.coins;
+            unsigned int nBaseOutputs = it->second.nBaseOutputs;
+            for (unsigned int i = 0; i < std::max((unsigned int)coins.vout.size(), nBaseOutputs); i++) {
+                if (coins.IsAvailable(i)) {
+                    batch.Write(CCoinsDBKey(it->first, i), CCoinsDBOutput(coins, i));
+                    written++;
+                } else if (i < nBaseOutputs) {
+                    batch.Erase(CCoinsDBKey(it->first, i));
+                    erased++;
+                }
+            }
+            if (coins.IsPruned()) {
+                if (nBaseOutputs > 0)
+                    batch.Erase(CoinsSlotsKey(it->first));
+            } else if (coins.vout.size() != nBaseOutputs) {
+                batch.Write(CoinsSlotsKey(it->first), (uint32_t)coins.vout.size());
+            }
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database: %u outputs written, %u erased...\n",
+             (unsigned int)changed, (unsigned int)count, (unsigned int)written, (unsigned int)erased);
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CCoinsViewAsyncWriter::CCoinsViewAsyncWriter(CCoinsView* viewIn) : CCoinsViewBacked(viewIn), hashPending(0), fPending(false), fFailed(false), fStop(false),
+    thread(boost::bind(&CCoinsViewAsyncWriter::ThreadWrite, this)) {
+}
+
+CCoinsViewAsyncWriter::~CCoinsViewAsyncWriter() {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fStop = true;
+        cond.notify_all();
+    }
+    thread.join();
+}
+
+void CCoinsViewAsyncWriter::ThreadWrite() {
+    RenameThread("worldcoin-dbwrite");
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (true) {
+        while (!fPending && !fStop)
+            cond.wait(lock);
+        if (!fPending)
+            return;
+
+        // Nothing but this thread touches the pending batch until fPending
+        // is cleared, and readers only look at it, so write without the lock.
+        boost::function<bool()> fnPreCommit;
+        fnPreCommit.swap(fnPendingPreCommit);
+        lock.unlock();
+        int64_t nStart = GetTimeMicros();
+        bool fOk = true;
+        try {
+            if (fnPreCommit)
+                fOk = fnPreCommit();
+            if (fOk)
+                fOk = base->BatchWrite(mapPending, hashPending);
+        } catch (const std::exception& e) {
+            LogPrintf("%s : %s\n", __func__, e.what());
+            fOk = false;
+        }
+        LogPrint("coindb", "Background chainstate write of %u transactions: %.2fms\n", (unsigned int)mapPending.size(), 0.001 * (GetTimeMicros() - nStart));
+        lock.lock();
+
+        if (!fOk)
+            fFailed = true;
+        mapPending.clear();
+        fPending = false;
+        cond.notify_all();
+    }
+}
+
+bool CCoinsViewAsyncWriter::GetCoins(const uint256 &txid, CCoins &coins) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(txid);
+            if (it != mapPending.end()) {
+                if (it->second.coins.IsPruned())
+                    return false;
+                coins = it->second.coins;
+                return true;
+            }
+        }
+    }
+    return base->GetCoins(txid, coins);
+}
+
+bool CCoinsViewAsyncWriter::HaveCoins(const uint256 &txid) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(txid);
+            if (it != mapPending.end())
+                return !it->second.coins.IsPruned();
+        }
+    }
+    return base->HaveCoins(txid);
+}
+
+uint256 CCoinsViewAsyncWriter::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fPending && hashPending != uint256(0))
+            return hashPending;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewAsyncWriter::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (fPending)
+        cond.wait(lock);
+    if (fFailed)
+        return false;
+
+    // Take over the dirty entries; the clean ones are already on disk
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            CCoinsCacheEntry& entry = mapPending[it->first];
+            entry.coins.swap(it->second.coins);
+            entry.flags = it->second.flags;
+            entry.nBaseOutputs = it->second.nBaseOutputs;
+        }
+        CCoinsMap::iterator itOld = it++;
+        mapCoins.erase(itOld);
+    }
+    hashPending = hashBlock;
+    fnPendingPreCommit.swap(fnPreCommit);
+    fnPreCommit.clear();
+    fPending = true;
+    cond.notify_all();
+    return true;
+}
+
+bool CCoinsViewAsyncWriter::GetStats(CCoinsStats &stats) const {
+    if (!const_cast<CCoinsViewAsyncWriter*>(this)->Sync())
+        return false;
+    return base->GetStats(stats);
+}
+
+void CCoinsViewAsyncWriter::SetPreCommit(const boost::function<bool()>& fn) {
+    boost::unique_lock<boost::mutex> lock(cs);
+    fnPreCommit = fn;
+}
+
+bool CCoinsViewAsyncWriter::Sync() {
+    boost::unique_lock<boost::mutex> lock(cs);
+    while (fPending)
+        cond.wait(lock);
+    return !fFailed;
+}
+
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << DB_COINS;
+    pcursor->Seek(ssKeySet.str());
+    if (!pcursor->Valid() || pcursor->key()[0] != DB_COINS)
+        return true;
+
+    LogPrintf("Upgrading chainstate to one record per unspent output...\n");
+    uiInterface.InitMessage(_("Upgrading UTXO database..."));
+
+    // Each batch converts whole transactions, so an interrupted upgrade
+    // leaves a consistent mix of both layouts and resumes on next start.
+    CLevelDBBatch batch;
+    size_t nBatch = 0;
+    size_t nTransactions = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CSpanReader ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != DB_COINS)
+                break;
+            uint256 txid;
+            ssKey >> txid;
+            leveldb::Slice slValue = pcursor->value();
+            CSpanReader ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoins coins;
+            ssValue >> coins;
+
+            for (unsigned int i = 0; i < coins.vout.size(); i++) {
+                if (coins.IsAvailable(i)) {
+                    batch.Write(CCoinsDBKey(txid, i), CCoinsDBOutput(coins, i));
+                    nBatch++;
+                }
+            }
+            if (!coins.IsPruned())
+                batch.Write(CoinsSlotsKey(txid), (uint32_t)coins.vout.size());
+            batch.Erase(make_pair(DB_COINS, txid));
+            nTransactions++;
+            if (nBatch >= COINS_WRITE_BATCH) {
+                db.WriteBatch(batch);
+                batch.Clear();
+                nBatch = 0;
+            }
+            pcursor->Next();
+        } catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    db.WriteBatch(batch, true);
+    LogPrintf("Upgraded %u transactions in the chainstate\n", (unsigned int)nTransactions);
+    return true;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, const CLevelDBProfile& profile) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, profile) {
 }
 
 bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
@@ -99,59 +418,387 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read('l', nFile);
 }
 
+namespace {
+
+/** Totals over the outputs of the transactions whose txid starts with one byte value */
+struct CCoinsStatsPart
+{
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+    //! set hash of the outputs, so parts can be scanned and combined in any order
+    CMuHash3072 muhashOutputs;
+
+    CCoinsStatsPart() : nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+};
+
+/** Scan of a chainstate snapshot by one or more threads, each taking the next unscanned part */
+class CCoinsStatsScan
+{
+private:
+    CLevelDBWrapper& db;
+    const leveldb::Snapshot* snapshot;
+
+    boost::mutex cs;
+    unsigned int nNextPart;
+    unsigned int nPartsDone;
+    int nProgress;
+
+    bool ScanPart(unsigned int nPart, CCoinsStatsPart& part);
+
+public:
+    std::vector<CCoinsStatsPart> vParts;
+    bool fFailed;
+
+    CCoinsStatsScan(CLevelDBWrapper& dbIn, const leveldb::Snapshot* snapshotIn) :
+        db(dbIn), snapshot(snapshotIn), nNextPart(0), nPartsDone(0), nProgress(0), vParts(256), fFailed(false) {}
+
+    void Run();
+};
+
+bool CCoinsStatsScan::ScanPart(unsigned int nPart, CCoinsStatsPart& part)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator(snapshot));
+    std::string strKey(1, DB_COIN);
+    strKey += (char)nPart;
+    pcursor->Seek(strKey);
+
+    uint256 txhashPrev;
+    while (true) {
+        boost::this_thread::interruption_point();
+        try {
+            // The first byte of the serialized txid selects the part
+            if (pcursor->Valid() && (pcursor->key().size() < 2 || (unsigned char)pcursor->key()[1] != nPart))
+                break;
+            uint256 txhash;
+            uint32_t n;
+            CCoinsDBOutput output;
+            if (!ReadCoinsCursor(pcursor.get(), txhash, n, output))
+                break;
+            if (part.nTransactionOutputs == 0 || txhash != txhashPrev) {
+                part.nTransactions++;
+                txhashPrev = txhash;
+            }
+            part.nTransactionOutputs++;
+            CDataStream ss(SER_GETHASH, PROTOCOL_VERSION);
+            ss << txhash << VARINT(n) << VARINT(output.nVersion) << VARINT(output.nHeight * 2 + (output.fCoinBase ? 1 : 0)) << output.txout;
+            part.muhashOutputs.Insert((const unsigned char*)&ss[0], ss.size());
+            part.nTotalAmount += output.txout.nValue;
+            part.nSerializedSize += pcursor->key().size() + pcursor->value().size();
+            pcursor->Next();
+        } catch (std::exception &e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+void CCoinsStatsScan::Run()
+{
+    while (true) {
+        unsigned int nPart;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (fFailed || nNextPart == vParts.size())
+                return;
+            nPart = nNextPart++;
+        }
+        bool fOk = ScanPart(nPart, vParts[nPart]);
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fOk)
+            fFailed = true;
+        int nProgressNew = ++nPartsDone * 100 / vParts.size();
+        if (nProgressNew != nProgress) {
+            nProgress = nProgressNew;
+            uiInterface.ShowProgress(_("Computing UTXO set statistics..."), std::min(99, nProgress));
+        }
+    }
+}
+
+/** Release a LevelDB snapshot when leaving the scope */
+class CSnapshotReleaser
+{
+private:
+    CLevelDBWrapper& db;
+    const leveldb::Snapshot* snapshot;
+
+public:
+    CSnapshotReleaser(CLevelDBWrapper& dbIn, const leveldb::Snapshot* snapshotIn) : db(dbIn), snapshot(snapshotIn) {}
+    ~CSnapshotReleaser() { db.ReleaseSnapshot(snapshot); }
+};
+
+/** The best block marker as of a snapshot */
+uint256 ReadBestBlock(CLevelDBWrapper& db, const leveldb::Snapshot* snapshot)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator(snapshot));
+    pcursor->Seek(std::string(1, DB_BEST_BLOCK));
+    uint256 hashBlock = 0;
+    if (pcursor->Valid() && pcursor->key() == std::string(1, DB_BEST_BLOCK)) {
+        leveldb::Slice slValue = pcursor->value();
+        CSpanReader ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> hashBlock;
+    }
+    return hashBlock;
+}
+
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    CLevelDBWrapper& dbRead = const_cast<CLevelDBWrapper&>(db);
+    // Everything is read from one snapshot, so the statistics match its best
+    // block even if the chainstate is written to meanwhile.
+    const leveldb::Snapshot* snapshot = dbRead.GetSnapshot();
+    CSnapshotReleaser releaser(dbRead, snapshot);
+    int64_t nStart = GetTimeMicros();
+
+    stats.hashBlock = ReadBestBlock(dbRead, snapshot);
+
+    // The txid space is split in 256 parts, scanned by the -par threads
+    uiInterface.ShowProgress(_("Computing UTXO set statistics..."), 0);
+    CCoinsStatsScan scan(dbRead, snapshot);
+    int nThreads = std::max(nScriptCheckThreads, 1);
+    if (nThreads == 1) {
+        scan.Run();
+    } else {
+        boost::thread_group threads;
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&CCoinsStatsScan::Run, &scan));
+        try {
+            threads.join_all();
+        } catch (const boost::thread_interrupted&) {
+            // Stop the scan before it goes out of scope
+            threads.interrupt_all();
+            threads.join_all();
+            uiInterface.ShowProgress("", 100);
+            throw;
+        }
+    }
+    uiInterface.ShowProgress("", 100);
+    if (scan.fFailed)
+        return false;
 
+    CMuHash3072 muhashOutputs;
+    BOOST_FOREACH(const CCoinsStatsPart& part, scan.vParts) {
+        stats.nTransactions += part.nTransactions;
+        stats.nTransactionOutputs += part.nTransactionOutputs;
+        stats.nSerializedSize += part.nSerializedSize;
+        stats.nTotalAmount += part.nTotalAmount;
+        muhashOutputs *= part.muhashOutputs;
+    }
+    uint256 hashOutputs;
+    muhashOutputs.Finalize(hashOutputs.begin());
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = GetBestBlock();
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        try {
-            leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
+    ss << stats.hashBlock << hashOutputs;
+    stats.hashSerialized = ss.GetHash();
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(stats.hashBlock);
+        stats.nHeight = mi != mapBlockIndex.end() ? mi->second->nHeight : -1;
+    }
+    LogPrint("coindb", "%s : %u outputs scanned by %d threads in %.2fs\n", __func__, stats.nTransactionOutputs, nThreads, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+CCoinsSnapshotHeader::CCoinsSnapshotHeader() : nVersion(COINS_SNAPSHOT_VERSION), hashBlock(0) {
+    memcpy(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE);
+}
+
+bool CCoinsSnapshotReader::ReadHeader() {
+    try {
+        stream >> header;
+    } catch (std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (memcmp(header.pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+        return error("%s : snapshot is for another network", __func__);
+    if (header.nVersion != COINS_SNAPSHOT_VERSION)
+        return error("%s : unknown snapshot version %d", __func__, header.nVersion);
+    return true;
+}
+
+bool CCoinsSnapshotReader::ReadCoins(uint256& txid, CCoins& coins) {
+    stream >> txid;
+    if (txid == 0)
+        return false;
+    stream >> coins;
+    return true;
+}
+
+bool CCoinsSnapshotReader::ReadTrailer(uint64_t nTransactions, uint64_t nOutputs, uint256& hashChecksum) {
+    uint64_t nTransactionsFile, nOutputsFile;
+    stream >> nTransactionsFile >> nOutputsFile;
+    hashChecksum = stream.GetHash();
+    uint256 hashChecksumFile;
+    filein >> hashChecksumFile;
+    if (nTransactionsFile != nTransactions || nOutputsFile != nOutputs)
+        return error("%s : snapshot holds %u transactions with %u outputs, trailer says %u with %u", __func__,
+                     nTransactions, nOutputs, nTransactionsFile, nOutputsFile);
+    if (hashChecksumFile != hashChecksum)
+        return error("%s : snapshot checksum mismatch", __func__);
+    return true;
+}
+
+bool CCoinsViewDB::DumpSnapshot(CAutoFile& fileout, CCoinsStats& stats) const {
+    CLevelDBWrapper& dbRead = const_cast<CLevelDBWrapper&>(db);
+    const leveldb::Snapshot* snapshot = dbRead.GetSnapshot();
+    CSnapshotReleaser releaser(dbRead, snapshot);
+
+    CCoinsSnapshotHeader header;
+    header.hashBlock = ReadBestBlock(dbRead, snapshot);
+    stats.hashBlock = header.hashBlock;
+
+    uiInterface.ShowProgress(_("Writing UTXO snapshot..."), 0);
+    try {
+        CHashStream<CAutoFile> stream(&fileout);
+        stream << header;
+
+        boost::scoped_ptr<leveldb::Iterator> pcursor(dbRead.NewIterator(snapshot));
+        pcursor->Seek(std::string(1, DB_COIN));
+        // Outputs are stored by txid and index, so each transaction's
+        // outputs are adjacent and can be collected into one CCoins
+        uint256 txidPrev;
+        CCoins coins;
+        int nProgress = 0;
+        while (true) {
+            boost::this_thread::interruption_point();
+            uint256 txid;
+            uint32_t n;
+            CCoinsDBOutput output;
+            bool fMore = ReadCoinsCursor(pcursor.get(), txid, n, output);
+            if (!coins.vout.empty() && (!fMore || txid != txidPrev)) {
+                stream << txidPrev << coins;
                 stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+                coins = CCoins();
+            }
+            if (!fMore)
+                break;
+            if (coins.vout.empty()) {
+                coins.nVersion = output.nVersion;
+                coins.nHeight = output.nHeight;
+                coins.fCoinBase = output.fCoinBase;
+                txidPrev = txid;
+            }
+            if (n >= coins.vout.size())
+                coins.vout.resize(n + 1);
+            coins.vout[n] = output.txout;
+            stats.nTransactionOutputs++;
+            stats.nTotalAmount += output.txout.nValue;
+            int nProgressNew = *txid.begin() * 100 / 256;
+            if (nProgressNew != nProgress) {
+                nProgress = nProgressNew;
+                uiInterface.ShowProgress(_("Writing UTXO snapshot..."), nProgress);
             }
             pcursor->Next();
-        } catch (std::exception &e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
+        stream << uint256(0) << stats.nTransactions << stats.nTransactionOutputs;
+        stats.hashSerialized = stream.GetHash();
+        fileout << stats.hashSerialized;
+        stats.nSerializedSize = stream.GetCount() + sizeof(uint256);
+    } catch (const boost::thread_interrupted&) {
+        uiInterface.ShowProgress("", 100);
+        throw;
+    } catch (std::exception &e) {
+        uiInterface.ShowProgress("", 100);
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
-    stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
+    uiInterface.ShowProgress("", 100);
     return true;
 }
 
+bool CCoinsViewDB::LoadSnapshot(CCoinsSnapshotReader& reader, uint64_t nFileSize, const uint256& hashExpected, CCoinsStats& stats) {
+    stats.hashBlock = reader.header.hashBlock;
+
+    // Until the last batch, the chainstate has no best block and is marked
+    // as loading, so a failed or interrupted load is not mistaken for a
+    // usable one.
+    CLevelDBBatch batch;
+    size_t nBatch = 0;
+
+    uiInterface.ShowProgress(_("Loading UTXO snapshot..."), 0);
+    try {
+        batch.Write(DB_SNAPSHOT_LOADING, reader.header.hashBlock);
+        batch.Erase(DB_BEST_BLOCK);
+        db.WriteBatch(batch, true);
+        batch.Clear();
+
+        // Drop the unspent outputs that are there now
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+        pcursor->Seek(std::string(1, DB_COIN));
+        uint256 txid;
+        uint32_t n;
+        CCoinsDBOutput output;
+        while (ReadCoinsCursor(pcursor.get(), txid, n, output)) {
+            boost::this_thread::interruption_point();
+            batch.Erase(CCoinsDBKey(txid, n));
+            batch.Erase(CoinsSlotsKey(txid));
+            if (++nBatch >= COINS_WRITE_BATCH) {
+                db.WriteBatch(batch);
+                batch.Clear();
+                nBatch = 0;
+            }
+            pcursor->Next();
+        }
+
+        CCoins coins;
+        int nProgress = 0;
+        while (reader.ReadCoins(txid, coins)) {
+            boost::this_thread::interruption_point();
+            stats.nTransactions++;
+            for (unsigned int i = 0; i < coins.vout.size(); i++) {
+                if (coins.IsAvailable(i)) {
+                    batch.Write(CCoinsDBKey(txid, i), CCoinsDBOutput(coins, i));
+                    stats.nTransactionOutputs++;
+                    stats.nTotalAmount += coins.vout[i].nValue;
+                    nBatch++;
+                }
+            }
+            if (!coins.IsPruned())
+                batch.Write(CoinsSlotsKey(txid), (uint32_t)coins.vout.size());
+            if (nBatch >= COINS_WRITE_BATCH) {
+                db.WriteBatch(batch);
+                batch.Clear();
+                nBatch = 0;
+                int nProgressNew = nFileSize ? std::min((uint64_t)99, reader.GetPosition() * 100 / nFileSize) : 0;
+                if (nProgressNew != nProgress) {
+                    nProgress = nProgressNew;
+                    uiInterface.ShowProgress(_("Loading UTXO snapshot..."), nProgress);
+                }
+            }
+        }
+        if (!reader.ReadTrailer(stats.nTransactions, stats.nTransactionOutputs, stats.hashSerialized)) {
+            uiInterface.ShowProgress("", 100);
+            return false;
+        }
+        // Checked before the best block is set, so a snapshot nobody vouched
+        // for is never used
+        if (stats.hashSerialized != hashExpected) {
+            uiInterface.ShowProgress("", 100);
+            return error("%s : snapshot checksum %s is not the expected %s", __func__, stats.hashSerialized.ToString(), hashExpected.ToString());
+        }
+        stats.nSerializedSize = reader.GetPosition() + sizeof(uint256);
+    } catch (const boost::thread_interrupted&) {
+        uiInterface.ShowProgress("", 100);
+        throw;
+    } catch (std::exception &e) {
+        uiInterface.ShowProgress("", 100);
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    batch.Erase(DB_SNAPSHOT_LOADING);
+    BatchWriteHashBestChain(batch, reader.header.hashBlock);
+    db.WriteBatch(batch, true);
+    uiInterface.ShowProgress("", 100);
+    return true;
+}
+
+bool CCoinsViewDB::IsLoadingSnapshot() const {
+    return db.Exists(DB_SNAPSHOT_LOADING);
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair('t', txid), pos);
 }
@@ -175,7 +822,7 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+bool CBlockTreeDB::LoadBlockIndexGuts(unsigned int nPoWCheckSample)
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
 
@@ -188,12 +835,12 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
         boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            CSpanReader ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
             if (chType == 'b') {
                 leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+                CSpanReader ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
                 CDiskBlockIndex diskindex;
                 ssValue >> diskindex;
 
@@ -211,15 +858,21 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nNonce         = diskindex.nNonce;
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
-
-                // Worldcoin: Disable PoW Sanity check while loading block index from disk.
-                // We use the sha256 hash for the block index for performance reasons, which is recorded for later use.
-                // CheckProofOfWork() uses the scrypt hash which is discarded after a block is accepted.
-                // While it is technically feasible to verify the PoW, doing so takes several minutes as it
-                // requires recomputing every PoW hash during every Worldcoin startup.
-                // We opt instead to simply trust the data that is on your local disk.
-                //if (!CheckProofOfWork(pindexNew->GetBlockPoWHash(), pindexNew->nBits))
-                //    return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
+                pindexNew->hashPoW        = diskindex.hashPoW;
+
+                // Worldcoin: Recomputing the Argon2d hash of every header takes several minutes,
+                // so the hash is stored alongside the index entry when the header is accepted.
+                // Like the rest of the entry it is trusted from the local disk: checking it
+                // against nBits only catches corruption, and a random sample is recomputed
+                // from the header to catch a hash that does not belong to it. Entries without
+                // a stored hash are verified (and upgraded) once by LoadBlockIndexDB().
+                if (pindexNew->nStatus & BLOCK_HAVE_POWHASH) {
+                    if (!CheckProofOfWork(pindexNew->hashPoW, pindexNew->nBits))
+                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
+                    if (nPoWCheckSample > 0 && insecure_rand() % nPoWCheckSample == 0 &&
+                        pindexNew->GetBlockHeader().GetPoWHash() != pindexNew->hashPoW)
+                        return error("LoadBlockIndex() : stored PoW hash does not match header: %s", pindexNew->ToString());
+                }
 
                 pcursor->Next();
             } else {
@@ -6,14 +6,21 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "hash.h"
 #include "leveldbwrapper.h"
 #include "main.h"
+#include "streams.h"
 
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 class CCoins;
 class uint256;
 
@@ -23,27 +30,145 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! On average one in this many stored PoW hashes is recomputed when the block index is loaded
+static const unsigned int DEFAULT_POWHASH_CHECK_SAMPLE = 1000;
+
+//! Format version of the UTXO set snapshots written by CCoinsViewDB::DumpSnapshot
+static const int COINS_SNAPSHOT_VERSION = 1;
+
+/**
+ * Start of a UTXO set snapshot file, naming the network and the block whose
+ * unspent outputs follow.
+ *
+ * Snapshot file format:
+ * - the header
+ * - for every transaction with unspent outputs: txid, CCoins
+ * - uint256(0)
+ * - uint64 number of transactions, uint64 number of unspent outputs
+ * - SHA256d of everything above
+ */
+class CCoinsSnapshotHeader
+{
+public:
+    MessageStartChars pchMessageStart;
+    int nVersion;
+    uint256 hashBlock;
+
+    //! A header for the current network and format version
+    CCoinsSnapshotHeader();
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionIn) {
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(nVersion);
+        READWRITE(hashBlock);
+    }
+};
+
+/** Sequential reader of a UTXO set snapshot file, checking its checksum at the end */
+class CCoinsSnapshotReader
+{
+private:
+    CAutoFile& filein;
+    CHashStream<CAutoFile> stream;
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+public:
+    CCoinsSnapshotHeader header;
+
+    CCoinsSnapshotReader(CAutoFile& fileinIn) : filein(fileinIn), stream(&filein) {}
+
+    //! Read the header; fails if the snapshot is for another network or format version
+    bool ReadHeader();
+    //! Read the next transaction's unspent outputs; false after the last one
+    bool ReadCoins(uint256& txid, CCoins& coins);
+    //! Read the trailer after the last transaction and check it against the counts seen; hashChecksum receives the file's checksum
+    bool ReadTrailer(uint64_t nTransactions, uint64_t nOutputs, uint256& hashChecksum);
+    //! Number of bytes read so far
+    uint64_t GetPosition() const { return stream.GetCount(); }
+};
+
+/**
+ * CCoinsView backed by the LevelDB coin database (chainstate/). Every unspent
+ * output is stored under its own key, next to the number of output slots of
+ * its transaction, and CCoins records are assembled from point reads of the
+ * outputs when they are read.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CLevelDBProfile& profile = CLevelDBProfile());
 
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+    //! Convert a chainstate written with one record per transaction, in place
+    bool Upgrade();
+    //! Write a snapshot of all unspent outputs to fileout; stats receives the block and totals
+    bool DumpSnapshot(CAutoFile& fileout, CCoinsStats& stats) const;
+    //! Replace all unspent outputs with those of a snapshot whose header was read already; its checksum must be hashExpected
+    bool LoadSnapshot(CCoinsSnapshotReader& reader, uint64_t nFileSize, const uint256& hashExpected, CCoinsStats& stats);
+    //! Whether a LoadSnapshot was interrupted, leaving an incomplete chainstate
+    bool IsLoadingSnapshot() const;
+    //! Figures about the underlying database
+    void GetDBStats(CLevelDBStats &stats) const { db.GetStats(stats); }
+    const CLevelDBProfile& GetDBProfile() const { return db.GetProfile(); }
+    //! See CLevelDBWrapper::EndBulkLoad
+    void EndBulkLoad() { db.EndBulkLoad(); }
+};
+
+/**
+ * Layer above CCoinsViewDB that commits flushed batches from its own thread,
+ * so that a flush under cs_main only hands the dirty entries over instead of
+ * waiting for LevelDB. While a batch is in flight its entries are served from
+ * memory. One batch is in flight at a time; handing over the next one waits
+ * for it. Each batch carries the best block marker, so the database is never
+ * ahead of or behind a consistent chainstate.
+ */
+class CCoinsViewAsyncWriter : public CCoinsViewBacked
+{
+private:
+    mutable boost::mutex cs;
+    boost::condition_variable cond;
+    CCoinsMap mapPending;
+    uint256 hashPending;
+    boost::function<bool()> fnPendingPreCommit;
+    boost::function<bool()> fnPreCommit;
+    bool fPending;
+    bool fFailed;
+    bool fStop;
+    boost::thread thread;
+
+    void ThreadWrite();
+
+public:
+    CCoinsViewAsyncWriter(CCoinsView* viewIn);
+    //! Finishes the batch in flight
+    ~CCoinsViewAsyncWriter();
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) const;
+    bool HaveCoins(const uint256 &txid) const;
+    uint256 GetBestBlock() const;
+    //! Returns false if an earlier batch failed to be written
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool GetStats(CCoinsStats &stats) const;
+
+    //! Run fn in the writer thread before the next batch is committed; the batch is dropped if it fails
+    void SetPreCommit(const boost::function<bool()>& fn);
+    //! Wait until all batches are written; false if any of them failed
+    bool Sync();
 };
 
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CLevelDBProfile& profile = CLevelDBProfile());
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
@@ -59,7 +184,7 @@ public:
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts();
+    bool LoadBlockIndexGuts(unsigned int nPoWCheckSample = DEFAULT_POWHASH_CHECK_SAMPLE);
 };
 
 #endif // BITCOIN_TXDB_H
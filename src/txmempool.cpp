@@ -6,6 +6,7 @@
 #include "txmempool.h"
 
 #include "clientversion.h"
+#include "core_memusage.h"
 #include "main.h"
 #include "streams.h"
 #include "util.h"
@@ -17,7 +18,9 @@
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
-    nFee(0), nTxSize(0), nModSize(0), nTime(0), dPriority(0.0)
+    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), nFeeDelta(0),
+    nCountWithAncestors(1), nSizeWithAncestors(0), nModFeesWithAncestors(0),
+    nCountWithDescendants(1), nSizeWithDescendants(0), nModFeesWithDescendants(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
@@ -25,11 +28,19 @@ CTxMemPoolEntry::CTxMemPoolEntry():
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _dPriority,
                                  unsigned int _nHeight):
-    tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
+    tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight), nFeeDelta(0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
 
     nModSize = tx.CalculateModifiedSize(nTxSize);
+    nUsageSize = RecursiveDynamicUsage(tx);
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = nTxSize;
+    nModFeesWithDescendants = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -373,7 +384,14 @@ public:
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
     nTransactionsUpdated(0),
-    minRelayFee(_minRelayFee)
+    minRelayFee(_minRelayFee),
+    totalTxSize(0),
+    cachedInnerUsage(0),
+    nEvicted(0),
+    rollingMinimumFeeRate(0),
+    lastRollingFeeUpdate(GetTime()),
+    blockSinceLastRollingFeeBump(false),
+    fJournalComplete(false)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -418,6 +436,156 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
+void CTxMemPool::JournalChange(const uint256& hash, bool fAdded)
+{
+    if (!fJournalComplete)
+        return;
+    if (vJournal.size() >= MEMPOOL_JOURNAL_MAX) {
+        // Nobody is reading; stop recording until the next ReadJournal()
+        vJournal.clear();
+        fJournalComplete = false;
+        return;
+    }
+    vJournal.push_back(std::make_pair(hash, fAdded));
+}
+
+bool CTxMemPool::ReadJournal(std::vector<std::pair<uint256, bool> >& vChanges)
+{
+    LOCK(cs);
+    vChanges.clear();
+    vChanges.swap(vJournal);
+    bool fComplete = fJournalComplete;
+    fJournalComplete = true;
+    return fComplete;
+}
+
+
+void CTxMemPool::IndexEntry(const CTxMemPoolEntry* entry)
+{
+    setByFeeRate.insert(entry);
+    setByAncestorFeeRate.insert(entry);
+    setByDescendantScore.insert(entry);
+    setByEntryTime.insert(entry);
+}
+
+void CTxMemPool::UnindexEntry(const CTxMemPoolEntry* entry)
+{
+    setByFeeRate.erase(entry);
+    setByAncestorFeeRate.erase(entry);
+    setByDescendantScore.erase(entry);
+    setByEntryTime.erase(entry);
+}
+
+void CTxMemPool::CalculateAncestors(const uint256& hash, std::set<uint256>& setAncestors) const
+{
+    LOCK(cs);
+    setAncestors.clear();
+    std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.find(hash);
+    if (it == mapTx.end())
+        return;
+    std::vector<const CTransaction*> vToVisit(1, &it->second.GetTx());
+    while (!vToVisit.empty())
+    {
+        const CTransaction* ptx = vToVisit.back();
+        vToVisit.pop_back();
+        BOOST_FOREACH(const CTxIn& txin, ptx->vin)
+        {
+            std::map<uint256, CTxMemPoolEntry>::const_iterator itParent = mapTx.find(txin.prevout.hash);
+            if (itParent != mapTx.end() && setAncestors.insert(txin.prevout.hash).second)
+                vToVisit.push_back(&itParent->second.GetTx());
+        }
+    }
+}
+
+void CTxMemPool::CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const
+{
+    LOCK(cs);
+    setDescendants.clear();
+    std::vector<uint256> vToVisit(1, hash);
+    while (!vToVisit.empty())
+    {
+        uint256 hashParent = vToVisit.back();
+        vToVisit.pop_back();
+        // mapNextTx is ordered by outpoint, so the spends of hashParent are adjacent
+        std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.lower_bound(COutPoint(hashParent, 0));
+        for (; it != mapNextTx.end() && it->first.hash == hashParent; ++it)
+        {
+            const uint256& hashChild = it->second.ptx->GetHash();
+            if (setDescendants.insert(hashChild).second)
+                vToVisit.push_back(hashChild);
+        }
+    }
+}
+
+bool CTxMemPool::CheckPackageLimits(const CTransaction& tx, uint64_t nLimitAncestorCount, uint64_t nLimitAncestorSize,
+                                    uint64_t nLimitDescendantCount, uint64_t nLimitDescendantSize, std::string& errString) const
+{
+    LOCK(cs);
+    uint64_t nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nSizeWithAncestors = nTxSize;
+    std::set<uint256> setAncestors;
+    std::vector<const CTransaction*> vToVisit(1, &tx);
+    while (!vToVisit.empty())
+    {
+        const CTransaction* ptx = vToVisit.back();
+        vToVisit.pop_back();
+        BOOST_FOREACH(const CTxIn& txin, ptx->vin)
+        {
+            std::map<uint256, CTxMemPoolEntry>::const_iterator itParent = mapTx.find(txin.prevout.hash);
+            if (itParent == mapTx.end() || !setAncestors.insert(txin.prevout.hash).second)
+                continue;
+            nSizeWithAncestors += itParent->second.GetTxSize();
+            if (setAncestors.size() + 1 > nLimitAncestorCount) {
+                errString = strprintf("too many unconfirmed ancestors [limit: %u]", nLimitAncestorCount);
+                return false;
+            }
+            if (nSizeWithAncestors > nLimitAncestorSize) {
+                errString = strprintf("exceeds ancestor size limit [limit: %u]", nLimitAncestorSize);
+                return false;
+            }
+            vToVisit.push_back(&itParent->second.GetTx());
+        }
+    }
+
+    // tx becomes a descendant of each of its ancestors
+    BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+    {
+        const CTxMemPoolEntry& ancestor = mapTx.find(hashAncestor)->second;
+        if (ancestor.GetCountWithDescendants() + 1 > nLimitDescendantCount) {
+            errString = strprintf("too many descendants for tx %s [limit: %u]", hashAncestor.ToString(), nLimitDescendantCount);
+            return false;
+        }
+        if (ancestor.GetSizeWithDescendants() + nTxSize > nLimitDescendantSize) {
+            errString = strprintf("exceeds descendant size limit for tx %s [limit: %u]", hashAncestor.ToString(), nLimitDescendantSize);
+            return false;
+        }
+    }
+    return true;
+}
+
+void CTxMemPool::UpdateDescendants(const uint256& hash, int64_t nCountDelta, int64_t nSizeDelta, CAmount nModFeeDelta)
+{
+    std::set<uint256> setDescendants;
+    CalculateDescendants(hash, setDescendants);
+    BOOST_FOREACH(const uint256& hashDescendant, setDescendants)
+    {
+        CTxMemPoolEntry& descendant = mapTx.find(hashDescendant)->second;
+        setByAncestorFeeRate.erase(&descendant);
+        descendant.nCountWithAncestors += nCountDelta;
+        descendant.nSizeWithAncestors += nSizeDelta;
+        descendant.nModFeesWithAncestors += nModFeeDelta;
+        setByAncestorFeeRate.insert(&descendant);
+    }
+}
+
+void CTxMemPool::AdjustDescendantState(CTxMemPoolEntry& entry, int64_t nCountDelta, int64_t nSizeDelta, CAmount nModFeeDelta)
+{
+    setByDescendantScore.erase(&entry);
+    entry.nCountWithDescendants += nCountDelta;
+    entry.nSizeWithDescendants += nSizeDelta;
+    entry.nModFeesWithDescendants += nModFeeDelta;
+    setByDescendantScore.insert(&entry);
+}
 
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry)
 {
@@ -426,12 +594,96 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry)
     // all the appropriate checks.
     LOCK(cs);
     {
-        mapTx[hash] = entry;
-        const CTransaction& tx = mapTx[hash].GetTx();
+        if (mapTx.count(hash))
+            return true;
+        CTxMemPoolEntry& newEntry = mapTx[hash];
+        newEntry = entry;
+        std::map<uint256, std::pair<double, CAmount> >::const_iterator pos = mapDeltas.find(hash);
+        if (pos != mapDeltas.end())
+            newEntry.nFeeDelta = pos->second.second;
+        int64_t nSize = newEntry.GetTxSize();
+        CAmount nModFee = newEntry.GetModifiedFee();
+
+        // The packages around the new entry grow by it instead of being
+        // recounted. Its ancestors are found through mapTx, and children it
+        // may already have (when it is re-added after a reorg) through the
+        // spends of its outputs, so both are known before its own inputs are
+        // linked into mapNextTx.
+        std::set<uint256> setAncestors, setDescendants;
+        CalculateAncestors(hash, setAncestors);
+        CalculateDescendants(hash, setDescendants);
+
+        newEntry.nCountWithAncestors = 1;
+        newEntry.nSizeWithAncestors = nSize;
+        newEntry.nModFeesWithAncestors = nModFee;
+        BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+        {
+            const CTxMemPoolEntry& ancestor = mapTx.find(hashAncestor)->second;
+            newEntry.nCountWithAncestors++;
+            newEntry.nSizeWithAncestors += ancestor.GetTxSize();
+            newEntry.nModFeesWithAncestors += ancestor.GetModifiedFee();
+        }
+        newEntry.nCountWithDescendants = 1;
+        newEntry.nSizeWithDescendants = nSize;
+        newEntry.nModFeesWithDescendants = nModFee;
+        std::vector<CTxMemPoolEntry*> vDescendants;
+        BOOST_FOREACH(const uint256& hashDescendant, setDescendants)
+        {
+            CTxMemPoolEntry& descendant = mapTx.find(hashDescendant)->second;
+            newEntry.nCountWithDescendants++;
+            newEntry.nSizeWithDescendants += descendant.GetTxSize();
+            newEntry.nModFeesWithDescendants += descendant.GetModifiedFee();
+            vDescendants.push_back(&descendant);
+        }
+
+        if (vDescendants.empty()) {
+            // The usual case: each ancestor gains just the new entry
+            BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+                AdjustDescendantState(mapTx.find(hashAncestor)->second, 1, nSize, nModFee);
+        } else {
+            // Each child gains the new entry, and each pair of an ancestor
+            // and a child that were not linked yet gain each other
+            BOOST_FOREACH(CTxMemPoolEntry* pdescendant, vDescendants)
+            {
+                setByAncestorFeeRate.erase(pdescendant);
+                pdescendant->nCountWithAncestors++;
+                pdescendant->nSizeWithAncestors += nSize;
+                pdescendant->nModFeesWithAncestors += nModFee;
+            }
+            BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+            {
+                CTxMemPoolEntry& ancestor = mapTx.find(hashAncestor)->second;
+                std::set<uint256> setLinked;
+                CalculateDescendants(hashAncestor, setLinked);
+                int64_t nCountDelta = 1;
+                int64_t nSizeDelta = nSize;
+                CAmount nModFeeDelta = nModFee;
+                BOOST_FOREACH(CTxMemPoolEntry* pdescendant, vDescendants)
+                {
+                    if (setLinked.count(pdescendant->GetTx().GetHash()))
+                        continue;
+                    nCountDelta++;
+                    nSizeDelta += pdescendant->GetTxSize();
+                    nModFeeDelta += pdescendant->GetModifiedFee();
+                    pdescendant->nCountWithAncestors++;
+                    pdescendant->nSizeWithAncestors += ancestor.GetTxSize();
+                    pdescendant->nModFeesWithAncestors += ancestor.GetModifiedFee();
+                }
+                AdjustDescendantState(ancestor, nCountDelta, nSizeDelta, nModFeeDelta);
+            }
+            BOOST_FOREACH(CTxMemPoolEntry* pdescendant, vDescendants)
+                setByAncestorFeeRate.insert(pdescendant);
+        }
+
+        const CTransaction& tx = newEntry.GetTx();
         for (unsigned int i = 0; i < tx.vin.size(); i++)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
         nTransactionsUpdated++;
         totalTxSize += entry.GetTxSize();
+        cachedInnerUsage += entry.GetDynamicMemoryUsage();
+        IndexEntry(&newEntry);
+
+        JournalChange(hash, true);
     }
     return true;
 }
@@ -456,14 +708,20 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                 txToRemove.push_back(it->second.ptx->GetHash());
             }
         }
+        // Collect everything that goes first, parents before children, so
+        // the packages of the transactions that stay can be corrected while
+        // the links between them are still there
+        std::vector<uint256> vRemove;
+        std::set<uint256> setRemove;
         while (!txToRemove.empty())
         {
             uint256 hash = txToRemove.front();
             txToRemove.pop_front();
-            if (!mapTx.count(hash))
+            if (!mapTx.count(hash) || !setRemove.insert(hash).second)
                 continue;
-            const CTransaction& tx = mapTx[hash].GetTx();
+            vRemove.push_back(hash);
             if (fRecursive) {
+                const CTransaction& tx = mapTx[hash].GetTx();
                 for (unsigned int i = 0; i < tx.vout.size(); i++) {
                     std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
                     if (it == mapNextTx.end())
@@ -471,13 +729,49 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                     txToRemove.push_back(it->second.ptx->GetHash());
                 }
             }
+        }
+        BOOST_FOREACH(const uint256& hash, vRemove)
+        {
+            CTxMemPoolEntry& entry = mapTx[hash];
+            int64_t nSize = entry.GetTxSize();
+            CAmount nModFee = entry.GetModifiedFee();
+
+            // Children left in the pool lose this transaction from their packages
+            std::set<uint256> setDescendants;
+            CalculateDescendants(hash, setDescendants);
+            BOOST_FOREACH(const uint256& hashDescendant, setDescendants)
+            {
+                if (setRemove.count(hashDescendant))
+                    continue;
+                CTxMemPoolEntry& descendant = mapTx.find(hashDescendant)->second;
+                setByAncestorFeeRate.erase(&descendant);
+                descendant.nCountWithAncestors--;
+                descendant.nSizeWithAncestors -= nSize;
+                descendant.nModFeesWithAncestors -= nModFee;
+                setByAncestorFeeRate.insert(&descendant);
+            }
+            // ... and parents left in the pool lose it from theirs
+            std::set<uint256> setAncestors;
+            CalculateAncestors(hash, setAncestors);
+            BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+                if (!setRemove.count(hashAncestor))
+                    AdjustDescendantState(mapTx.find(hashAncestor)->second, -1, -nSize, -nModFee);
+        }
+        BOOST_FOREACH(const uint256& hash, vRemove)
+        {
+            const CTxMemPoolEntry& entry = mapTx[hash];
+            const CTransaction& tx = entry.GetTx();
+            UnindexEntry(&entry);
+
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
                 mapNextTx.erase(txin.prevout);
 
             removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
+            totalTxSize -= entry.GetTxSize();
+            cachedInnerUsage -= entry.GetDynamicMemoryUsage();
             mapTx.erase(hash);
             nTransactionsUpdated++;
+            JournalChange(hash, false);
         }
     }
 }
@@ -539,6 +833,7 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
             entries.push_back(mapTx[hash]);
     }
     minerPolicyEstimator->seenBlock(entries, nBlockHeight, minRelayFee);
+    blockSinceLastRollingFeeBump = true;
     BOOST_FOREACH(const CTransaction& tx, vtx)
     {
         std::list<CTransaction> dummy;
@@ -552,10 +847,17 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
 void CTxMemPool::clear()
 {
     LOCK(cs);
+    setByFeeRate.clear();
+    setByAncestorFeeRate.clear();
+    setByDescendantScore.clear();
+    setByEntryTime.clear();
     mapTx.clear();
     mapNextTx.clear();
     totalTxSize = 0;
+    cachedInnerUsage = 0;
     ++nTransactionsUpdated;
+    vJournal.clear();
+    fJournalComplete = false;
 }
 
 void CTxMemPool::check(const CCoinsViewCache *pcoins) const
@@ -566,6 +868,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     LogPrint("mempool", "Checking mempool with %u transactions and %u inputs\n", (unsigned int)mapTx.size(), (unsigned int)mapNextTx.size());
 
     uint64_t checkTotal = 0;
+    uint64_t innerUsage = 0;
 
     CCoinsViewCache mempoolDuplicate(const_cast<CCoinsViewCache*>(pcoins));
 
@@ -574,6 +877,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         unsigned int i = 0;
         checkTotal += it->second.GetTxSize();
+        innerUsage += it->second.GetDynamicMemoryUsage();
         const CTransaction& tx = it->second.GetTx();
         bool fDependsWait = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
@@ -629,6 +933,111 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
     }
 
     assert(totalTxSize == checkTotal);
+    assert(innerUsage == cachedInnerUsage);
+
+    // The orderings index every entry, and packages match a recount
+    assert(setByFeeRate.size() == mapTx.size());
+    assert(setByAncestorFeeRate.size() == mapTx.size());
+    assert(setByDescendantScore.size() == mapTx.size());
+    assert(setByEntryTime.size() == mapTx.size());
+    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        assert(setByAncestorFeeRate.count(&it->second));
+        std::set<uint256> setAncestors;
+        CalculateAncestors(it->first, setAncestors);
+        uint64_t nSize = it->second.GetTxSize();
+        CAmount nModFees = it->second.GetModifiedFee();
+        BOOST_FOREACH(const uint256& hashAncestor, setAncestors) {
+            nSize += mapTx.find(hashAncestor)->second.GetTxSize();
+            nModFees += mapTx.find(hashAncestor)->second.GetModifiedFee();
+        }
+        assert(it->second.GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(it->second.GetSizeWithAncestors() == nSize);
+        assert(it->second.GetModFeesWithAncestors() == nModFees);
+
+        assert(setByDescendantScore.count(&it->second));
+        std::set<uint256> setDescendants;
+        CalculateDescendants(it->first, setDescendants);
+        nSize = it->second.GetTxSize();
+        nModFees = it->second.GetModifiedFee();
+        BOOST_FOREACH(const uint256& hashDescendant, setDescendants) {
+            nSize += mapTx.find(hashDescendant)->second.GetTxSize();
+            nModFees += mapTx.find(hashDescendant)->second.GetModifiedFee();
+        }
+        assert(it->second.GetCountWithDescendants() == setDescendants.size() + 1);
+        assert(it->second.GetSizeWithDescendants() == nSize);
+        assert(it->second.GetModFeesWithDescendants() == nModFees);
+    }
+}
+
+size_t CTxMemPool::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return memusage::DynamicUsage(mapTx) + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) +
+           memusage::DynamicUsage(setByFeeRate) + memusage::DynamicUsage(setByAncestorFeeRate) +
+           memusage::DynamicUsage(setByDescendantScore) + memusage::DynamicUsage(setByEntryTime) + cachedInnerUsage;
+}
+
+unsigned int CTxMemPool::TrimToSize(size_t nSizeLimit)
+{
+    LOCK(cs);
+    unsigned int nRemoved = 0;
+    CFeeRate maxFeeRateRemoved(0);
+    while (!mapTx.empty() && DynamicMemoryUsage() > nSizeLimit)
+    {
+        // The entry with the worst descendant score goes, together with
+        // everything spending it. Scoring by descendants keeps a cheap parent
+        // whose children pay for it (CPFP).
+        const CTxMemPoolEntry* worst = *setByDescendantScore.rbegin();
+        CAmount nFees = worst->GetModFeesWithDescendants();
+        size_t nSize = worst->GetSizeWithDescendants();
+
+        // Anything joining later has to pay more than what was just dropped
+        CFeeRate feeRateRemoved(CFeeRate(nFees, nSize).GetFeePerK() + minRelayFee.GetFeePerK());
+        if (feeRateRemoved.GetFeePerK() > rollingMinimumFeeRate)
+        {
+            rollingMinimumFeeRate = feeRateRemoved.GetFeePerK();
+            blockSinceLastRollingFeeBump = false;
+        }
+        maxFeeRateRemoved = std::max(maxFeeRateRemoved, feeRateRemoved);
+
+        std::list<CTransaction> removed;
+        CTransaction tx = worst->GetTx();
+        remove(tx, removed, true);
+        nRemoved += removed.size();
+    }
+    nEvicted += nRemoved;
+    if (nRemoved > 0)
+        LogPrint("mempool", "Removed %u txn to stay below %u bytes, rolling minimum fee bumped to %s\n",
+                 nRemoved, nSizeLimit, maxFeeRateRemoved.ToString());
+    return nRemoved;
+}
+
+CFeeRate CTxMemPool::GetMinFee(size_t nSizeLimit) const
+{
+    LOCK(cs);
+    if (!blockSinceLastRollingFeeBump || rollingMinimumFeeRate == 0)
+        return CFeeRate((CAmount)rollingMinimumFeeRate);
+
+    int64_t nTime = GetTime();
+    if (nTime > lastRollingFeeUpdate + 10)
+    {
+        double halflife = ROLLING_FEE_HALFLIFE;
+        size_t nUsage = DynamicMemoryUsage();
+        if (nUsage < nSizeLimit / 4)
+            halflife /= 4;
+        else if (nUsage < nSizeLimit / 2)
+            halflife /= 2;
+
+        rollingMinimumFeeRate = rollingMinimumFeeRate / pow(2.0, (nTime - lastRollingFeeUpdate) / halflife);
+        lastRollingFeeUpdate = nTime;
+
+        if (rollingMinimumFeeRate < minRelayFee.GetFeePerK() / 2)
+        {
+            rollingMinimumFeeRate = 0;
+            return CFeeRate(0);
+        }
+    }
+    return std::max(CFeeRate((CAmount)rollingMinimumFeeRate), minRelayFee);
 }
 
 void CTxMemPool::queryHashes(vector<uint256>& vtxid)
@@ -703,6 +1112,26 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount> &deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+
+        std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+        if (it != mapTx.end() && nFeeDelta != 0)
+        {
+            CTxMemPoolEntry& entry = it->second;
+            UnindexEntry(&entry);
+            entry.nFeeDelta += nFeeDelta;
+            entry.nModFeesWithAncestors += nFeeDelta;
+            entry.nModFeesWithDescendants += nFeeDelta;
+            IndexEntry(&entry);
+            UpdateDescendants(hash, 0, 0, nFeeDelta);
+            std::set<uint256> setAncestors;
+            CalculateAncestors(hash, setAncestors);
+            BOOST_FOREACH(const uint256& hashAncestor, setAncestors)
+                AdjustDescendantState(mapTx.find(hashAncestor)->second, 0, 0, nFeeDelta);
+        }
+
+        // Selection order changed, cached templates must be rebuilt
+        vJournal.clear();
+        fJournalComplete = false;
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -6,7 +6,9 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <algorithm>
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
@@ -27,6 +29,9 @@ inline bool AllowFree(double dPriority)
     return dPriority > AllowFreeThreshold();
 }
 
+/** Changes the mempool journal holds before it gives up and forces a full template rebuild */
+static const unsigned int MEMPOOL_JOURNAL_MAX = 10000;
+
 /** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
@@ -40,9 +45,23 @@ private:
     CAmount nFee; //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize; //! ... and avoid recomputing tx size
     size_t nModSize; //! ... and modified size for priority
+    size_t nUsageSize; //! ... and total memory usage
     int64_t nTime; //! Local time when entering the mempool
     double dPriority; //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    CAmount nFeeDelta; //! Fee adjustment from PrioritiseTransaction
+
+    //! This transaction together with all its unconfirmed ancestors, maintained by CTxMemPool
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+
+    //! This transaction together with all its descendants in the pool, maintained by CTxMemPool
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
+
+    friend class CTxMemPool;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -54,8 +73,84 @@ public:
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
     size_t GetTxSize() const { return nTxSize; }
+    size_t GetDynamicMemoryUsage() const { return nUsageSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+};
+
+/** Order mempool entries by modified fee rate, highest first */
+class CompareTxMemPoolEntryByFeeRate
+{
+public:
+    bool operator()(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) const
+    {
+        // Cross-multiply in floating point, sizes times fees can overflow 64 bits
+        double f1 = (double)a->GetModifiedFee() * b->GetTxSize();
+        double f2 = (double)b->GetModifiedFee() * a->GetTxSize();
+        if (f1 == f2)
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        return f1 > f2;
+    }
+};
+
+/** Order mempool entries by the fee rate of the package of them and their unconfirmed ancestors, highest first */
+class CompareTxMemPoolEntryByAncestorFeeRate
+{
+public:
+    bool operator()(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) const
+    {
+        double f1 = (double)a->GetModFeesWithAncestors() * b->GetSizeWithAncestors();
+        double f2 = (double)b->GetModFeesWithAncestors() * a->GetSizeWithAncestors();
+        if (f1 == f2)
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        return f1 > f2;
+    }
+};
+
+/**
+ * Order mempool entries by the higher of their own fee rate and the fee rate
+ * of them with all their descendants, highest first. The last entry is the
+ * one whose removal, with its descendants, loses the least: a parent paid
+ * for by its children ranks by what the children pay.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) const
+    {
+        double f1 = GetScore(a) * b->GetTxSize() * b->GetSizeWithDescendants();
+        double f2 = GetScore(b) * a->GetTxSize() * a->GetSizeWithDescendants();
+        if (f1 == f2)
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        return f1 > f2;
+    }
+
+private:
+    /** The score as a fraction over GetTxSize() * GetSizeWithDescendants() */
+    static double GetScore(const CTxMemPoolEntry* e)
+    {
+        return std::max((double)e->GetModifiedFee() * e->GetSizeWithDescendants(),
+                        (double)e->GetModFeesWithDescendants() * e->GetTxSize());
+    }
+};
+
+/** Order mempool entries by the time they entered the pool, oldest first */
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) const
+    {
+        if (a->GetTime() == b->GetTime())
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        return a->GetTime() < b->GetTime();
+    }
 };
 
 class CMinerPolicyEstimator;
@@ -92,13 +187,45 @@ private:
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+    uint64_t nEvicted; //! Transactions dropped by TrimToSize()
+
+    //! Minimum fee rate to enter a pool that had to evict, in satoshis per 1000 bytes; decays once blocks drain the pool
+    mutable double rollingMinimumFeeRate;
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+
+    std::vector<std::pair<uint256, bool> > vJournal; //! Transactions added (true) or removed (false) since the last ReadJournal()
+    bool fJournalComplete; //! False once vJournal no longer describes every change
+
+    void JournalChange(const uint256& hash, bool fAdded);
+
+    void IndexEntry(const CTxMemPoolEntry* entry);
+    void UnindexEntry(const CTxMemPoolEntry* entry);
+    /** Adjust the packages of all descendants of hash */
+    void UpdateDescendants(const uint256& hash, int64_t nCountDelta, int64_t nSizeDelta, CAmount nModFeeDelta);
+    /** Adjust the descendant package of an entry and re-sort it */
+    void AdjustDescendantState(CTxMemPoolEntry& entry, int64_t nCountDelta, int64_t nSizeDelta, CAmount nModFeeDelta);
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; //! seconds
+
     mutable CCriticalSection cs;
     std::map<uint256, CTxMemPoolEntry> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
+    /**
+     * Secondary orderings of mapTx, kept in step by addUnchecked, remove and
+     * PrioritiseTransaction so block assembly and eviction can read the best
+     * or worst entries off an end instead of sorting the pool. Read-only
+     * outside CTxMemPool; guarded by cs like mapTx.
+     */
+    std::set<const CTxMemPoolEntry*, CompareTxMemPoolEntryByFeeRate> setByFeeRate;
+    std::set<const CTxMemPoolEntry*, CompareTxMemPoolEntryByAncestorFeeRate> setByAncestorFeeRate;
+    std::set<const CTxMemPoolEntry*, CompareTxMemPoolEntryByDescendantScore> setByDescendantScore;
+    std::set<const CTxMemPoolEntry*, CompareTxMemPoolEntryByEntryTime> setByEntryTime;
+
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
 
@@ -119,10 +246,31 @@ public:
                         std::list<CTransaction>& conflicts);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
+    /** Hashes of the unconfirmed transactions hash depends on, directly or not (excluding hash) */
+    void CalculateAncestors(const uint256& hash, std::set<uint256>& setAncestors) const;
+    /** Hashes of the pool transactions that spend hash, directly or not (excluding hash) */
+    void CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const;
+    /**
+     * Check that adding tx keeps it with its in-pool ancestors, and each of
+     * those with its descendants, within the given count and size (in bytes)
+     * limits. The ancestor walk stops at the first limit exceeded. Returns
+     * false with the reason in errString otherwise.
+     */
+    bool CheckPackageLimits(const CTransaction& tx, uint64_t nLimitAncestorCount, uint64_t nLimitAncestorSize,
+                            uint64_t nLimitDescendantCount, uint64_t nLimitDescendantSize, std::string& errString) const;
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
 
+    /**
+     * Move the transactions added and removed since the last call into vChanges,
+     * in order, so a block template can be patched instead of rebuilt. Returns
+     * false if some changes were not recorded (the journal overflowed, the pool
+     * was cleared or a transaction was prioritised); the caller must then start
+     * over from mapTx. There is a single reader, the block template cache.
+     */
+    bool ReadJournal(std::vector<std::pair<uint256, bool> >& vChanges);
+
     /** Affect CreateNewBlock prioritisation of transactions */
     void PrioritiseTransaction(const uint256 hash, const std::string strHash, double dPriorityDelta, const CAmount& nFeeDelta);
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta);
@@ -138,6 +286,28 @@ public:
         LOCK(cs);
         return totalTxSize;
     }
+    uint64_t GetEvictedCount()
+    {
+        LOCK(cs);
+        return nEvicted;
+    }
+
+    /** Heap memory used by the pool: its maps, indexes and transactions */
+    size_t DynamicMemoryUsage() const;
+
+    /**
+     * Evict the lowest descendant-score packages until DynamicMemoryUsage() is at most
+     * nSizeLimit bytes, raising the rolling minimum fee above each evicted
+     * package. Returns the number of transactions removed.
+     */
+    unsigned int TrimToSize(size_t nSizeLimit);
+
+    /**
+     * The fee rate a transaction must pay to enter the pool: zero unless the pool
+     * had to evict. The rolling minimum halves every ROLLING_FEE_HALFLIFE after a
+     * block arrives, faster while the pool is well below nSizeLimit.
+     */
+    CFeeRate GetMinFee(size_t nSizeLimit) const;
 
     bool exists(uint256 hash)
     {